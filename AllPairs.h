@@ -0,0 +1,230 @@
+#ifndef METROPATH_ALL_PAIRS_H
+#define METROPATH_ALL_PAIRS_H
+
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "CompactGraph.h"
+#include "Route.h"
+#include "ShortestPath.h"
+
+// Precomputed cost and next-hop matrices for every ordered station pair under
+// one metric, stored row-major in contiguous arrays. Queries are an O(1)
+// lookup plus O(path) reconstruction by following next hops.
+//
+// The table is kept current across edge edits: an insertion is folded in
+// with one O(V^2) relaxation pass, a removal recomputes only the rows whose
+// shortest-path tree could have used the edge.
+//
+// The matrices are read through views, so a table can also be attached to
+// arrays inside a mapped snapshot; the first edit copies them into memory
+// the table owns.
+class AllPairsTable {
+public:
+    AllPairsTable() {}
+    AllPairsTable(const AllPairsTable&) = delete;
+    AllPairsTable& operator=(const AllPairsTable&) = delete;
+    AllPairsTable(AllPairsTable&&) = default;
+    AllPairsTable& operator=(AllPairsTable&&) = default;
+
+    bool empty() const {
+        return n == 0;
+    }
+
+    Metric metricType() const {
+        return metric;
+    }
+
+    // One Dijkstra per source, spread over the given number of threads
+    // (0 = one per hardware thread).
+    void build(const CompactGraph& g, Metric metric, unsigned threads = 0) {
+        this->metric = metric;
+        n = g.numVertex();
+        backing.reset();
+        costStore.assign((size_t)n * n, INT_MAX);
+        nextStore.assign((size_t)n * n, CompactGraph::NO_STATION);
+        cost = costStore;
+        next = nextStore;
+
+        std::vector<uint32_t> rows(n);
+        for (uint32_t s = 0; s < n; s++) {
+            rows[s] = s;
+        }
+        computeRows(g, rows, threads);
+    }
+
+    // Uses n x n matrices owned by someone else, typically a mapped
+    // snapshot; backing keeps them alive.
+    void attach(Metric metric, uint32_t n, const int* costs, const uint32_t* hops,
+                std::shared_ptr<const void> backing) {
+        this->metric = metric;
+        this->n = n;
+        costStore.clear();
+        nextStore.clear();
+        cost = ArrayView<int>(costs, (size_t)n * n);
+        next = ArrayView<uint32_t>(hops, (size_t)n * n);
+        this->backing = backing;
+    }
+
+    // Row-major n x n matrices, for writing the table out.
+    const int* costData() const {
+        return cost.data();
+    }
+
+    const uint32_t* nextData() const {
+        return next.data();
+    }
+
+    int costOf(uint32_t s, uint32_t t) const {
+        return cost[(size_t)s * n + t];
+    }
+
+    bool reachable(uint32_t s, uint32_t t) const {
+        return costOf(s, t) != INT_MAX;
+    }
+
+    // First station after s on a shortest path to t.
+    uint32_t nextHop(uint32_t s, uint32_t t) const {
+        return next[(size_t)s * n + t];
+    }
+
+    void route(const CompactGraph& g, uint32_t s, uint32_t t, Route& out) const {
+        out.reset(metric);
+        if (!reachable(s, t)) {
+            return;
+        }
+        out.cost = costOf(s, t);
+        for (uint32_t v = s; v != t; v = nextHop(v, t)) {
+            out.stations.push_back(v);
+        }
+        out.stations.push_back(t);
+        completeRoute(g, out);
+    }
+
+    // Folds in a new edge u - v (or a cheaper weight for an existing one).
+    // A shortest path uses the new edge at most once, so every pair only
+    // has to be checked against s -> u -> v -> t and s -> v -> u -> t.
+    void edgeAdded(uint32_t u, uint32_t v, int w) {
+        detach();
+        std::vector<int> fromU(cost.begin() + (size_t)u * n, cost.begin() + (size_t)(u + 1) * n);
+        std::vector<int> fromV(cost.begin() + (size_t)v * n, cost.begin() + (size_t)(v + 1) * n);
+
+        for (uint32_t s = 0; s < n; s++) {
+            int* row = &costStore[(size_t)s * n];
+            uint32_t* hop = &nextStore[(size_t)s * n];
+            int su = row[u], sv = row[v];
+            uint32_t hopU = s == u ? v : hop[u];
+            uint32_t hopV = s == v ? u : hop[v];
+
+            for (uint32_t t = 0; t < n; t++) {
+                if (su != INT_MAX && fromV[t] != INT_MAX && su + w + fromV[t] < row[t]) {
+                    row[t] = su + w + fromV[t];
+                    hop[t] = hopU;
+                }
+                if (sv != INT_MAX && fromU[t] != INT_MAX && sv + w + fromU[t] < row[t]) {
+                    row[t] = sv + w + fromU[t];
+                    hop[t] = hopV;
+                }
+            }
+        }
+    }
+
+    // Repairs the table after edge u - v of weight w was removed. g must
+    // already be the graph without the edge.
+    void edgeRemoved(const CompactGraph& g, uint32_t u, uint32_t v, int w, unsigned threads = 0) {
+        detach();
+        std::vector<uint32_t> rows;
+        for (uint32_t s = 0; s < n; s++) {
+            int su = costOf(s, u), sv = costOf(s, v);
+            bool tight = (su != INT_MAX && su + w == sv) || (sv != INT_MAX && sv + w == su);
+            if (tight) {
+                rows.push_back(s);
+            }
+        }
+        computeRows(g, rows, threads);
+    }
+
+private:
+    uint32_t n = 0;
+    Metric metric = Metric::Distance;
+    ArrayView<int> cost;
+    ArrayView<uint32_t> next;
+    std::vector<int> costStore;
+    std::vector<uint32_t> nextStore;
+    std::shared_ptr<const void> backing; // set while viewing someone else's arrays
+
+    void detach() {
+        if (backing) {
+            costStore.assign(cost.begin(), cost.end());
+            nextStore.assign(next.begin(), next.end());
+            cost = costStore;
+            next = nextStore;
+            backing.reset();
+        }
+    }
+
+    void computeRows(const CompactGraph& g, const std::vector<uint32_t>& rows, unsigned threads) {
+        if (threads == 0) {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (threads <= 1 || rows.size() < 2) {
+            DijkstraSearch search;
+            std::vector<uint32_t> scratch;
+            for (uint32_t s : rows) {
+                computeRow(g, s, search, scratch);
+            }
+            return;
+        }
+
+        std::vector<std::thread> workers;
+        for (unsigned k = 0; k < threads; k++) {
+            workers.push_back(std::thread([this, &g, &rows, k, threads]() {
+                DijkstraSearch search;
+                std::vector<uint32_t> scratch;
+                for (size_t i = k; i < rows.size(); i += threads) {
+                    computeRow(g, rows[i], search, scratch);
+                }
+            }));
+        }
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+    // One full sweep from s; next hops are found by walking each vertex's
+    // predecessor chain up to the first vertex whose hop is already known.
+    void computeRow(const CompactGraph& g, uint32_t s, DijkstraSearch& search,
+                    std::vector<uint32_t>& chain) {
+        search.run(g, s, CompactGraph::NO_STATION, metric);
+        const std::vector<uint32_t>& pred = search.predecessors();
+        int* row = &costStore[(size_t)s * n];
+        uint32_t* hop = &nextStore[(size_t)s * n];
+
+        for (uint32_t t = 0; t < n; t++) {
+            row[t] = search.cost(t);
+            hop[t] = CompactGraph::NO_STATION;
+        }
+        hop[s] = s;
+
+        for (uint32_t t = 0; t < n; t++) {
+            if (row[t] == INT_MAX || hop[t] != CompactGraph::NO_STATION) {
+                continue;
+            }
+            chain.clear();
+            uint32_t v = t;
+            while (hop[v] == CompactGraph::NO_STATION && pred[v] != s) {
+                chain.push_back(v);
+                v = pred[v];
+            }
+            uint32_t first = hop[v] == CompactGraph::NO_STATION ? v : hop[v];
+            hop[v] = first;
+            for (uint32_t c : chain) {
+                hop[c] = first;
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,313 @@
+#ifndef METROPATH_ALTERNATIVES_H
+#define METROPATH_ALTERNATIVES_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include "CompactGraph.h"
+#include "IndexedHeap.h"
+#include "Route.h"
+
+// Tuning for AlternativeRoutes::diverse. Percentages are of the best route's
+// cost.
+struct DiversityOptions {
+    int penaltyPercent = 40;     // added to every arc of each route found
+    int maxStretchPercent = 150; // longer alternatives are not offered
+    int maxSharePercent = 80;    // reject routes sharing more with one found
+    int maxIterations = 0;       // searches before giving up, 0 = 4 * k
+};
+
+// Several different routes between two stations, for when the best one is
+// disrupted. Both methods return Routes ordered as found, each with its own
+// cost (in the metric's unit, without penalties), stations and interchanges.
+//
+// All searches go through one Dijkstra whose cost, predecessor and ban
+// arrays are validated by timestamps instead of being cleared, so the many
+// spur searches of one query each cost only what they settle. Yen's spur
+// searches run as A* towards dst on exact remaining costs, which keeps them
+// to the corridor around the routes already found.
+class AlternativeRoutes {
+public:
+    // The k cheapest loopless routes (Yen's algorithm, spurring each new
+    // route only from the station where it left its parent, after Lawler).
+    // Fewer if there are not k.
+    void kShortest(const CompactGraph& g, uint32_t src, uint32_t dst, Metric metric, size_t k,
+                   std::vector<Route>& out) {
+        out.clear();
+        settled = 0;
+        prepare(g);
+        candidates.clear();
+        deviation.clear();
+        if (k == 0) {
+            return;
+        }
+        const int* w = g.weights(metric);
+
+        // Exact costs to dst (arcs come in symmetric pairs, so a sweep from
+        // dst gives them) steer every spur search straight at dst; bans only
+        // make the true remaining cost larger, so they stay lower bounds.
+        nextBan();
+        toDst.resize(g.numVertex());
+        search(g, w, dst, CompactGraph::NO_STATION);
+        for (uint32_t v = 0; v < g.numVertex(); v++) {
+            toDst[v] = seen[v] == stamp ? dist[v] : INT_MAX;
+        }
+        if (toDst[src] == INT_MAX) {
+            return;
+        }
+        search(g, w, src, dst, toDst.data());
+        out.push_back(Route());
+        finish(g, metric, dst, out.back());
+        deviation.push_back(0);
+
+        while (out.size() < k) {
+            const Route& last = out.back();
+            for (size_t i = deviation.back(); i + 1 < last.stations.size(); i++) {
+                uint32_t spur = last.stations[i];
+                nextBan();
+                for (size_t j = 0; j < i; j++) {
+                    vertexBan[last.stations[j]] = banStamp;
+                }
+                for (const Route& r : out) {
+                    if (r.stations.size() > i + 1 &&
+                        std::equal(r.stations.begin(), r.stations.begin() + i + 1, last.stations.begin())) {
+                        arcBan[g.arc(r.stations[i], r.stations[i + 1])] = banStamp;
+                    }
+                }
+                if (!search(g, w, spur, dst, toDst.data())) {
+                    continue;
+                }
+
+                Candidate c;
+                c.deviation = i;
+                c.cost = 0;
+                c.stations.assign(last.stations.begin(), last.stations.begin() + i);
+                for (size_t j = 0; j < i; j++) {
+                    c.cost += last.legs[j];
+                }
+                c.cost += dist[dst];
+                size_t root = c.stations.size();
+                for (uint32_t v = dst; v != NONE; v = pred[v]) {
+                    c.stations.push_back(v);
+                }
+                std::reverse(c.stations.begin() + root, c.stations.end());
+                if (!known(out, c.stations) && !queued(c.stations)) {
+                    candidates.push_back(std::move(c));
+                }
+            }
+            if (candidates.empty()) {
+                break;
+            }
+
+            size_t best = 0;
+            for (size_t j = 1; j < candidates.size(); j++) {
+                if (candidates[j].cost < candidates[best].cost) {
+                    best = j;
+                }
+            }
+            out.push_back(Route());
+            out.back().metric = metric;
+            out.back().cost = candidates[best].cost;
+            out.back().stations.swap(candidates[best].stations);
+            completeRoute(g, out.back());
+            deviation.push_back(candidates[best].deviation);
+            candidates[best] = std::move(candidates.back());
+            candidates.pop_back();
+        }
+    }
+
+    // Up to k routes that differ noticeably (the penalty method): after each
+    // search every arc of the route found is made dearer, which pushes the
+    // next search elsewhere. Routes much costlier than the best, or mostly
+    // overlapping one already returned, are skipped.
+    void diverse(const CompactGraph& g, uint32_t src, uint32_t dst, Metric metric, size_t k,
+                 const DiversityOptions& options, std::vector<Route>& out) {
+        out.clear();
+        settled = 0;
+        prepare(g);
+        if (k == 0) {
+            return;
+        }
+        const int* w = g.weights(metric);
+        penalised.resize(g.numArcs()); // in hundredths, so small weights still grow
+        for (uint32_t a = 0; a < g.numArcs(); a++) {
+            penalised[a] = w[a] * 100;
+        }
+        used.assign(g.numArcs(), 0);
+        int iterations = options.maxIterations > 0 ? options.maxIterations : (int)(4 * k);
+
+        nextBan();
+        for (int it = 0; it < iterations && out.size() < k; it++) {
+            if (!search(g, penalised.data(), src, dst)) {
+                break;
+            }
+            Route r;
+            finish(g, metric, dst, r);
+            bool accept = out.empty() ||
+                          (long long)r.cost * 100 <= (long long)out[0].cost * options.maxStretchPercent;
+            accept = accept && !known(out, r.stations);
+            for (size_t j = 0; accept && j < out.size(); j++) {
+                long long shared = 0;
+                for (size_t i = 0; i + 1 < r.stations.size(); i++) {
+                    if (used[g.arc(r.stations[i], r.stations[i + 1])] & bit(j)) {
+                        shared += r.legs[i];
+                    }
+                }
+                accept = shared * 100 <= (long long)r.cost * options.maxSharePercent;
+            }
+
+            for (size_t i = 0; i + 1 < r.stations.size(); i++) {
+                uint32_t u = r.stations[i], v = r.stations[i + 1];
+                for (uint32_t a : {g.arc(u, v), g.arc(v, u)}) {
+                    penalised[a] += w[a] * options.penaltyPercent;
+                    if (accept) {
+                        used[a] |= bit(out.size());
+                    }
+                }
+            }
+            if (accept) {
+                out.push_back(std::move(r));
+            }
+        }
+    }
+
+    // Vertices settled over all searches of the last query.
+    uint32_t settledCount() const {
+        return settled;
+    }
+
+private:
+    enum : uint32_t { NONE = UINT32_MAX };
+
+    struct Candidate {
+        int cost;
+        size_t deviation; // index of the spur station
+        std::vector<uint32_t> stations;
+    };
+
+    std::vector<int> dist;
+    std::vector<uint32_t> pred;
+    std::vector<uint32_t> seen; // == stamp marks dist and pred as valid
+    std::vector<uint32_t> vertexBan;
+    std::vector<uint32_t> arcBan;
+    uint32_t stamp = 0;
+    uint32_t banStamp = 0;
+    IndexedHeap<int> heap;
+    uint32_t settled = 0;
+
+    std::vector<Candidate> candidates;
+    std::vector<int> toDst;
+    std::vector<size_t> deviation; // per route returned by kShortest
+    std::vector<int> penalised;
+    std::vector<uint64_t> used; // bit j: arc is on diverse route j (first 64)
+
+    static uint64_t bit(size_t j) {
+        return j < 64 ? (uint64_t)1 << j : 0;
+    }
+
+    void prepare(const CompactGraph& g) {
+        uint32_t n = g.numVertex();
+        if (seen.size() != n) {
+            dist.assign(n, INT_MAX);
+            pred.assign(n, NONE);
+            seen.assign(n, 0);
+            vertexBan.assign(n, 0);
+            heap.resize(n);
+            stamp = 0;
+            banStamp = 0;
+        }
+        if (arcBan.size() != g.numArcs()) {
+            arcBan.assign(g.numArcs(), 0);
+            banStamp = 0;
+        }
+    }
+
+    // Starts a new set of banned vertices and arcs, empty until marked.
+    void nextBan() {
+        if (++banStamp == 0) {
+            std::fill(vertexBan.begin(), vertexBan.end(), 0);
+            std::fill(arcBan.begin(), arcBan.end(), 0);
+            banStamp = 1;
+        }
+    }
+
+    // Dijkstra from src to dst under weights w, avoiding the current bans.
+    // With a potential h (exact or lower-bound cost to dst) it is A*:
+    // vertices are queued by cost + h and those with h INT_MAX are skipped.
+    bool search(const CompactGraph& g, const int* w, uint32_t src, uint32_t dst,
+                const int* h = nullptr) {
+        if (++stamp == 0) {
+            std::fill(seen.begin(), seen.end(), 0);
+            stamp = 1;
+        }
+        heap.clear();
+        seen[src] = stamp;
+        dist[src] = 0;
+        pred[src] = NONE;
+        heap.add(src, h ? h[src] : 0);
+
+        while (!heap.isEmpty()) {
+            uint32_t v;
+            int key;
+            heap.remove(v, key);
+            settled++;
+            if (v == dst) {
+                return true;
+            }
+            int cost = dist[v];
+            for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                uint32_t nbr = g.targets[a];
+                if (arcBan[a] == banStamp || vertexBan[nbr] == banStamp) {
+                    continue;
+                }
+                if (h && h[nbr] == INT_MAX) {
+                    continue;
+                }
+                int nc = cost + w[a];
+                if (seen[nbr] != stamp || nc < dist[nbr]) {
+                    seen[nbr] = stamp;
+                    dist[nbr] = nc;
+                    pred[nbr] = v;
+                    heap.addOrUpdate(nbr, h ? nc + h[nbr] : nc);
+                }
+            }
+        }
+        return false;
+    }
+
+    // Route from the last search's predecessors, costed with the metric's
+    // own weights.
+    void finish(const CompactGraph& g, Metric metric, uint32_t dst, Route& out) const {
+        out.reset(metric);
+        for (uint32_t v = dst; v != NONE; v = pred[v]) {
+            out.stations.push_back(v);
+        }
+        std::reverse(out.stations.begin(), out.stations.end());
+        completeRoute(g, out);
+        out.cost = 0;
+        for (int leg : out.legs) {
+            out.cost += leg;
+        }
+    }
+
+    static bool known(const std::vector<Route>& routes, const std::vector<uint32_t>& stations) {
+        for (const Route& r : routes) {
+            if (r.stations == stations) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool queued(const std::vector<uint32_t>& stations) const {
+        for (const Candidate& c : candidates) {
+            if (c.stations == stations) {
+                return true;
+            }
+        }
+        return false;
+    }
+};
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef METROPATH_BATCH_QUERY_H
+#define METROPATH_BATCH_QUERY_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include "CompactGraph.h"
+#include "Route.h"
+#include "ShortestPath.h"
+#include "ThreadPool.h"
+
+// One origin-destination request in a batch, by compact station id.
+struct ODQuery {
+    uint32_t src;
+    uint32_t dst;
+    Metric metric;
+};
+
+// Answers large batches of OD queries on a thread pool. Each worker keeps
+// its own DijkstraSearch for the lifetime of the engine, so steady-state
+// batches do not reallocate search buffers. The graph is passed as an
+// immutable snapshot and is only read.
+class BatchQueryEngine {
+public:
+    explicit BatchQueryEngine(unsigned threads = 0) : pool(threads), searches(pool.size()) {}
+
+    unsigned threads() const {
+        return pool.size();
+    }
+
+    // results[i] answers queries[i]. Unknown ids give an empty route.
+    void run(const std::shared_ptr<const CompactGraph>& graph,
+             const std::vector<ODQuery>& queries, std::vector<Route>& results) {
+        const CompactGraph& g = *graph;
+        results.resize(queries.size());
+        pool.parallelFor(queries.size(), GRAIN, [&](unsigned worker, size_t begin, size_t end) {
+            DijkstraSearch& search = searches[worker];
+            for (size_t i = begin; i < end; i++) {
+                const ODQuery& q = queries[i];
+                if (!valid(g, q)) {
+                    results[i].reset(q.metric);
+                    continue;
+                }
+                search.run(g, q.src, q.dst, q.metric);
+                search.route(g, q.dst, results[i]);
+            }
+        });
+    }
+
+    // Cost-only variant for fare tables and replays: skips route
+    // reconstruction. Unreachable or unknown pairs give INT_MAX.
+    void runCosts(const std::shared_ptr<const CompactGraph>& graph,
+                  const std::vector<ODQuery>& queries, std::vector<int>& costs) {
+        const CompactGraph& g = *graph;
+        costs.resize(queries.size());
+        pool.parallelFor(queries.size(), GRAIN, [&](unsigned worker, size_t begin, size_t end) {
+            DijkstraSearch& search = searches[worker];
+            for (size_t i = begin; i < end; i++) {
+                const ODQuery& q = queries[i];
+                if (!valid(g, q)) {
+                    costs[i] = INT_MAX;
+                    continue;
+                }
+                search.run(g, q.src, q.dst, q.metric);
+                costs[i] = search.cost(q.dst);
+            }
+        });
+    }
+
+    // Many-to-many mode. Groups the batch by source, or by target when that
+    // gives fewer groups, and answers each group from one sweep that stops
+    // once the group's last station is settled. The network is undirected,
+    // so sweeping "backwards" from a target uses the same CSR arrays.
+    void runGrouped(const std::shared_ptr<const CompactGraph>& graph,
+                    const std::vector<ODQuery>& queries, std::vector<Route>& results) {
+        const CompactGraph& g = *graph;
+        results.assign(queries.size(), Route());
+        grouped(g, queries, [&](const DijkstraSearch& search, size_t i, bool bySource) {
+            const ODQuery& q = queries[i];
+            Route& out = results[i];
+            out.metric = q.metric;
+            if (bySource) {
+                search.route(g, q.dst, out);
+            } else if (search.cost(q.src) != INT_MAX) {
+                buildRouteToRoot(g, search.predecessors(), q.src, q.metric, search.cost(q.src), out);
+            }
+        });
+        for (size_t i = 0; i < queries.size(); i++) {
+            results[i].metric = queries[i].metric;
+        }
+    }
+
+    void runGroupedCosts(const std::shared_ptr<const CompactGraph>& graph,
+                         const std::vector<ODQuery>& queries, std::vector<int>& costs) {
+        const CompactGraph& g = *graph;
+        costs.assign(queries.size(), INT_MAX);
+        grouped(g, queries, [&](const DijkstraSearch& search, size_t i, bool bySource) {
+            costs[i] = search.cost(bySource ? queries[i].dst : queries[i].src);
+        });
+    }
+
+private:
+    // Queries per chunk: large enough to amortise deque locking, small
+    // enough that stealing can still even out a skewed batch.
+    static const size_t GRAIN = 64;
+
+    ThreadPool pool;
+    std::vector<DijkstraSearch> searches; // one per worker
+
+    std::vector<size_t> order;      // query indices sorted into groups
+    std::vector<size_t> groupStart; // group k is order[groupStart[k] .. groupStart[k + 1])
+    std::vector<std::vector<uint32_t>> targets; // per-worker scratch
+
+    static bool valid(const CompactGraph& g, const ODQuery& q) {
+        return q.src < g.numVertex() && q.dst < g.numVertex();
+    }
+
+    // Sorts the valid queries by (metric, key) and records group bounds.
+    template <typename Key>
+    size_t groupBy(const std::vector<ODQuery>& queries, Key key) {
+        std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+            if (queries[a].metric != queries[b].metric) {
+                return queries[a].metric < queries[b].metric;
+            }
+            return key(queries[a]) < key(queries[b]);
+        });
+        groupStart.clear();
+        for (size_t k = 0; k < order.size(); k++) {
+            if (k == 0 || queries[order[k]].metric != queries[order[k - 1]].metric ||
+                key(queries[order[k]]) != key(queries[order[k - 1]])) {
+                groupStart.push_back(k);
+            }
+        }
+        groupStart.push_back(order.size());
+        return groupStart.size() - 1;
+    }
+
+    // Runs one multi-target sweep per group and calls
+    // emit(search, queryIndex, bySource) for every query in it.
+    template <typename Emit>
+    void grouped(const CompactGraph& g, const std::vector<ODQuery>& queries, Emit emit) {
+        order.clear();
+        for (size_t i = 0; i < queries.size(); i++) {
+            if (valid(g, queries[i])) {
+                order.push_back(i);
+            }
+        }
+
+        auto src = [](const ODQuery& q) { return q.src; };
+        auto dst = [](const ODQuery& q) { return q.dst; };
+        size_t sources = groupBy(queries, src);
+        size_t dests = groupBy(queries, dst);
+        bool bySource = sources <= dests;
+        if (bySource) {
+            groupBy(queries, src);
+        }
+
+        targets.resize(pool.size());
+        pool.parallelFor(groupStart.size() - 1, 1, [&](unsigned worker, size_t begin, size_t end) {
+            DijkstraSearch& search = searches[worker];
+            std::vector<uint32_t>& wanted = targets[worker];
+            for (size_t k = begin; k < end; k++) {
+                const ODQuery& first = queries[order[groupStart[k]]];
+                wanted.clear();
+                for (size_t j = groupStart[k]; j < groupStart[k + 1]; j++) {
+                    const ODQuery& q = queries[order[j]];
+                    wanted.push_back(bySource ? q.dst : q.src);
+                }
+                search.runToAll(g, bySource ? first.src : first.dst, wanted.data(), wanted.size(),
+                                first.metric);
+                for (size_t j = groupStart[k]; j < groupStart[k + 1]; j++) {
+                    emit(search, order[j], bySource);
+                }
+            }
+        });
+    }
+};
+
+#endif
@@ -0,0 +1,424 @@
+#ifndef METROPATH_COMPACT_GRAPH_H
+#define METROPATH_COMPACT_GRAPH_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+
+// Which edge weight a search minimises. Distances are stored in km, times in
+// seconds using the fixed 120s dwell plus 40s per km model.
+enum class Metric { Distance = 0, Time = 1 };
+
+inline int travelTime(int distance) {
+    return 120 + 40 * distance;
+}
+
+// Longest edge a network file may declare. Far beyond any real metro hop,
+// and small enough that times and route totals stay clear of int overflow.
+const int MAX_EDGE_KM = 1000;
+
+// Lines are identified by the capital letters used in a station's "~BGP"
+// suffix; a set of lines is a bitmask with 'A' as bit 0.
+inline uint32_t lineMask(const char* code, size_t len) {
+    uint32_t mask = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (code[i] >= 'A' && code[i] <= 'Z') {
+            mask |= 1u << (code[i] - 'A');
+        }
+    }
+    return mask;
+}
+
+// Lowest line letter index in a non-empty mask.
+inline uint32_t firstLine(uint32_t mask) {
+    uint32_t line = 0;
+    while ((mask & 1) == 0) {
+        mask >>= 1;
+        line++;
+    }
+    return line;
+}
+
+inline uint32_t stationLineMask(const std::string& name) {
+    size_t tilde = name.find('~');
+    return tilde == std::string::npos ? 0 : lineMask(name.data() + tilde + 1, name.size() - tilde - 1);
+}
+
+// Read-only window onto a contiguous array. The graph's arrays are views so
+// that they can point either into vectors it owns or straight into a
+// memory-mapped snapshot file.
+template <typename T>
+struct ArrayView {
+    const T* ptr = nullptr;
+    size_t count = 0;
+
+    ArrayView() {}
+    ArrayView(const T* ptr, size_t count) : ptr(ptr), count(count) {}
+    ArrayView(const std::vector<T>& v) : ptr(v.data()), count(v.size()) {}
+
+    size_t size() const {
+        return count;
+    }
+
+    bool empty() const {
+        return count == 0;
+    }
+
+    const T* data() const {
+        return ptr;
+    }
+
+    const T* begin() const {
+        return ptr;
+    }
+
+    const T* end() const {
+        return ptr + count;
+    }
+
+    const T& operator[](size_t i) const {
+        return ptr[i];
+    }
+};
+
+// Station names packed end to end: name v is chars[offsets[v] .. offsets[v + 1]).
+struct NameTable {
+    ArrayView<uint32_t> offsets;
+    ArrayView<char> chars;
+
+    size_t size() const {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    const char* data(size_t v) const {
+        return chars.data() + offsets[v];
+    }
+
+    size_t length(size_t v) const {
+        return offsets[v + 1] - offsets[v];
+    }
+
+    std::string operator[](size_t v) const {
+        return std::string(data(v), length(v));
+    }
+
+    std::vector<std::string> toVector() const {
+        std::vector<std::string> out;
+        out.reserve(size());
+        for (size_t v = 0; v < size(); v++) {
+            out.push_back((*this)[v]);
+        }
+        return out;
+    }
+};
+
+inline uint64_t hashName(const char* p, size_t n) {
+    uint64_t h = 14695981039346656037ULL;
+    for (size_t i = 0; i < n; i++) {
+        h = (h ^ (unsigned char)p[i]) * 1099511628211ULL;
+    }
+    return h;
+}
+
+// Read-optimised, frozen copy of the metro network. Stations are interned to
+// dense ids [0, numVertex()) and the adjacency is laid out in compressed
+// sparse row form: the arcs leaving station v are
+// targets[offsets[v] .. offsets[v + 1]) with matching entries in the weight
+// arrays. Every undirected edge appears once in each direction.
+//
+// All arrays are views; storage keeps whatever they point into alive (the
+// vectors filled by buildCompactGraph, or a mapped snapshot file), so a
+// CompactGraph can be copied cheaply and shared between threads.
+struct CompactGraph {
+    enum : uint32_t { NO_STATION = UINT32_MAX };
+
+    NameTable names;
+    ArrayView<uint32_t> nameSlots; // open-addressing name index, id + 1 per slot, 0 = empty
+
+    ArrayView<uint32_t> offsets;
+    ArrayView<uint32_t> targets;
+    ArrayView<int> distance;
+    ArrayView<int> time;
+    ArrayView<uint32_t> arcLines; // lines running over each arc, as a mask
+
+    std::vector<std::string> lineNames; // display name per line letter, may be empty
+
+    std::shared_ptr<const void> storage;
+
+    uint32_t numVertex() const {
+        return (uint32_t)names.size();
+    }
+
+    uint32_t numArcs() const {
+        return (uint32_t)targets.size();
+    }
+
+    uint32_t id(const char* name, size_t len) const {
+        if (nameSlots.empty()) {
+            return NO_STATION;
+        }
+        size_t mask = nameSlots.size() - 1;
+        for (size_t i = hashName(name, len) & mask;; i = (i + 1) & mask) {
+            uint32_t slot = nameSlots[i];
+            if (slot == 0) {
+                return NO_STATION;
+            }
+            uint32_t v = slot - 1;
+            if (names.length(v) == len && std::memcmp(names.data(v), name, len) == 0) {
+                return v;
+            }
+        }
+    }
+
+    uint32_t id(const std::string& name) const {
+        return id(name.data(), name.size());
+    }
+
+    const int* weights(Metric metric) const {
+        return metric == Metric::Time ? time.data() : distance.data();
+    }
+
+    uint32_t begin(uint32_t v) const {
+        return offsets[v];
+    }
+
+    uint32_t end(uint32_t v) const {
+        return offsets[v + 1];
+    }
+
+    // Index of the arc u -> v, or NO_STATION if they are not adjacent.
+    // Neighbour lists are sorted, so this is a binary search.
+    uint32_t arc(uint32_t u, uint32_t v) const {
+        const uint32_t* first = targets.data() + offsets[u];
+        const uint32_t* last = targets.data() + offsets[u + 1];
+        const uint32_t* it = std::lower_bound(first, last, v);
+        return it != last && *it == v ? (uint32_t)(it - targets.data()) : NO_STATION;
+    }
+
+    // FNV-1a hash of the topology and distances. Derived data saved to disk
+    // (hierarchies, snapshots) records it to detect a changed network.
+    uint64_t fingerprint() const {
+        uint64_t h = 14695981039346656037ULL;
+        auto mix = [&h](const void* data, size_t bytes) {
+            const unsigned char* p = (const unsigned char*)data;
+            for (size_t i = 0; i < bytes; i++) {
+                h = (h ^ p[i]) * 1099511628211ULL;
+            }
+        };
+        mix(offsets.data(), offsets.size() * sizeof(uint32_t));
+        mix(targets.data(), targets.size() * sizeof(uint32_t));
+        mix(distance.data(), distance.size() * sizeof(int));
+        return h;
+    }
+
+    // Line letters encoded after the '~' in a station name, e.g. "BGP".
+    std::string lineCode(uint32_t v) const {
+        const char* p = names.data(v);
+        const char* e = p + names.length(v);
+        const char* tilde = std::find(p, e, '~');
+        return tilde == e ? std::string() : std::string(tilde + 1, e);
+    }
+};
+
+// One published state of the network, as handed to concurrent readers.
+// Numbers only grow, so anything derived from a version can tell when it is
+// out of date.
+struct GraphVersion {
+    uint64_t number = 0;
+    std::shared_ptr<const CompactGraph> graph;
+};
+
+// Size of the name index for n stations: a power of two at least 2n, so
+// probes stay short.
+inline size_t nameSlotCount(size_t n) {
+    size_t size = 16;
+    while (size < 2 * n) {
+        size *= 2;
+    }
+    return size;
+}
+
+// Backing vectors for a graph built in memory.
+struct CompactGraphArrays {
+    std::vector<uint32_t> nameOffsets;
+    std::vector<char> nameChars;
+    std::vector<uint32_t> nameSlots;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> targets;
+    std::vector<int> distance;
+    std::vector<int> time;
+    std::vector<uint32_t> arcLines;
+};
+
+// One undirected edge for buildCompactGraph. lines = 0 means "infer from
+// the endpoints": the lines both stations are on.
+struct EdgeRecord {
+    uint32_t u;
+    uint32_t v;
+    int distance;
+    uint32_t lines;
+};
+
+// Lays out g from the station names and an edge list over their indices.
+// g.lineNames is kept. If an edge is listed more than once, the first
+// occurrence wins.
+inline void buildCompactGraph(const std::vector<std::string>& names, const std::vector<EdgeRecord>& edges,
+                              CompactGraph& g) {
+    std::shared_ptr<CompactGraphArrays> arrays = std::make_shared<CompactGraphArrays>();
+    CompactGraphArrays& out = *arrays;
+    uint32_t n = (uint32_t)names.size();
+
+    out.nameOffsets.reserve(n + 1);
+    out.nameOffsets.push_back(0);
+    for (uint32_t i = 0; i < n; i++) {
+        out.nameChars.insert(out.nameChars.end(), names[i].begin(), names[i].end());
+        out.nameOffsets.push_back((uint32_t)out.nameChars.size());
+    }
+    out.nameSlots.assign(nameSlotCount(n), 0);
+    size_t slotMask = out.nameSlots.size() - 1;
+    for (uint32_t i = 0; i < n; i++) {
+        size_t s = hashName(names[i].data(), names[i].size()) & slotMask;
+        while (out.nameSlots[s] != 0) {
+            s = (s + 1) & slotMask;
+        }
+        out.nameSlots[s] = i + 1;
+    }
+
+    std::vector<uint32_t> masks(n);
+    for (uint32_t i = 0; i < n; i++) {
+        masks[i] = stationLineMask(names[i]);
+    }
+
+    // Both directions of every edge, stably sorted by (source, target) so
+    // duplicates are adjacent with the first occurrence in front.
+    struct Arc {
+        uint32_t from;
+        uint32_t to;
+        uint32_t edge;
+    };
+    std::vector<Arc> arcs;
+    arcs.reserve(2 * edges.size());
+    for (uint32_t e = 0; e < edges.size(); e++) {
+        if (edges[e].u == edges[e].v) {
+            continue;
+        }
+        arcs.push_back(Arc{edges[e].u, edges[e].v, e});
+        arcs.push_back(Arc{edges[e].v, edges[e].u, e});
+    }
+    std::stable_sort(arcs.begin(), arcs.end(), [](const Arc& a, const Arc& b) {
+        return a.from != b.from ? a.from < b.from : a.to < b.to;
+    });
+
+    out.offsets.assign(n + 1, 0);
+    out.targets.reserve(arcs.size());
+    out.distance.reserve(arcs.size());
+    out.time.reserve(arcs.size());
+    out.arcLines.reserve(arcs.size());
+    for (size_t i = 0; i < arcs.size(); i++) {
+        const Arc& a = arcs[i];
+        if (i > 0 && arcs[i - 1].from == a.from && arcs[i - 1].to == a.to) {
+            continue;
+        }
+        const EdgeRecord& e = edges[a.edge];
+        uint32_t lines = e.lines != 0 ? e.lines : masks[a.from] & masks[a.to];
+        out.targets.push_back(a.to);
+        out.distance.push_back(e.distance);
+        out.time.push_back(travelTime(e.distance));
+        out.arcLines.push_back(lines);
+        out.offsets[a.from + 1]++;
+    }
+    for (uint32_t v = 0; v < n; v++) {
+        out.offsets[v + 1] += out.offsets[v];
+    }
+
+    g.names.offsets = out.nameOffsets;
+    g.names.chars = out.nameChars;
+    g.nameSlots = out.nameSlots;
+    g.offsets = out.offsets;
+    g.targets = out.targets;
+    g.distance = out.distance;
+    g.time = out.time;
+    g.arcLines = out.arcLines;
+    g.storage = arrays;
+    if (g.lineNames.size() < 26) {
+        g.lineNames.resize(26);
+    }
+}
+
+// Lays out g as a copy of from with the undirected edge u - v added (with
+// the given distance, lines inferred from the endpoints) or removed. Station
+// ids stay the same. This is a straight copy of the arrays with two arcs
+// spliced in or out, with no name hashing or sorting, so a single edit to a
+// large network costs a fraction of buildCompactGraph. The caller checks
+// that the edge is absent before adding and present before removing.
+inline void editCompactGraph(const CompactGraph& from, uint32_t u, uint32_t v, int distance, bool add,
+                             CompactGraph& g) {
+    std::shared_ptr<CompactGraphArrays> arrays = std::make_shared<CompactGraphArrays>();
+    CompactGraphArrays& out = *arrays;
+    uint32_t n = from.numVertex();
+    size_t m = from.numArcs();
+
+    out.nameOffsets.assign(from.names.offsets.data(), from.names.offsets.data() + from.names.offsets.size());
+    out.nameChars.assign(from.names.chars.data(), from.names.chars.data() + from.names.chars.size());
+    out.nameSlots.assign(from.nameSlots.data(), from.nameSlots.data() + from.nameSlots.size());
+
+    // The rows of a come before the rows of b, so the arc a -> b sits (or
+    // goes) in front of b -> a.
+    uint32_t a = std::min(u, v), b = std::max(u, v);
+    auto slot = [&from](uint32_t x, uint32_t y) {
+        const uint32_t* first = from.targets.data() + from.offsets[x];
+        const uint32_t* last = from.targets.data() + from.offsets[x + 1];
+        return (size_t)(std::lower_bound(first, last, y) - from.targets.data());
+    };
+    size_t at[2] = {slot(a, b), slot(b, a)};
+    uint32_t to[2] = {b, a};
+    uint32_t lines = stationLineMask(from.names[a]) & stationLineMask(from.names[b]);
+
+    size_t size = add ? m + 2 : m - 2;
+    out.targets.reserve(size);
+    out.distance.reserve(size);
+    out.time.reserve(size);
+    out.arcLines.reserve(size);
+    auto copy = [&](size_t first, size_t last) {
+        out.targets.insert(out.targets.end(), from.targets.data() + first, from.targets.data() + last);
+        out.distance.insert(out.distance.end(), from.distance.data() + first, from.distance.data() + last);
+        out.time.insert(out.time.end(), from.time.data() + first, from.time.data() + last);
+        out.arcLines.insert(out.arcLines.end(), from.arcLines.data() + first, from.arcLines.data() + last);
+    };
+    size_t next = 0;
+    for (int i = 0; i < 2; i++) {
+        copy(next, at[i]);
+        if (add) {
+            out.targets.push_back(to[i]);
+            out.distance.push_back(distance);
+            out.time.push_back(travelTime(distance));
+            out.arcLines.push_back(lines);
+            next = at[i];
+        } else {
+            next = at[i] + 1;
+        }
+    }
+    copy(next, m);
+
+    out.offsets.assign(from.offsets.data(), from.offsets.data() + n + 1);
+    for (uint32_t x = a + 1; x <= n; x++) {
+        uint32_t shift = x <= b ? 1 : 2;
+        out.offsets[x] = add ? out.offsets[x] + shift : out.offsets[x] - shift;
+    }
+
+    g.names.offsets = out.nameOffsets;
+    g.names.chars = out.nameChars;
+    g.nameSlots = out.nameSlots;
+    g.offsets = out.offsets;
+    g.targets = out.targets;
+    g.distance = out.distance;
+    g.time = out.time;
+    g.arcLines = out.arcLines;
+    g.storage = arrays;
+    g.lineNames = from.lineNames;
+}
+
+#endif
@@ -0,0 +1,404 @@
+#ifndef METROPATH_CONNECTION_SCAN_H
+#define METROPATH_CONNECTION_SCAN_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "CompactGraph.h"
+
+// Timetable routing with the Connection Scan Algorithm. Every train run
+// between two consecutive stops is one connection; all connections live in
+// a single array sorted by departure, and a query is one linear pass over
+// part of it. Unlike the static graph (a fixed 120 + 40 * km seconds per
+// edge), this accounts for the departure time, headways and the wait when
+// changing trains.
+//
+// Times are seconds after midnight of the service day and may exceed 24h
+// for trains running past midnight.
+
+// "08:13" or "08:13:30" to seconds after midnight; false if malformed.
+inline bool parseClock(const char* p, size_t n, int& seconds) {
+    int parts[3] = {0, 0, 0};
+    int count = 0;
+    size_t i = 0;
+    while (count < 3) {
+        size_t start = i;
+        int value = 0;
+        while (i < n && p[i] >= '0' && p[i] <= '9' && i - start < 3) {
+            value = value * 10 + (p[i] - '0');
+            i++;
+        }
+        if (i == start) {
+            return false;
+        }
+        parts[count++] = value;
+        if (i == n) {
+            break;
+        }
+        if (p[i] != ':') {
+            return false;
+        }
+        i++;
+    }
+    if (i != n || count < 2 || parts[1] > 59 || parts[2] > 59) {
+        return false;
+    }
+    seconds = parts[0] * 3600 + parts[1] * 60 + parts[2];
+    return true;
+}
+
+inline bool parseClock(const std::string& text, int& seconds) {
+    return parseClock(text.data(), text.size(), seconds);
+}
+
+// Seconds after midnight as "HH:MM", or "HH:MM:SS" if not on the minute.
+inline std::string formatClock(int seconds) {
+    char buf[16];
+    int h = seconds / 3600, m = seconds / 60 % 60, s = seconds % 60;
+    if (s == 0) {
+        std::snprintf(buf, sizeof(buf), "%02d:%02d", h, m);
+    } else {
+        std::snprintf(buf, sizeof(buf), "%02d:%02d:%02d", h, m, s);
+    }
+    return buf;
+}
+
+// A run of trains as read from a network file. A headway pattern has
+// headway > 0: a train leaves stops[0] every headway seconds from first to
+// last, and each leg takes the static travel time of its edge. An explicit
+// trip has times[i] for every stop instead.
+struct ServiceRecord {
+    uint32_t line = 0; // line letter index, 'A' = 0
+    int first = 0;
+    int last = 0;
+    int headway = 0;
+    std::vector<uint32_t> stops;
+    std::vector<int> times;
+    size_t lineNo = 0; // position in the source file, for error messages
+};
+
+struct Connection {
+    uint32_t from;
+    uint32_t to;
+    int departure;
+    int arrival;
+    uint32_t trip;
+};
+
+// All connections of a service day, sorted by departure. The connections of
+// each trip are also listed in travel order so journeys can be expanded
+// stop by stop.
+struct Timetable {
+    uint32_t numStops = 0;
+    std::vector<Connection> connections;
+    std::vector<uint32_t> tripLine;    // line letter index per trip
+    std::vector<uint32_t> tripOffsets; // trip t is tripConnections[tripOffsets[t] .. tripOffsets[t + 1])
+    std::vector<uint32_t> tripConnections;
+
+    uint32_t numTrips() const {
+        return (uint32_t)tripLine.size();
+    }
+
+    bool empty() const {
+        return connections.empty();
+    }
+
+    // Index of the first connection departing at or after t.
+    uint32_t firstDeparture(int t) const {
+        auto it = std::lower_bound(connections.begin(), connections.end(), t,
+                                   [](const Connection& c, int time) { return c.departure < time; });
+        return (uint32_t)(it - connections.begin());
+    }
+};
+
+// Expands service records into a timetable over g's stations. Headway legs
+// must follow edges of g. Fails with a "source:line: message" error.
+inline bool buildTimetable(const CompactGraph& g, const std::vector<ServiceRecord>& services,
+                           const std::string& source, Timetable& tt, std::string& error) {
+    tt = Timetable();
+    tt.numStops = g.numVertex();
+    std::vector<int> legs;
+    for (const ServiceRecord& s : services) {
+        std::string where = source + ":" + std::to_string(s.lineNo) + ": ";
+        if (s.headway > 0) {
+            legs.clear();
+            for (size_t i = 0; i + 1 < s.stops.size(); i++) {
+                uint32_t a = g.arc(s.stops[i], s.stops[i + 1]);
+                if (a == CompactGraph::NO_STATION) {
+                    error = where + "no edge between " + g.names[s.stops[i]] + " and " + g.names[s.stops[i + 1]];
+                    return false;
+                }
+                legs.push_back(g.time[a]);
+            }
+            for (int start = s.first; start <= s.last; start += s.headway) {
+                uint32_t trip = (uint32_t)tt.tripLine.size();
+                tt.tripLine.push_back(s.line);
+                int t = start;
+                for (size_t i = 0; i < legs.size(); i++) {
+                    tt.connections.push_back(Connection{s.stops[i], s.stops[i + 1], t, t + legs[i], trip});
+                    t += legs[i];
+                }
+            }
+        } else {
+            for (size_t i = 0; i + 1 < s.times.size(); i++) {
+                if (s.times[i + 1] <= s.times[i]) {
+                    error = where + "trip times must increase";
+                    return false;
+                }
+            }
+            uint32_t trip = (uint32_t)tt.tripLine.size();
+            tt.tripLine.push_back(s.line);
+            for (size_t i = 0; i + 1 < s.stops.size(); i++) {
+                tt.connections.push_back(Connection{s.stops[i], s.stops[i + 1], s.times[i], s.times[i + 1], trip});
+            }
+        }
+    }
+
+    std::sort(tt.connections.begin(), tt.connections.end(), [](const Connection& a, const Connection& b) {
+        return a.departure != b.departure ? a.departure < b.departure : a.arrival < b.arrival;
+    });
+
+    // Within a trip departures strictly increase, so the sorted order is
+    // also travel order.
+    uint32_t trips = tt.numTrips();
+    tt.tripOffsets.assign(trips + 1, 0);
+    for (const Connection& c : tt.connections) {
+        tt.tripOffsets[c.trip + 1]++;
+    }
+    for (uint32_t t = 0; t < trips; t++) {
+        tt.tripOffsets[t + 1] += tt.tripOffsets[t];
+    }
+    tt.tripConnections.resize(tt.connections.size());
+    std::vector<uint32_t> fill(tt.tripOffsets.begin(), tt.tripOffsets.end() - 1);
+    for (uint32_t i = 0; i < tt.connections.size(); i++) {
+        tt.tripConnections[fill[tt.connections[i].trip]++] = i;
+    }
+    return true;
+}
+
+// One ride on one train.
+struct JourneyLeg {
+    uint32_t trip;
+    uint32_t line;
+    uint32_t from;
+    uint32_t to;
+    int departure;
+    int arrival;
+};
+
+struct Journey {
+    int departure = 0;
+    int arrival = INT_MAX;
+    std::vector<JourneyLeg> legs;
+    std::vector<uint32_t> stations; // every stop passed, both ends included
+
+    bool found() const {
+        return arrival != INT_MAX;
+    }
+
+    int changes() const {
+        return legs.empty() ? 0 : (int)legs.size() - 1;
+    }
+};
+
+// Leaving at departure reaches the destination at arrival. Profile queries
+// return these sorted by departure; a later entry always arrives later too,
+// otherwise the earlier one would have been dropped.
+struct ProfileEntry {
+    int departure;
+    int arrival;
+};
+
+// Earliest-arrival and profile queries over a Timetable. Buffers are kept
+// between queries; scannedCount() reports how many connections the last
+// query looked at.
+class ConnectionScan {
+public:
+    // Minimum time to change trains at a station.
+    void setChangeTime(int seconds) {
+        changeTime = seconds;
+    }
+
+    int changeTimeSeconds() const {
+        return changeTime;
+    }
+
+    // Earliest arrival at dst for a passenger at src from time departure.
+    // The scan stops at the first connection leaving after the best arrival
+    // found so far.
+    bool earliestArrival(const Timetable& tt, uint32_t src, uint32_t dst, int departure) {
+        reset(tt);
+        this->src = src;
+        this->dst = dst;
+        start = departure;
+        arrival[src] = departure;
+        ready[src] = departure;
+
+        const Connection* conns = tt.connections.data();
+        uint32_t count = (uint32_t)tt.connections.size();
+        for (uint32_t i = tt.firstDeparture(departure); i < count; i++) {
+            const Connection& c = conns[i];
+            if (c.departure >= arrival[dst]) {
+                break;
+            }
+            scanned++;
+            if (boarded[c.trip] == NONE) {
+                if (ready[c.from] > c.departure) {
+                    continue;
+                }
+                boarded[c.trip] = i;
+            }
+            if (c.arrival < arrival[c.to]) {
+                arrival[c.to] = c.arrival;
+                ready[c.to] = c.arrival + changeTime;
+                reachedBy[c.to] = i;
+            }
+        }
+        return arrival[dst] != INT_MAX;
+    }
+
+    int arrivalTime() const {
+        return arrival.empty() ? INT_MAX : arrival[dst];
+    }
+
+    uint32_t scannedCount() const {
+        return scanned;
+    }
+
+    // The journey found by the last earliestArrival call, leg by leg.
+    void journey(const Timetable& tt, Journey& out) const {
+        out = Journey();
+        out.departure = start;
+        if (arrival.empty() || arrival[dst] == INT_MAX) {
+            return;
+        }
+        out.arrival = arrival[dst];
+        if (src == dst) {
+            out.stations.push_back(src);
+            return;
+        }
+        for (uint32_t v = dst; v != src;) {
+            const Connection& last = tt.connections[reachedBy[v]];
+            const Connection& first = tt.connections[boarded[last.trip]];
+            out.legs.push_back(JourneyLeg{last.trip, tt.tripLine[last.trip], first.from, v, first.departure,
+                                          last.arrival});
+            v = first.from;
+        }
+        std::reverse(out.legs.begin(), out.legs.end());
+        out.departure = out.legs.front().departure;
+
+        out.stations.push_back(src);
+        for (const JourneyLeg& leg : out.legs) {
+            bool riding = false;
+            for (uint32_t k = tt.tripOffsets[leg.trip]; k < tt.tripOffsets[leg.trip + 1]; k++) {
+                const Connection& c = tt.connections[tt.tripConnections[k]];
+                riding = riding || (c.from == leg.from && c.departure == leg.departure);
+                if (riding) {
+                    out.stations.push_back(c.to);
+                    if (c.to == leg.to && c.arrival == leg.arrival) {
+                        break;
+                    }
+                }
+            }
+        }
+    }
+
+    // Every useful departure from src to dst between from and to: for each,
+    // the earliest arrival, dropping departures that cannot beat a later
+    // one (even one after the window). Scans connections backwards from the
+    // end of the day, keeping per station the Pareto set of
+    // (departure, arrival at dst).
+    void profile(const Timetable& tt, uint32_t src, uint32_t dst, int from, int to,
+                 std::vector<ProfileEntry>& out) {
+        reset(tt);
+        out.clear();
+        if (profiles.size() != tt.numStops) {
+            profiles.assign(tt.numStops, std::vector<ProfileEntry>());
+        }
+        for (std::vector<ProfileEntry>& p : profiles) {
+            p.clear();
+        }
+        tripArrival.assign(tt.numTrips(), INT_MAX);
+        if (src == dst) {
+            return;
+        }
+
+        uint32_t first = tt.firstDeparture(from);
+        for (uint32_t i = (uint32_t)tt.connections.size(); i-- > first;) {
+            const Connection& c = tt.connections[i];
+            scanned++;
+            int best = tripArrival[c.trip];
+            if (c.to == dst) {
+                best = std::min(best, c.arrival);
+            } else {
+                best = std::min(best, evaluate(profiles[c.to], c.arrival + changeTime));
+            }
+            if (best == INT_MAX) {
+                continue;
+            }
+            tripArrival[c.trip] = best;
+
+            std::vector<ProfileEntry>& p = profiles[c.from];
+            if (!p.empty() && p.back().arrival <= best) {
+                continue;
+            }
+            if (!p.empty() && p.back().departure == c.departure) {
+                p.back().arrival = best;
+            } else {
+                p.push_back(ProfileEntry{c.departure, best});
+            }
+        }
+
+        const std::vector<ProfileEntry>& p = profiles[src];
+        for (size_t k = p.size(); k-- > 0;) {
+            if (p[k].departure <= to) {
+                out.push_back(p[k]);
+            }
+        }
+    }
+
+private:
+    enum : uint32_t { NONE = UINT32_MAX };
+
+    int changeTime = 120;
+    std::vector<int> arrival;
+    std::vector<int> ready;
+    std::vector<uint32_t> reachedBy;
+    std::vector<uint32_t> boarded;
+    std::vector<int> tripArrival; // profile: arrival at dst when staying on each trip
+    std::vector<std::vector<ProfileEntry>> profiles; // decreasing departure
+    uint32_t src = 0;
+    uint32_t dst = 0;
+    int start = 0;
+    uint32_t scanned = 0;
+
+    void reset(const Timetable& tt) {
+        arrival.assign(tt.numStops, INT_MAX);
+        ready.assign(tt.numStops, INT_MAX);
+        reachedBy.assign(tt.numStops, NONE);
+        boarded.assign(tt.numTrips(), NONE);
+        scanned = 0;
+    }
+
+    // Earliest arrival at dst departing no earlier than t, from a profile
+    // stored in decreasing departure order.
+    static int evaluate(const std::vector<ProfileEntry>& p, int t) {
+        // Entries with departure >= t form a prefix; the last of them
+        // departs earliest and arrives earliest.
+        size_t lo = 0, hi = p.size();
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (p[mid].departure >= t) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
+            }
+        }
+        return lo == 0 ? INT_MAX : p[lo - 1].arrival;
+    }
+};
+
+#endif
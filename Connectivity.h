@@ -0,0 +1,99 @@
+#ifndef METROPATH_CONNECTIVITY_H
+#define METROPATH_CONNECTIVITY_H
+
+#include <cstdint>
+#include <utility>
+#include <vector>
+#include "CompactGraph.h"
+
+// Connected components of the network as a union-find forest, so "is there
+// any route from u to v" is two finds instead of a search. New stations and
+// edges are merged in place (union by size with path halving, so a find is
+// effectively constant time, and right after a build every station points
+// straight at its root). Removing a station or edge can split a component,
+// which union-find cannot undo: the owner marks the index stale and it is
+// rebuilt from the graph, in one pass over the arcs, before the next answer.
+class ConnectivityIndex {
+public:
+    bool stale() const {
+        return !valid;
+    }
+
+    void invalidate() {
+        valid = false;
+    }
+
+    uint32_t numVertex() const {
+        return (uint32_t)parent.size();
+    }
+
+    uint32_t numComponents() const {
+        return components;
+    }
+
+    void build(const CompactGraph& g) {
+        uint32_t n = g.numVertex();
+        parent.resize(n);
+        size.assign(n, 1);
+        for (uint32_t v = 0; v < n; v++) {
+            parent[v] = v;
+        }
+        components = n;
+        for (uint32_t v = 0; v < n; v++) {
+            for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                if (v < g.targets[a]) {
+                    connect(v, g.targets[a]);
+                }
+            }
+        }
+        for (uint32_t v = 0; v < n; v++) {
+            parent[v] = find(v);
+        }
+        valid = true;
+    }
+
+    // Stations added since: each starts as a component of its own.
+    void grow(uint32_t n) {
+        while (parent.size() < n) {
+            parent.push_back((uint32_t)parent.size());
+            size.push_back(1);
+            components++;
+        }
+    }
+
+    void connect(uint32_t u, uint32_t v) {
+        u = find(u);
+        v = find(v);
+        if (u == v) {
+            return;
+        }
+        if (size[u] < size[v]) {
+            std::swap(u, v);
+        }
+        parent[v] = u;
+        size[u] += size[v];
+        components--;
+    }
+
+    bool connected(uint32_t u, uint32_t v) {
+        return find(u) == find(v);
+    }
+
+    // Representative of v's component; stations share it exactly when
+    // they are connected.
+    uint32_t find(uint32_t v) {
+        while (parent[v] != v) {
+            parent[v] = parent[parent[v]];
+            v = parent[v];
+        }
+        return v;
+    }
+
+private:
+    std::vector<uint32_t> parent;
+    std::vector<uint32_t> size; // valid at roots
+    uint32_t components = 0;
+    bool valid = false;
+};
+
+#endif
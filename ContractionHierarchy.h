@@ -0,0 +1,610 @@
+#ifndef METROPATH_CONTRACTION_HIERARCHY_H
+#define METROPATH_CONTRACTION_HIERARCHY_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+#include "CompactGraph.h"
+#include "IndexedHeap.h"
+#include "Route.h"
+
+// Contraction Hierarchies for one metric. Preprocessing contracts stations
+// one at a time in order of importance, adding a shortcut u - w whenever
+// removing v would break the only shortest u - v - w path. A query then only
+// walks "upward" (towards more important stations) from both ends, which on
+// large transit networks settles a few hundred vertices instead of most of
+// the graph.
+//
+// The hierarchy is stored as an upward CSR: for every station, the arcs to
+// higher-ranked neighbours including shortcuts. The network is undirected,
+// so the forward and backward queries share it. Like AllPairsTable the
+// arrays are read through views and can live in a mapped snapshot.
+class ContractionHierarchy {
+public:
+    ContractionHierarchy() {}
+    ContractionHierarchy(const ContractionHierarchy&) = delete;
+    ContractionHierarchy& operator=(const ContractionHierarchy&) = delete;
+    ContractionHierarchy(ContractionHierarchy&&) = default;
+    ContractionHierarchy& operator=(ContractionHierarchy&&) = default;
+
+    bool empty() const {
+        return n == 0;
+    }
+
+    uint32_t numVertex() const {
+        return n;
+    }
+
+    Metric metricType() const {
+        return metric;
+    }
+
+    // Fingerprint of the CompactGraph the hierarchy was built from.
+    uint64_t graphFingerprint() const {
+        return fingerprint;
+    }
+
+    uint32_t numShortcuts() const {
+        return shortcuts;
+    }
+
+    void build(const CompactGraph& g, Metric metric) {
+        this->metric = metric;
+        n = g.numVertex();
+        fingerprint = g.fingerprint();
+        shortcuts = 0;
+        backing.reset();
+        Builder(*this, g).run();
+        bind();
+    }
+
+    // Upward CSR arrays as laid out by save(); rank has n entries, offsets
+    // n + 1, the arc arrays offsets[n].
+    struct Arrays {
+        const uint32_t* rank;
+        const uint32_t* upOffsets;
+        const uint32_t* upTargets;
+        const int* upWeights;
+        const uint32_t* upMiddles;
+    };
+
+    Arrays arrays() const {
+        return Arrays{rank.data(), upOffsets.data(), upTargets.data(), upWeights.data(), upMiddles.data()};
+    }
+
+    uint32_t numArcs() const {
+        return (uint32_t)upTargets.size();
+    }
+
+    // Uses arrays owned by someone else, typically a mapped snapshot;
+    // backing keeps them alive. The caller vouches that they were built
+    // from a graph with the given fingerprint.
+    void attach(Metric metric, uint32_t n, uint64_t fingerprint, uint32_t shortcuts, const Arrays& a,
+                std::shared_ptr<const void> backing) {
+        *this = ContractionHierarchy();
+        this->metric = metric;
+        this->n = n;
+        this->fingerprint = fingerprint;
+        this->shortcuts = shortcuts;
+        uint32_t arcs = n == 0 ? 0 : a.upOffsets[n];
+        rank = ArrayView<uint32_t>(a.rank, n);
+        upOffsets = ArrayView<uint32_t>(a.upOffsets, n + 1);
+        upTargets = ArrayView<uint32_t>(a.upTargets, arcs);
+        upWeights = ArrayView<int>(a.upWeights, arcs);
+        upMiddles = ArrayView<uint32_t>(a.upMiddles, arcs);
+        this->backing = backing;
+    }
+
+    uint32_t rankOf(uint32_t v) const {
+        return rank[v];
+    }
+
+    uint32_t begin(uint32_t v) const {
+        return upOffsets[v];
+    }
+
+    uint32_t end(uint32_t v) const {
+        return upOffsets[v + 1];
+    }
+
+    uint32_t target(uint32_t a) const {
+        return upTargets[a];
+    }
+
+    int weight(uint32_t a) const {
+        return upWeights[a];
+    }
+
+    // Station a shortcut bypasses, or NO_STATION for an original edge.
+    uint32_t middle(uint32_t a) const {
+        return upMiddles[a];
+    }
+
+    // Upward arc from lower-ranked v to u. Upward lists are sorted.
+    uint32_t arc(uint32_t v, uint32_t u) const {
+        const uint32_t* first = upTargets.data() + upOffsets[v];
+        const uint32_t* last = upTargets.data() + upOffsets[v + 1];
+        const uint32_t* it = std::lower_bound(first, last, u);
+        return it != last && *it == u ? (uint32_t)(it - upTargets.data()) : CompactGraph::NO_STATION;
+    }
+
+    // Appends the original stations strictly after `from` on the hierarchy
+    // edge from -> to, ending with `to`.
+    void unpack(uint32_t from, uint32_t to, uint32_t mid, std::vector<uint32_t>& out) const {
+        if (mid == CompactGraph::NO_STATION) {
+            out.push_back(to);
+            return;
+        }
+        unpack(from, mid, middle(arc(mid, from)), out);
+        unpack(mid, to, middle(arc(mid, to)), out);
+    }
+
+    // Binary format: magic, version, metric, fingerprint, then the rank and
+    // upward CSR arrays. Lets startup skip preprocessing.
+    void save(std::ostream& out) const {
+        uint32_t header[4] = {MAGIC, VERSION, (uint32_t)metric, n};
+        out.write((const char*)header, sizeof(header));
+        out.write((const char*)&fingerprint, sizeof(fingerprint));
+        out.write((const char*)&shortcuts, sizeof(shortcuts));
+        uint32_t arcs = (uint32_t)upTargets.size();
+        out.write((const char*)&arcs, sizeof(arcs));
+        out.write((const char*)rank.data(), n * sizeof(uint32_t));
+        out.write((const char*)upOffsets.data(), (n + 1) * sizeof(uint32_t));
+        out.write((const char*)upTargets.data(), arcs * sizeof(uint32_t));
+        out.write((const char*)upWeights.data(), arcs * sizeof(int));
+        out.write((const char*)upMiddles.data(), arcs * sizeof(uint32_t));
+    }
+
+    // Returns false (leaving the hierarchy empty) if the stream is not a
+    // hierarchy of this version, was built from a different network, or is
+    // truncated or corrupt. Counts in the header are checked against what
+    // the stream holds before anything is allocated for them.
+    bool load(std::istream& in, const CompactGraph& g) {
+        *this = ContractionHierarchy();
+        uint32_t header[4];
+        uint64_t fp;
+        uint32_t sc, arcs;
+        if (!in.read((char*)header, sizeof(header)) || header[0] != MAGIC || header[1] != VERSION ||
+            header[2] > 1 || header[3] != g.numVertex()) {
+            return false;
+        }
+        if (!in.read((char*)&fp, sizeof(fp)) || fp != g.fingerprint() ||
+            !in.read((char*)&sc, sizeof(sc)) || !in.read((char*)&arcs, sizeof(arcs))) {
+            return false;
+        }
+
+        uint32_t count = header[3];
+        uint64_t needed = ((uint64_t)count * 2 + 1) * sizeof(uint32_t) + (uint64_t)arcs * 3 * sizeof(uint32_t);
+        if (needed > remaining(in)) {
+            return false;
+        }
+        std::vector<uint32_t> r, offs, tg, mid;
+        std::vector<int> wt;
+        if (!readArray(in, r, count) || !readArray(in, offs, count + 1) || offs[count] != arcs ||
+            !readArray(in, tg, arcs) || !readArray(in, wt, arcs) || !readArray(in, mid, arcs)) {
+            return false;
+        }
+        for (uint32_t v = 0; v < count; v++) {
+            if (r[v] >= count || offs[v] > offs[v + 1]) {
+                return false;
+            }
+        }
+        for (uint32_t a = 0; a < arcs; a++) {
+            if (tg[a] >= count || (mid[a] >= count && mid[a] != CompactGraph::NO_STATION)) {
+                return false;
+            }
+        }
+
+        metric = (Metric)header[2];
+        n = count;
+        fingerprint = fp;
+        shortcuts = sc;
+        store.rank.swap(r);
+        store.upOffsets.swap(offs);
+        store.upTargets.swap(tg);
+        store.upWeights.swap(wt);
+        store.upMiddles.swap(mid);
+        bind();
+        return true;
+    }
+
+private:
+    static const uint32_t MAGIC = 0x4843504d; // "MPCH"
+    static const uint32_t VERSION = 1;
+
+    Metric metric = Metric::Distance;
+    uint32_t n = 0;
+    uint64_t fingerprint = 0;
+    uint32_t shortcuts = 0;
+    ArrayView<uint32_t> rank;
+    ArrayView<uint32_t> upOffsets;
+    ArrayView<uint32_t> upTargets;
+    ArrayView<int> upWeights;
+    ArrayView<uint32_t> upMiddles;
+
+    struct Store {
+        std::vector<uint32_t> rank;
+        std::vector<uint32_t> upOffsets;
+        std::vector<uint32_t> upTargets;
+        std::vector<int> upWeights;
+        std::vector<uint32_t> upMiddles;
+    } store;
+    std::shared_ptr<const void> backing; // set while viewing someone else's arrays
+
+    // Bytes left in a seekable stream; UINT64_MAX if it cannot tell.
+    static uint64_t remaining(std::istream& in) {
+        std::istream::pos_type here = in.tellg();
+        if (here == std::istream::pos_type(-1) || !in.seekg(0, std::ios::end)) {
+            in.clear();
+            return UINT64_MAX;
+        }
+        std::istream::pos_type end = in.tellg();
+        in.seekg(here);
+        return end == std::istream::pos_type(-1) || end < here ? 0 : (uint64_t)(end - here);
+    }
+
+    // Reads count values in bounded chunks, so a stream that cannot seek
+    // and ends early fails before much more is allocated than it held.
+    template <typename T>
+    static bool readArray(std::istream& in, std::vector<T>& out, uint64_t count) {
+        const uint64_t CHUNK = 1 << 16;
+        out.clear();
+        while (out.size() < count) {
+            size_t have = out.size();
+            size_t more = (size_t)std::min(CHUNK, count - have);
+            out.resize(have + more);
+            if (!in.read((char*)(out.data() + have), more * sizeof(T))) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void bind() {
+        rank = store.rank;
+        upOffsets = store.upOffsets;
+        upTargets = store.upTargets;
+        upWeights = store.upWeights;
+        upMiddles = store.upMiddles;
+    }
+
+    // Contraction state, discarded once the upward CSR is written.
+    class Builder {
+    public:
+        Builder(ContractionHierarchy& ch, const CompactGraph& g) : ch(ch), g(g) {}
+
+        void run() {
+            uint32_t n = ch.n;
+            const int* w = g.weights(ch.metric);
+            adj.assign(n, std::vector<Edge>());
+            for (uint32_t v = 0; v < n; v++) {
+                for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                    if (g.targets[a] != v) {
+                        adj[v].push_back(Edge{g.targets[a], w[a], CompactGraph::NO_STATION});
+                    }
+                }
+            }
+            deleted.assign(n, 0);
+            up.assign(n, std::vector<Edge>());
+            dist.assign(n, INT_MAX);
+            witnessHeap.resize(n);
+            ch.store.rank.assign(n, 0);
+
+            IndexedHeap<int> order(n);
+            for (uint32_t v = 0; v < n; v++) {
+                order.add(v, priority(v));
+            }
+
+            uint32_t next = 0;
+            while (!order.isEmpty()) {
+                uint32_t v;
+                int key;
+                order.remove(v, key);
+
+                // Lazy update: priorities drift as neighbours are contracted.
+                int current = priority(v);
+                if (!order.isEmpty() && current > order.topKey()) {
+                    order.add(v, current);
+                    continue;
+                }
+
+                contract(v);
+                ch.store.rank[v] = next++;
+                for (const Edge& e : up[v]) {
+                    deleted[e.to]++;
+                    order.setKey(e.to, priority(e.to));
+                }
+            }
+            writeUpward();
+        }
+
+    private:
+        struct Edge {
+            uint32_t to;
+            int weight;
+            uint32_t middle;
+        };
+
+        struct Shortcut {
+            uint32_t from;
+            uint32_t to;
+            int weight;
+        };
+
+        // Bound on each witness search; a search that gives up just adds
+        // the shortcut, which is always correct.
+        static const uint32_t WITNESS_SETTLE_LIMIT = 500;
+
+        ContractionHierarchy& ch;
+        const CompactGraph& g;
+        std::vector<std::vector<Edge>> adj; // edges among uncontracted stations
+        std::vector<std::vector<Edge>> up;  // final upward edges per station
+        std::vector<int> deleted;           // contracted neighbours so far
+        std::vector<int> dist;
+        std::vector<uint32_t> touched;
+        IndexedHeap<int> witnessHeap;
+        std::vector<Shortcut> found;
+
+        // Shortcuts needed to contract v, written to `found`.
+        void shortcutsFor(uint32_t v) {
+            found.clear();
+            const std::vector<Edge>& edges = adj[v];
+            for (size_t i = 0; i < edges.size(); i++) {
+                int limit = 0;
+                for (size_t j = i + 1; j < edges.size(); j++) {
+                    limit = std::max(limit, edges[i].weight + edges[j].weight);
+                }
+                if (limit == 0) {
+                    continue;
+                }
+                witness(edges[i].to, v, limit);
+                for (size_t j = i + 1; j < edges.size(); j++) {
+                    int via = edges[i].weight + edges[j].weight;
+                    if (dist[edges[j].to] > via) {
+                        found.push_back(Shortcut{edges[i].to, edges[j].to, via});
+                    }
+                }
+                clearWitness();
+            }
+        }
+
+        // Local Dijkstra from u among uncontracted stations, avoiding v,
+        // up to cost limit.
+        void witness(uint32_t u, uint32_t v, int limit) {
+            dist[u] = 0;
+            touched.push_back(u);
+            witnessHeap.add(u, 0);
+            uint32_t settled = 0;
+            while (!witnessHeap.isEmpty() && settled < WITNESS_SETTLE_LIMIT) {
+                uint32_t x;
+                int cost;
+                witnessHeap.remove(x, cost);
+                settled++;
+                if (cost > limit) {
+                    break;
+                }
+                for (const Edge& e : adj[x]) {
+                    if (e.to == v) {
+                        continue;
+                    }
+                    int nc = cost + e.weight;
+                    if (nc < dist[e.to]) {
+                        if (dist[e.to] == INT_MAX) {
+                            touched.push_back(e.to);
+                        }
+                        dist[e.to] = nc;
+                        witnessHeap.addOrUpdate(e.to, nc);
+                    }
+                }
+            }
+        }
+
+        void clearWitness() {
+            witnessHeap.clear();
+            for (uint32_t x : touched) {
+                dist[x] = INT_MAX;
+            }
+            touched.clear();
+        }
+
+        // Edge difference plus contracted-neighbour count: favours stations
+        // whose removal adds few shortcuts, spread evenly over the network.
+        int priority(uint32_t v) {
+            shortcutsFor(v);
+            return 2 * ((int)found.size() - (int)adj[v].size()) + deleted[v];
+        }
+
+        void contract(uint32_t v) {
+            shortcutsFor(v);
+            up[v] = adj[v];
+            for (const Edge& e : adj[v]) {
+                std::vector<Edge>& list = adj[e.to];
+                for (size_t k = 0; k < list.size(); k++) {
+                    if (list[k].to == v) {
+                        list[k] = list.back();
+                        list.pop_back();
+                        break;
+                    }
+                }
+            }
+            adj[v].clear();
+            for (const Shortcut& s : found) {
+                addShortcut(s.from, s.to, s.weight, v);
+                addShortcut(s.to, s.from, s.weight, v);
+                ch.shortcuts++;
+            }
+        }
+
+        void addShortcut(uint32_t from, uint32_t to, int weight, uint32_t mid) {
+            for (Edge& e : adj[from]) {
+                if (e.to == to) {
+                    if (weight < e.weight) {
+                        e.weight = weight;
+                        e.middle = mid;
+                    }
+                    return;
+                }
+            }
+            adj[from].push_back(Edge{to, weight, mid});
+        }
+
+        void writeUpward() {
+            uint32_t n = ch.n;
+            ch.store.upOffsets.assign(n + 1, 0);
+            ch.store.upTargets.clear();
+            ch.store.upWeights.clear();
+            ch.store.upMiddles.clear();
+            for (uint32_t v = 0; v < n; v++) {
+                std::vector<Edge>& edges = up[v];
+                std::sort(edges.begin(), edges.end(),
+                          [](const Edge& a, const Edge& b) { return a.to < b.to; });
+                for (const Edge& e : edges) {
+                    ch.store.upTargets.push_back(e.to);
+                    ch.store.upWeights.push_back(e.weight);
+                    ch.store.upMiddles.push_back(e.middle);
+                }
+                ch.store.upOffsets[v + 1] = (uint32_t)ch.store.upTargets.size();
+            }
+        }
+    };
+};
+
+// Bidirectional upward query over a ContractionHierarchy. Both searches only
+// relax arcs towards higher rank; the shortest path is the best meeting
+// point, and a side stops once its queue head cannot improve on it.
+class CHSearch {
+public:
+    bool run(const ContractionHierarchy& ch, uint32_t src, uint32_t dst) {
+        reset(ch.numVertex());
+        metric = ch.metricType();
+
+        label(0, src, 0, CompactGraph::NO_STATION);
+        label(1, dst, 0, CompactGraph::NO_STATION);
+        heap[0].add(src, 0);
+        heap[1].add(dst, 0);
+        mu = INT_MAX;
+        meet = CompactGraph::NO_STATION;
+        if (src == dst) {
+            mu = 0;
+            meet = src;
+        }
+
+        while (true) {
+            bool live0 = !heap[0].isEmpty() && heap[0].topKey() < mu;
+            bool live1 = !heap[1].isEmpty() && heap[1].topKey() < mu;
+            if (!live0 && !live1) {
+                break;
+            }
+            int side = live0 && (!live1 || heap[0].topKey() <= heap[1].topKey()) ? 0 : 1;
+
+            uint32_t v;
+            int cost;
+            heap[side].remove(v, cost);
+            settled++;
+
+            int other = distance(1 - side, v);
+            if (other != INT_MAX && cost + other < mu) {
+                mu = cost + other;
+                meet = v;
+            }
+
+            for (uint32_t a = ch.begin(v); a < ch.end(v); a++) {
+                uint32_t u = ch.target(a);
+                int nc = cost + ch.weight(a);
+                if (nc < distance(side, u)) {
+                    label(side, u, nc, v);
+                    heap[side].addOrUpdate(u, nc);
+                }
+            }
+        }
+        return mu != INT_MAX;
+    }
+
+    int cost() const {
+        return mu;
+    }
+
+    uint32_t settledCount() const {
+        return settled;
+    }
+
+    // Unpacks the shortcuts on both halves into original stations.
+    void route(const CompactGraph& g, const ContractionHierarchy& ch, Route& out) const {
+        out.reset(metric);
+        if (mu == INT_MAX) {
+            return;
+        }
+        out.cost = mu;
+
+        chain.clear();
+        for (uint32_t v = meet; v != CompactGraph::NO_STATION; v = pred[0][v]) {
+            chain.push_back(v);
+        }
+        out.stations.push_back(chain.back());
+        for (size_t i = chain.size() - 1; i > 0; i--) {
+            uint32_t lower = chain[i], higher = chain[i - 1];
+            ch.unpack(lower, higher, ch.middle(ch.arc(lower, higher)), out.stations);
+        }
+        for (uint32_t v = meet; pred[1][v] != CompactGraph::NO_STATION; v = pred[1][v]) {
+            uint32_t lower = pred[1][v];
+            ch.unpack(v, lower, ch.middle(ch.arc(lower, v)), out.stations);
+        }
+        completeRoute(g, out);
+    }
+
+private:
+    std::vector<int> dist[2];
+    std::vector<uint32_t> pred[2];
+    std::vector<uint32_t> labelled[2]; // dist and pred are valid where == round
+    uint32_t round = 0;
+    IndexedHeap<int> heap[2];
+    mutable std::vector<uint32_t> chain;
+    Metric metric = Metric::Distance;
+    int mu = INT_MAX;
+    uint32_t meet = CompactGraph::NO_STATION;
+    uint32_t settled = 0;
+
+    int distance(int side, uint32_t v) const {
+        return labelled[side][v] == round ? dist[side][v] : INT_MAX;
+    }
+
+    void label(int side, uint32_t v, int cost, uint32_t from) {
+        labelled[side][v] = round;
+        dist[side][v] = cost;
+        pred[side][v] = from;
+    }
+
+    // Timestamped as in DijkstraSearch: a query only touches the vertices
+    // its two upward searches reach.
+    void reset(uint32_t n) {
+        bool resized = labelled[0].size() != n;
+        for (int side = 0; side < 2; side++) {
+            if (resized) {
+                dist[side].resize(n);
+                pred[side].resize(n);
+                labelled[side].assign(n, 0);
+            }
+            if (heap[side].capacity() != n) {
+                heap[side].resize(n);
+            } else {
+                heap[side].clear();
+            }
+        }
+        if (resized) {
+            round = 0;
+        }
+        if (++round == 0) {
+            for (int side = 0; side < 2; side++) {
+                std::fill(labelled[side].begin(), labelled[side].end(), 0);
+            }
+            round = 1;
+        }
+        settled = 0;
+    }
+};
+
+#endif
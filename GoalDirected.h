@@ -0,0 +1,316 @@
+#ifndef METROPATH_GOAL_DIRECTED_H
+#define METROPATH_GOAL_DIRECTED_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
+#include <vector>
+#include "CompactGraph.h"
+#include "IndexedHeap.h"
+#include "Route.h"
+#include "ShortestPath.h"
+
+// Point-to-point searches that settle fewer vertices than plain Dijkstra.
+// Each keeps its buffers between queries and reports how many vertices the
+// last query settled, for comparison with DijkstraSearch::settledCount().
+// Labels are timestamped per query as in DijkstraSearch, so a query costs
+// what it settles rather than a pass over every station.
+
+// Dijkstra from both ends at once, always advancing the side with the
+// smaller queue head. mu is the best s-t cost seen where the two searches
+// touch; once the two heads sum to at least mu no shorter path can exist.
+class BidirectionalSearch {
+public:
+    bool run(const CompactGraph& g, uint32_t src, uint32_t dst, Metric metric) {
+        reset(g.numVertex());
+        this->metric = metric;
+        const int* w = g.weights(metric);
+
+        label(0, src, 0, CompactGraph::NO_STATION);
+        label(1, dst, 0, CompactGraph::NO_STATION);
+        heap[0].add(src, 0);
+        heap[1].add(dst, 0);
+        mu = src == dst ? 0 : INT_MAX;
+        meet = src == dst ? src : CompactGraph::NO_STATION;
+
+        while (!heap[0].isEmpty() && !heap[1].isEmpty()) {
+            int top0 = heap[0].topKey(), top1 = heap[1].topKey();
+            if (mu != INT_MAX && (long long)top0 + top1 >= mu) {
+                break;
+            }
+
+            int side = top0 <= top1 ? 0 : 1;
+            uint32_t v;
+            int cost;
+            heap[side].remove(v, cost);
+            settled++;
+
+            // The graph is undirected, so the backward search walks the same
+            // arcs as the forward one.
+            for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                uint32_t nbr = g.targets[a];
+                int nc = cost + w[a];
+                if (nc < distance(side, nbr)) {
+                    label(side, nbr, nc, v);
+                    heap[side].addOrUpdate(nbr, nc);
+                    int other = distance(1 - side, nbr);
+                    if (other != INT_MAX && nc + other < mu) {
+                        mu = nc + other;
+                        meet = nbr;
+                    }
+                }
+            }
+        }
+        return mu != INT_MAX;
+    }
+
+    int cost() const {
+        return mu;
+    }
+
+    uint32_t settledCount() const {
+        return settled;
+    }
+
+    void route(const CompactGraph& g, Route& out) const {
+        out.reset(metric);
+        if (mu == INT_MAX) {
+            return;
+        }
+        out.cost = mu;
+        for (uint32_t v = meet; v != CompactGraph::NO_STATION; v = pred[0][v]) {
+            out.stations.push_back(v);
+        }
+        std::reverse(out.stations.begin(), out.stations.end());
+        for (uint32_t v = pred[1][meet]; v != CompactGraph::NO_STATION; v = pred[1][v]) {
+            out.stations.push_back(v);
+        }
+        completeRoute(g, out);
+    }
+
+private:
+    std::vector<int> dist[2]; // 0 = forward from src, 1 = backward from dst
+    std::vector<uint32_t> pred[2];
+    std::vector<uint32_t> labelled[2]; // dist and pred are valid where == round
+    uint32_t round = 0;
+    IndexedHeap<int> heap[2];
+    Metric metric = Metric::Distance;
+    int mu = INT_MAX;
+    uint32_t meet = CompactGraph::NO_STATION;
+    uint32_t settled = 0;
+
+    int distance(int side, uint32_t v) const {
+        return labelled[side][v] == round ? dist[side][v] : INT_MAX;
+    }
+
+    void label(int side, uint32_t v, int cost, uint32_t from) {
+        labelled[side][v] = round;
+        dist[side][v] = cost;
+        pred[side][v] = from;
+    }
+
+    void reset(uint32_t n) {
+        bool resized = labelled[0].size() != n;
+        for (int side = 0; side < 2; side++) {
+            if (resized) {
+                dist[side].resize(n);
+                pred[side].resize(n);
+                labelled[side].assign(n, 0);
+            }
+            if (heap[side].capacity() != n) {
+                heap[side].resize(n);
+            } else {
+                heap[side].clear();
+            }
+        }
+        if (resized) {
+            round = 0;
+        }
+        if (++round == 0) {
+            for (int side = 0; side < 2; side++) {
+                std::fill(labelled[side].begin(), labelled[side].end(), 0);
+            }
+            round = 1;
+        }
+        settled = 0;
+    }
+};
+
+// Precomputed costs from a few landmark stations, used as A* lower bounds
+// through the triangle inequality: d(v, t) >= |d(L, t) - d(L, v)|.
+class Landmarks {
+public:
+    bool empty() const {
+        return count == 0;
+    }
+
+    Metric metricType() const {
+        return metric;
+    }
+
+    // Farthest-point selection: each new landmark is the station whose
+    // nearest existing landmark is farthest away.
+    void build(const CompactGraph& g, Metric metric, uint32_t wanted) {
+        this->metric = metric;
+        n = g.numVertex();
+        count = 0;
+        cost.clear();
+        if (n == 0) {
+            return;
+        }
+        wanted = std::min(wanted, n);
+
+        DijkstraSearch search;
+        std::vector<int> nearest(n, INT_MAX);
+        uint32_t next = 0;
+        for (uint32_t v = 1; v < n; v++) {
+            if (g.end(v) - g.begin(v) < g.end(next) - g.begin(next)) {
+                next = v; // start from a line terminus
+            }
+        }
+
+        while (count < wanted) {
+            search.run(g, next, CompactGraph::NO_STATION, metric);
+            for (uint32_t v = 0; v < n; v++) {
+                cost.push_back(search.cost(v));
+                nearest[v] = std::min(nearest[v], search.cost(v));
+            }
+            count++;
+
+            // Unreached stations (other components) score highest so every
+            // component eventually gets a landmark.
+            uint32_t best = CompactGraph::NO_STATION;
+            for (uint32_t v = 0; v < n; v++) {
+                if (nearest[v] != 0 && (best == CompactGraph::NO_STATION || nearest[v] > nearest[best])) {
+                    best = v;
+                }
+            }
+            if (best == CompactGraph::NO_STATION) {
+                break;
+            }
+            next = best;
+        }
+    }
+
+    // Lower bound on the cost from v to t; INT_MAX if some landmark proves
+    // they lie in different components.
+    int lowerBound(uint32_t v, uint32_t t) const {
+        int bound = 0;
+        for (uint32_t l = 0; l < count; l++) {
+            int lv = cost[(size_t)l * n + v], lt = cost[(size_t)l * n + t];
+            if (lv == INT_MAX || lt == INT_MAX) {
+                if (lv != lt) {
+                    return INT_MAX;
+                }
+                continue;
+            }
+            bound = std::max(bound, std::abs(lt - lv));
+        }
+        return bound;
+    }
+
+private:
+    Metric metric = Metric::Distance;
+    uint32_t n = 0;
+    uint32_t count = 0;
+    std::vector<int> cost; // count rows of n costs
+};
+
+// A* with landmark lower bounds (ALT). The bounds are consistent, so each
+// vertex is still settled at most once and the first pop of dst is optimal.
+class AltSearch {
+public:
+    bool run(const CompactGraph& g, const Landmarks& landmarks, uint32_t src, uint32_t dst) {
+        reset(g.numVertex());
+        metric = landmarks.metricType();
+        const int* w = g.weights(metric);
+        target = dst;
+
+        int h = landmarks.lowerBound(src, dst);
+        if (h == INT_MAX) {
+            return false;
+        }
+        labelled[src] = round;
+        dist[src] = 0;
+        pred[src] = CompactGraph::NO_STATION;
+        heap.add(src, h);
+
+        while (!heap.isEmpty()) {
+            uint32_t v;
+            int key;
+            heap.remove(v, key);
+            settled++;
+
+            if (v == dst) {
+                return true;
+            }
+
+            for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                uint32_t nbr = g.targets[a];
+                int nc = dist[v] + w[a];
+                if (nc < distance(nbr)) {
+                    int bound = landmarks.lowerBound(nbr, dst);
+                    if (bound == INT_MAX) {
+                        continue;
+                    }
+                    labelled[nbr] = round;
+                    dist[nbr] = nc;
+                    pred[nbr] = v;
+                    heap.addOrUpdate(nbr, nc + bound);
+                }
+            }
+        }
+        return false;
+    }
+
+    int cost() const {
+        return distance(target);
+    }
+
+    uint32_t settledCount() const {
+        return settled;
+    }
+
+    void route(const CompactGraph& g, Route& out) const {
+        out.reset(metric);
+        if (distance(target) != INT_MAX) {
+            buildRoute(g, pred, target, metric, dist[target], out);
+        }
+    }
+
+private:
+    std::vector<int> dist;       // valid where labelled == round
+    std::vector<uint32_t> pred;  // likewise
+    std::vector<uint32_t> labelled;
+    uint32_t round = 0;
+    IndexedHeap<int> heap;
+    Metric metric = Metric::Distance;
+    uint32_t target = 0;
+    uint32_t settled = 0;
+
+    int distance(uint32_t v) const {
+        return labelled[v] == round ? dist[v] : INT_MAX;
+    }
+
+    void reset(uint32_t n) {
+        if (labelled.size() != n) {
+            dist.resize(n);
+            pred.resize(n);
+            labelled.assign(n, 0);
+            round = 0;
+        }
+        if (++round == 0) {
+            std::fill(labelled.begin(), labelled.end(), 0);
+            round = 1;
+        }
+        if (heap.capacity() != n) {
+            heap.resize(n);
+        } else {
+            heap.clear();
+        }
+        settled = 0;
+    }
+};
+
+#endif
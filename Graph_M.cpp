@@ -2,121 +2,591 @@
 #include <unordered_map>
 #include <vector>
 #include <queue>
-#include <list>
 #include <algorithm>
 #include <climits>
 #include <cmath>
+#include <cstdlib>
 #include <sstream>
 #include <cctype>
+#include <fstream>
+#include <memory>
+#include "CompactGraph.h"
+#include "ConnectionScan.h"
+#include "Connectivity.h"
+#include "ContractionHierarchy.h"
+#include "GoalDirected.h"
+#include "Instrumentation.h"
+#include "LineGraph.h"
+#include "ManySource.h"
+#include "NetworkLoader.h"
+#include "Pareto.h"
+#include "Rcu.h"
+#include "Snapshot.h"
+#include "StationIndex.h"
+#ifndef _WIN32
+#include <csignal>
+#include "Server.h"
+#endif
+#include "AllPairs.h"
+#include "Alternatives.h"
+#include "BatchQuery.h"
+#include "Route.h"
+#include "RouteCache.h"
+#include "ShortestPath.h"
+#include "TreeRepair.h"
 using namespace std;
 
-class Heap {
+// Engine used for a point-to-point query when the caller picks one.
+enum class SearchMode { Dijkstra, Bidirectional, ALT, CH };
+
+// One change in a batch for Graph_M::applyEdits.
+struct EdgeEdit {
+    enum Kind { Add, Remove } kind;
+    string from;
+    string to;
+    int distance; // km, Add only
+};
+
+class Graph_M {
 private:
-    struct Node {
-        string vname;
-        string psf;
-        int cost;
+    struct Vertex {
+        unordered_map<string, int> nbrs;
+    };
+    
+    unordered_map<string, Vertex> vtces;
+    vector<string> order; // insertion order, fixes the compact station ids
+    
+    shared_ptr<const CompactGraph> csr;
+    bool csrDirty = true;
+    
+    // What concurrent readers see: every new compact graph is published
+    // here as the next version.
+    RcuPointer<GraphVersion> versions;
+    uint64_t versionNumber = 0;
+    bool holdVersions = false; // inside applyEdits: publish once at the end
+    bool versionHeld = false;
+    
+    void publishVersion() {
+        if (holdVersions) {
+            versionHeld = true;
+            return;
+        }
+        versionHeld = false;
+        unique_ptr<GraphVersion> v(new GraphVersion);
+        v->number = ++versionNumber;
+        v->graph = csr;
+        versions.publish(move(v));
+    }
+    bool builderStale = false; // vtces not yet rebuilt from an adopted csr
+    
+    DijkstraSearch search;
+    BidirectionalSearch bidirectional;
+    AltSearch alt;
+    Landmarks landmarks[2]; // indexed by Metric
+    shared_ptr<const CompactGraph> landmarkGraph[2];
+    uint32_t landmarkCount = 8;
+    uint32_t settled = 0;
+    
+    CHSearch chSearch;
+    ContractionHierarchy hierarchies[2]; // indexed by Metric
+    shared_ptr<const CompactGraph> hierarchyGraph[2];
+    
+    const ContractionHierarchy& hierarchyFor(Metric metric) {
+        int m = (int)metric;
+        shared_ptr<const CompactGraph> g = snapshot();
+        if (hierarchyGraph[m] != g) {
+            hierarchies[m].build(*g, metric);
+            hierarchyGraph[m] = g;
+        }
+        return hierarchies[m];
+    }
+    
+    const Landmarks& landmarksFor(Metric metric) {
+        int m = (int)metric;
+        shared_ptr<const CompactGraph> g = snapshot();
+        if (landmarkGraph[m] != g) {
+            landmarks[m].build(*g, metric, landmarkCount);
+            landmarkGraph[m] = g;
+        }
+        return landmarks[m];
+    }
+    
+    // A sweep copies the hierarchy's arcs, so it stays valid for the graph
+    // it was prepared from even if the hierarchy is later reloaded.
+    ManySourceSweep sweeps[2]; // indexed by Metric
+    shared_ptr<const CompactGraph> sweepGraph[2];
+    
+    ManySourceSweep& sweepFor(Metric metric) {
+        int m = (int)metric;
+        shared_ptr<const CompactGraph> g = snapshot();
+        if (sweepGraph[m] != g) {
+            sweeps[m].prepare(hierarchyFor(metric));
+            sweepGraph[m] = g;
+        }
+        return sweeps[m];
+    }
+    
+    LineAwareSearch lineSearch;
+    ParetoSearch pareto;
+    AlternativeRoutes alternatives;
+    LineGraph lineGraph;
+    shared_ptr<const CompactGraph> lineGraphSource;
+    
+    const LineGraph& lineGraphFor() {
+        shared_ptr<const CompactGraph> g = snapshot();
+        if (lineGraphSource != g) {
+            lineGraph.build(*g);
+            lineGraphSource = g;
+        }
+        return lineGraph;
+    }
+    
+    // Only depends on the names, so edits that leave them alone keep it.
+    StationIndex stationIndex;
+    shared_ptr<const CompactGraph> stationIndexSource;
+    
+    const StationIndex& stationIndexFor() {
+        shared_ptr<const CompactGraph> g = snapshot();
+        if (stationIndexSource != g) {
+            if (!stationIndexSource || !sameNames(stationIndexSource->names, g->names)) {
+                stationIndex.build(*g);
+            }
+            stationIndexSource = g;
+        }
+        return stationIndex;
+    }
+    
+    static bool sameNames(const NameTable& a, const NameTable& b) {
+        return a.offsets.size() == b.offsets.size() && a.chars.size() == b.chars.size() &&
+               equal(a.offsets.begin(), a.offsets.end(), b.offsets.begin()) &&
+               equal(a.chars.begin(), a.chars.end(), b.chars.begin());
+    }
+    
+    // linePath with LineObjective::CostThenInterchanges, through lineCache.
+    // compact() has published the current graph by the time the key is
+    // formed, so versionNumber names the graph the answer came from.
+    bool cachedLinePath(const string& src, const string& dst, Metric metric, Route& route) {
+        if (!cachingRoutes) {
+            return linePath(src, dst, metric, LineObjective::CostThenInterchanges, route);
+        }
+        const CompactGraph& g = compact();
+        uint32_t s = g.id(src), t = g.id(dst);
+        if (s != CompactGraph::NO_STATION && t != CompactGraph::NO_STATION) {
+            if (shared_ptr<const Route> cached = lineCache.find(s, t, metric, versionNumber)) {
+                QueryProbe probe(instrumenting, "line_path");
+                probe.stations(s, t);
+                probe.cacheHit();
+                settled = 0;
+                route = *cached;
+                return route.found();
+            }
+        }
+        linePath(src, dst, metric, LineObjective::CostThenInterchanges, route);
+        if (s != CompactGraph::NO_STATION && t != CompactGraph::NO_STATION) {
+            lineCache.insert(s, t, metric, versionNumber, make_shared<const Route>(route));
+        }
+        return route.found();
+    }
+    
+    unique_ptr<BatchQueryEngine> batch;
+    
+    // Answers of the plain shortestPath search and of Get_Minimum_*, keyed
+    // by graph version: an edit publishes a new version and the old
+    // entries stop matching.
+    RouteCache pathCache;
+    RouteCache lineCache;
+    bool cachingRoutes = true;
+    
+    // Reused by the queries that only return a number, so those allocate
+    // nothing once the buffers have grown.
+    Route scratch;
+    
+    // Answers hasPath and turns away unreachable queries before they
+    // search. addEdge queues the stations it links (their ids are only
+    // known once the compact graph is rebuilt); removals mark it stale.
+    ConnectivityIndex components;
+    vector<pair<string, string>> pendingLinks;
+    
+    bool connected(uint32_t u, uint32_t v) {
+        refreshComponents();
+        return components.connected(u, v);
+    }
+    
+    void refreshComponents() {
+        const CompactGraph& g = compact();
+        if (components.stale()) {
+            components.build(g);
+        } else {
+            components.grow(g.numVertex());
+            for (const pair<string, string>& link : pendingLinks) {
+                components.connect(g.id(link.first), g.id(link.second));
+            }
+        }
+        pendingLinks.clear();
+    }
+    
+    void componentsChanged() {
+        components.invalidate();
+        pendingLinks.clear();
+    }
+    
+    // Counting twins of search and lineSearch, used instead of them while
+    // instrumentation is on so the plain ones carry no counters.
+    bool instrumenting = false;
+    BasicDijkstraSearch<SearchCounters> countedSearch;
+    BasicLineAwareSearch<SearchCounters> countedLineSearch;
+    
+    shared_ptr<const Timetable> timetable; // stop ids are compact station ids
+    ConnectionScan csa;
+    
+    AllPairsTable allPairs[2]; // indexed by Metric
+    bool allPairsEnabled = false;
+    bool allPairsStale = false; // vertex set changed, rebuild on next query
+    
+    AllPairsTable& allPairsFor(Metric metric) {
+        return allPairs[(int)metric];
+    }
+    
+    // Trees handed out by liveTree, repaired on every edge edit.
+    vector<shared_ptr<ShortestPathTree>> liveTrees;
+    TreeRepair treeRepair;
+    
+    // Readers may still hold the published tree, so an edit repairs a copy
+    // unless nobody else has it.
+    ShortestPathTree& writableTree(shared_ptr<ShortestPathTree>& tree) {
+        if (tree.use_count() > 1) {
+            tree = make_shared<ShortestPathTree>(*tree);
+        }
+        return *tree;
+    }
+    
+    // True if something built on the graph is patched on each edge edit;
+    // the edit then publishes the new compact graph straight away.
+    bool tracksEdits() {
+        return (allPairsEnabled && !allPairsStale) || !liveTrees.empty();
+    }
+    
+    // Brings the compact graph up to date after an edge edit made in the
+    // builder. While edits are tracked the current graph is patched, since a
+    // rebuild from the builder would cost far more than the repair after it.
+    void editCompact(const string& vname1, const string& vname2, int value, bool added) {
+        if (vname1 == vname2) {
+            return; // the compact graph has no self-loops
+        }
+        if (csrDirty || !tracksEdits()) {
+            csrDirty = true;
+            return;
+        }
+        shared_ptr<CompactGraph> g = make_shared<CompactGraph>();
+        editCompactGraph(*csr, csr->id(vname1), csr->id(vname2), value, added, *g);
+        csr = g;
+        publishVersion();
+    }
+    
+    void repairTrees(uint32_t u, uint32_t v, int value, bool added) {
+        const CompactGraph& g = compact();
+        for (shared_ptr<ShortestPathTree>& tree : liveTrees) {
+            ShortestPathTree& t = writableTree(tree);
+            if (added) {
+                int w = t.metric == Metric::Time ? travelTime(value) : value;
+                treeRepair.edgeAdded(g, t, u, v, w);
+            } else {
+                treeRepair.edgeRemoved(g, t, u, v);
+            }
+        }
+    }
+    
+    void refreshAllPairs() {
+        if (allPairsEnabled && allPairsStale) {
+            const CompactGraph& g = compact();
+            allPairsFor(Metric::Distance).build(g, Metric::Distance);
+            allPairsFor(Metric::Time).build(g, Metric::Time);
+            allPairsStale = false;
+        }
+    }
+    
+    shared_ptr<const CompactGraph> buildCompact() {
+        shared_ptr<CompactGraph> g = make_shared<CompactGraph>();
+        if (csr) {
+            g->lineNames = csr->lineNames;
+        }
         
-        bool operator<(const Node& other) const {
-            return cost > other.cost; // Min heap
+        unordered_map<string, uint32_t> ids;
+        ids.reserve(order.size());
+        for (uint32_t i = 0; i < order.size(); i++) {
+            ids[order[i]] = i;
         }
-    };
+        
+        // Line assignments from a loaded network survive later edits;
+        // edges without one fall back to the stations' shared lines.
+        vector<EdgeRecord> edges;
+        for (uint32_t i = 0; i < order.size(); i++) {
+            Vertex& vtx = vtces.find(order[i])->second;
+            uint32_t oi = csr ? csr->id(order[i]) : CompactGraph::NO_STATION;
+            for (auto& nbrPair : vtx.nbrs) {
+                uint32_t j = ids.find(nbrPair.first)->second;
+                if (i < j) {
+                    uint32_t lines = 0;
+                    if (oi != CompactGraph::NO_STATION) {
+                        uint32_t oj = csr->id(nbrPair.first);
+                        uint32_t a = oj == CompactGraph::NO_STATION ? oj : csr->arc(oi, oj);
+                        lines = a == CompactGraph::NO_STATION ? 0 : csr->arcLines[a];
+                    }
+                    edges.push_back(EdgeRecord{i, j, nbrPair.second, lines});
+                }
+            }
+        }
+        buildCompactGraph(order, edges, *g);
+        return g;
+    }
     
-    priority_queue<Node> pq;
+    // Recreates the string-keyed builder from the compact form after a
+    // network was adopted from a loader, so the mutation API keeps working.
+    void thaw() {
+        if (!builderStale) {
+            return;
+        }
+        const CompactGraph& g = *csr;
+        vtces.clear();
+        vtces.reserve(g.numVertex());
+        order = g.names.toVector();
+        for (uint32_t v = 0; v < g.numVertex(); v++) {
+            Vertex& vtx = vtces[g.names[v]];
+            for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                vtx.nbrs[g.names[g.targets[a]]] = g.distance[a];
+            }
+        }
+        builderStale = false;
+    }
     
 public:
-    void add(const string& vname, const string& psf, int cost) {
-        Node n;
-        n.vname = vname;
-        n.psf = psf;
-        n.cost = cost;
-        pq.push(n);
+    Graph_M() {}
+    
+    // Rebuilds the compact form after the builder API has been used. Queries
+    // call this implicitly; Create_Metro_Map calls it once up front.
+    void freeze() {
+        if (csrDirty) {
+            csr = buildCompact();
+            csrDirty = false;
+            publishVersion();
+        }
     }
     
-    bool isEmpty() {
-        return pq.empty();
+    const CompactGraph& compact() {
+        freeze();
+        return *csr;
     }
     
-    void remove(string& vname, string& psf, int& cost) {
-        Node n = pq.top();
-        pq.pop();
-        vname = n.vname;
-        psf = n.psf;
-        cost = n.cost;
+    shared_ptr<const CompactGraph> snapshot() {
+        freeze();
+        return csr;
     }
-};
-
-class Graph_M {
-private:
-    struct Vertex {
-        unordered_map<string, int> nbrs;
+    
+    enum {
+        // Largest network the menu precomputes all-pairs tables for: two
+        // metrics at 8 bytes per ordered pair is about 64 MB here.
+        ALL_PAIRS_MAX_STATIONS = 2000
     };
     
-    unordered_map<string, Vertex> vtces;
+    // Precomputes all-pairs distance and time tables so that shortestPath
+    // and hasPath become table lookups. The tables follow later edge edits
+    // incrementally. Costs O(V^2) memory, so only worth it on small networks
+    // (see ALL_PAIRS_MAX_STATIONS).
+    void enableAllPairs() {
+        if (!allPairsEnabled) {
+            allPairsEnabled = true;
+            allPairsStale = true;
+        }
+        refreshAllPairs();
+    }
     
-    struct Pair {
-        string vname;
-        string psf;
-        int min_dis;
-        int min_time;
-    };
+    // Compact id of a station, or CompactGraph::NO_STATION.
+    uint32_t stationId(const string& vname) {
+        return compact().id(vname);
+    }
     
-public:
-    Graph_M() {}
+    string stationName(uint32_t v) {
+        return compact().names[v];
+    }
+    
+    // Station named by what a rider typed: the exact name, the name in any
+    // case with or without its "~LINES" suffix (if no other station shares
+    // it), or its menu code. NO_STATION if nothing matches. Hash lookups
+    // only, however many stations there are (StationIndex.h).
+    uint32_t resolveStation(const string& text) {
+        uint32_t v = compact().id(text);
+        if (v != CompactGraph::NO_STATION) {
+            return v;
+        }
+        const StationIndex& index = stationIndexFor();
+        v = index.find(text);
+        return v != CompactGraph::NO_STATION ? v : index.findCode(text);
+    }
+    
+    // Station with a code from printCodelist, in any case, or NO_STATION.
+    uint32_t stationByCode(const string& code) {
+        return stationIndexFor().findCode(code);
+    }
+    
+    // Autocomplete: up to limit stations whose name starts with text,
+    // allowing maxEdits typos, fewest typos first, then alphabetical.
+    vector<StationMatch> completeStation(const string& text, uint32_t maxEdits = 0, size_t limit = 10) {
+        vector<StationMatch> out;
+        stationIndexFor().complete(text, maxEdits, limit, out);
+        return out;
+    }
+    
+    // Stations whose whole name is within maxEdits typos of text, closest
+    // first: suggestions for a name that does not resolve.
+    vector<StationMatch> closestStations(const string& text, uint32_t maxEdits = 2, size_t limit = 5) {
+        vector<StationMatch> out;
+        stationIndexFor().closest(text, maxEdits, limit, out);
+        return out;
+    }
+    
+    // Replaces the whole network with a prebuilt compact graph, e.g. from
+    // NetworkLoader. The string-keyed builder is only rebuilt if a mutation
+    // is made later.
+    void adopt(shared_ptr<const CompactGraph> g) {
+        csr = g;
+        csrDirty = false;
+        publishVersion();
+        componentsChanged();
+        builderStale = true;
+        vtces.clear();
+        order.clear();
+        liveTrees.clear();
+        allPairsStale = true;
+        refreshAllPairs();
+    }
+    
+    // Loads a network file (see NetworkLoader.h) in place of the current
+    // map. On failure the graph is unchanged and error says why.
+    bool loadNetwork(const string& path, string& error) {
+        shared_ptr<CompactGraph> g = make_shared<CompactGraph>();
+        shared_ptr<Timetable> tt = make_shared<Timetable>();
+        NetworkLoader loader;
+        if (!loader.loadFile(path, *g, error, tt.get())) {
+            return false;
+        }
+        adopt(g);
+        // A file without services drops the old timetable: its stop ids
+        // belong to the previous graph.
+        if (tt->empty()) {
+            timetable.reset();
+        } else {
+            timetable = tt;
+        }
+        return true;
+    }
+    
+    // Maps a snapshot written by snapshot_tool and answers queries straight
+    // from it. Precomputed tables in the snapshot are used as they are;
+    // all-pairs tables also switch on table lookups as enableAllPairs would.
+    bool loadSnapshot(const string& path, string& error) {
+        Snapshot snap;
+        if (!snap.open(path, error)) {
+            return false;
+        }
+        shared_ptr<const CompactGraph> g = snap.graph();
+        adopt(g);
+        timetable.reset();
+        
+        bool tables = snap.hasAllPairs(Metric::Distance) && snap.hasAllPairs(Metric::Time);
+        if (tables && snap.attachAllPairs(Metric::Distance, allPairsFor(Metric::Distance)) &&
+            snap.attachAllPairs(Metric::Time, allPairsFor(Metric::Time))) {
+            allPairsEnabled = true;
+            allPairsStale = false;
+        }
+        for (int m = 0; m < 2; m++) {
+            if (snap.attachHierarchy((Metric)m, hierarchies[m])) {
+                hierarchyGraph[m] = g;
+            }
+        }
+        return true;
+    }
+    
+    // Loads either a network file or a snapshot, telling them apart by the
+    // snapshot's magic bytes.
+    bool loadAny(const string& path, string& error) {
+        return isSnapshotFile(path) ? loadSnapshot(path, error) : loadNetwork(path, error);
+    }
     
     int numVertex() {
-        return vtces.size();
+        return compact().numVertex();
     }
     
     bool containsVertex(string vname) {
-        return vtces.find(vname) != vtces.end();
+        return compact().id(vname) != CompactGraph::NO_STATION;
     }
     
+    // Adding a station that already exists is a no-op (it used to wipe the
+    // station's edges while its neighbours still pointed at it).
     void addVertex(string vname) {
+        thaw();
+        if (vtces.find(vname) != vtces.end()) {
+            return;
+        }
         Vertex vtx;
+        order.push_back(vname);
         vtces[vname] = vtx;
+        csrDirty = true;
+        allPairsStale = true;
+        
+        // The new station takes the next id and is not reachable yet.
+        for (shared_ptr<ShortestPathTree>& tree : liveTrees) {
+            ShortestPathTree& t = writableTree(tree);
+            t.cost.push_back(INT_MAX);
+            t.pred.push_back(CompactGraph::NO_STATION);
+        }
     }
     
+    // Removing a station renumbers the others, so a loaded timetable and
+    // the live trees are dropped with it.
     void removeVertex(string vname) {
-        Vertex vtx = vtces[vname];
-        vector<string> keys;
-        
-        for (auto& pair : vtx.nbrs) {
-            keys.push_back(pair.first);
+        thaw();
+        auto it = vtces.find(vname);
+        if (it == vtces.end()) {
+            return;
         }
+        timetable.reset();
+        liveTrees.clear();
         
-        for (string key : keys) {
-            Vertex& nbrVtx = vtces[key];
-            nbrVtx.nbrs.erase(vname);
+        for (auto& pair : it->second.nbrs) {
+            if (pair.first != vname) {
+                vtces.find(pair.first)->second.nbrs.erase(vname);
+            }
         }
         
-        vtces.erase(vname);
+        vtces.erase(it);
+        order.erase(find(order.begin(), order.end(), vname));
+        csrDirty = true;
+        componentsChanged();
+        allPairsStale = true;
     }
     
     int numEdges() {
-        int count = 0;
-        for (auto& pair : vtces) {
-            count += pair.second.nbrs.size();
-        }
-        return count / 2;
+        return compact().numArcs() / 2;
     }
     
     bool containsEdge(string vname1, string vname2) {
-        if (vtces.find(vname1) == vtces.end() || vtces.find(vname2) == vtces.end()) {
+        const CompactGraph& g = compact();
+        uint32_t v1 = g.id(vname1), v2 = g.id(vname2);
+        if (v1 == CompactGraph::NO_STATION || v2 == CompactGraph::NO_STATION) {
             return false;
         }
-        
-        Vertex& vtx1 = vtces[vname1];
-        return vtx1.nbrs.find(vname2) != vtx1.nbrs.end();
+        return g.arc(v1, v2) != CompactGraph::NO_STATION;
     }
     
     void addEdge(string vname1, string vname2, int value) {
-        if (vtces.find(vname1) == vtces.end() || vtces.find(vname2) == vtces.end()) {
+        thaw();
+        auto it1 = vtces.find(vname1), it2 = vtces.find(vname2);
+        if (it1 == vtces.end() || it2 == vtces.end()) {
             return;
         }
         
-        Vertex& vtx1 = vtces[vname1];
-        Vertex& vtx2 = vtces[vname2];
+        Vertex& vtx1 = it1->second;
+        Vertex& vtx2 = it2->second;
         
         if (vtx1.nbrs.find(vname2) != vtx1.nbrs.end()) {
             return;
@@ -124,22 +594,93 @@ public:
         
         vtx1.nbrs[vname2] = value;
         vtx2.nbrs[vname1] = value;
+        editCompact(vname1, vname2, value, true);
+        if (!components.stale()) {
+            pendingLinks.emplace_back(vname1, vname2);
+        }
+        
+        if (!tracksEdits()) {
+            return;
+        }
+        const CompactGraph& g = compact();
+        uint32_t u = g.id(vname1), v = g.id(vname2);
+        if (allPairsEnabled && !allPairsStale) {
+            allPairsFor(Metric::Distance).edgeAdded(u, v, value);
+            allPairsFor(Metric::Time).edgeAdded(u, v, travelTime(value));
+        }
+        repairTrees(u, v, value, true);
     }
     
     void removeEdge(string vname1, string vname2) {
-        if (vtces.find(vname1) == vtces.end() || vtces.find(vname2) == vtces.end()) {
+        thaw();
+        auto it1 = vtces.find(vname1), it2 = vtces.find(vname2);
+        if (it1 == vtces.end() || it2 == vtces.end()) {
             return;
         }
         
-        Vertex& vtx1 = vtces[vname1];
-        Vertex& vtx2 = vtces[vname2];
+        Vertex& vtx1 = it1->second;
+        Vertex& vtx2 = it2->second;
         
-        if (vtx1.nbrs.find(vname2) == vtx1.nbrs.end()) {
+        auto edge = vtx1.nbrs.find(vname2);
+        if (edge == vtx1.nbrs.end()) {
             return;
         }
         
-        vtx1.nbrs.erase(vname2);
+        int value = edge->second;
+        vtx1.nbrs.erase(edge);
         vtx2.nbrs.erase(vname1);
+        editCompact(vname1, vname2, value, false);
+        componentsChanged();
+        
+        if (!tracksEdits()) {
+            return;
+        }
+        const CompactGraph& g = compact();
+        uint32_t u = g.id(vname1), v = g.id(vname2);
+        if (allPairsEnabled && !allPairsStale) {
+            allPairsFor(Metric::Distance).edgeRemoved(g, u, v, value);
+            allPairsFor(Metric::Time).edgeRemoved(g, u, v, travelTime(value));
+        }
+        repairTrees(u, v, value, false);
+    }
+    
+    // Applies a batch of edge edits in order and publishes the result as
+    // one new version, so concurrent readers see all of it or none of it.
+    void applyEdits(const vector<EdgeEdit>& edits) {
+        holdVersions = true;
+        for (const EdgeEdit& e : edits) {
+            if (e.kind == EdgeEdit::Add) {
+                addEdge(e.from, e.to, e.distance);
+            } else {
+                removeEdge(e.from, e.to);
+            }
+        }
+        freeze();
+        holdVersions = false;
+        if (versionHeld) {
+            publishVersion();
+        }
+    }
+    
+    // Pins the latest published version for a reader on any thread; the
+    // graph stays valid while the guard lives, whatever the writer does.
+    // This and version() are the only members safe to call concurrently
+    // with the thread that owns the Graph_M, which alone may edit or use
+    // the other queries. Publishing happens whenever the compact graph is
+    // rebuilt, so call freeze() (or applyEdits) to make edits visible.
+    RcuPointer<GraphVersion>::ReadGuard readVersion() const {
+        return versions.read();
+    }
+    
+    uint64_t version() const {
+        RcuPointer<GraphVersion>::ReadGuard v = versions.read();
+        return v ? v->number : 0;
+    }
+    
+    // The published versions themselves, for a QueryServer or other
+    // reader pool to hold on to.
+    const RcuPointer<GraphVersion>& publishedVersions() const {
+        return versions;
     }
     
     void display_Map() {
@@ -147,17 +688,18 @@ public:
         cout << "\t------------------" << endl;
         cout << "----------------------------------------------------\n" << endl;
         
-        for (auto& pair : vtces) {
-            string str = pair.first + " =>\n";
-            Vertex& vtx = pair.second;
+        const CompactGraph& g = compact();
+        for (uint32_t v = 0; v < g.numVertex(); v++) {
+            string str = g.names[v] + " =>\n";
             
-            for (auto& nbrPair : vtx.nbrs) {
-                str += "\t" + nbrPair.first + "\t";
-                if (nbrPair.first.length() < 16)
+            for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                const string& nbr = g.names[g.targets[a]];
+                str += "\t" + nbr + "\t";
+                if (nbr.length() < 16)
                     str += "\t";
-                if (nbrPair.first.length() < 8)
+                if (nbr.length() < 8)
                     str += "\t";
-                str += to_string(nbrPair.second) + "\n";
+                str += to_string(g.distance[a]) + "\n";
             }
             cout << str << endl;
         }
@@ -167,234 +709,504 @@ public:
     
     void display_Stations() {
         cout << "\n***********************************************************************\n" << endl;
-        int i = 1;
-        for (auto& pair : vtces) {
-            cout << i << ". " << pair.first << endl;
-            i++;
+        const NameTable& names = compact().names;
+        for (size_t v = 0; v < names.size(); v++) {
+            cout << v + 1 << ". " << names[v] << endl;
         }
         cout << "\n***********************************************************************\n" << endl;
     }
     
-    bool hasPath(string vname1, string vname2, unordered_map<string, bool>& processed) {
-        if (containsEdge(vname1, vname2)) {
-            return true;
+    // Whether any route joins the two stations: a lookup in the component
+    // index (Connectivity.h), which is rebuilt first if a station or edge
+    // was removed since the last query.
+    bool hasPath(const string& vname1, const string& vname2) {
+        QueryProbe probe(instrumenting, "has_path");
+        const CompactGraph& g = compact();
+        uint32_t v1 = g.id(vname1), v2 = g.id(vname2);
+        probe.stations(v1, v2);
+        probe.phase("lookup");
+        if (v1 == CompactGraph::NO_STATION || v2 == CompactGraph::NO_STATION) {
+            return false;
         }
+        return connected(v1, v2);
+    }
+    
+    // Number of connected components; 1 when every station can reach
+    // every other.
+    uint32_t numComponents() {
+        refreshComponents();
+        return components.numComponents();
+    }
+    
+    int dijkstra(const string& src, const string& des, bool nan) {
+        return shortestPath(src, des, nan ? Metric::Time : Metric::Distance, scratch) ? scratch.cost : 0;
+    }
+    
+    // Shortest route, and among equally short ones the one with the fewest
+    // interchanges; route.interchanges() comes from the search itself.
+    Route Get_Minimum_Distance(const string& src, const string& dst) {
+        Route route;
+        cachedLinePath(src, dst, Metric::Distance, route);
+        return route;
+    }
+    
+    Route Get_Minimum_Time(const string& src, const string& dst) {
+        Route route;
+        cachedLinePath(src, dst, Metric::Time, route);
+        return route;
+    }
+    
+    // The same into a caller's Route, whose buffers are reused: a caller
+    // that keeps one Route per thread makes these queries allocation-free.
+    // Returns route.found().
+    bool Get_Minimum_Distance(const string& src, const string& dst, Route& route) {
+        return cachedLinePath(src, dst, Metric::Distance, route);
+    }
+    
+    bool Get_Minimum_Time(const string& src, const string& dst, Route& route) {
+        return cachedLinePath(src, dst, Metric::Time, route);
+    }
+    
+    // Turns the route caches used by shortestPath (without a mode) and
+    // Get_Minimum_* on or off; off also empties them. On by default.
+    void setRouteCaching(bool on) {
+        cachingRoutes = on;
+        if (!on) {
+            pathCache.clear();
+            lineCache.clear();
+        }
+    }
+    
+    // Records counters, phase timings and a trace for every shortestPath,
+    // linePath, Get_Minimum_* and hasPath call (see Instrumentation.h).
+    // Off by default; when off the queries run the uncounted engines.
+    void setInstrumentation(bool on) {
+        instrumenting = on;
+    }
+    
+    bool instrumented() const {
+        return instrumenting;
+    }
+    
+    // The most recent query traces, as Chrome trace / Perfetto JSON.
+    void writeTrace(ostream& out) const {
+        TraceLog::instance().writeChromeTrace(out);
+    }
+    
+    // Process-wide query metrics plus this graph's route cache and size, in
+    // Prometheus text format.
+    void writeMetrics(ostream& out) {
+        MetricsRegistry::instance().writePrometheus(out);
+        RouteCache::Stats cache = routeCacheStats();
+        out << "# TYPE metropath_route_cache_hits_total counter\nmetropath_route_cache_hits_total "
+            << cache.hits << "\n# TYPE metropath_route_cache_misses_total counter\nmetropath_route_cache_misses_total "
+            << cache.misses << "\n# TYPE metropath_route_cache_evictions_total counter\n"
+            << "metropath_route_cache_evictions_total " << cache.evictions
+            << "\n# TYPE metropath_route_cache_entries gauge\nmetropath_route_cache_entries " << cache.entries
+            << "\n# TYPE metropath_stations gauge\nmetropath_stations " << compact().numVertex()
+            << "\n# TYPE metropath_graph_version gauge\nmetropath_graph_version " << versionNumber << "\n";
+    }
+    
+    // Hits, misses and evictions of both route caches together.
+    RouteCache::Stats routeCacheStats() const {
+        RouteCache::Stats a = pathCache.stats(), b = lineCache.stats();
+        a.hits += b.hits;
+        a.misses += b.misses;
+        a.evictions += b.evictions;
+        a.entries += b.entries;
+        return a;
+    }
+    
+    // Search over the station x line graph, where changing lines is an arc
+    // of its own and the objective decides how interchanges are weighed.
+    // route.lines and route.changes say which line each leg is ridden on.
+    Route linePath(const string& src, const string& dst, Metric metric, LineObjective objective) {
+        Route route;
+        linePath(src, dst, metric, objective, route);
+        return route;
+    }
+    
+    bool linePath(const string& src, const string& dst, Metric metric, LineObjective objective, Route& route) {
+        QueryProbe probe(instrumenting, "line_path");
+        const CompactGraph& g = compact();
+        uint32_t s = g.id(src), t = g.id(dst);
+        probe.stations(s, t);
         
-        processed[vname1] = true;
-        
-        Vertex& vtx = vtces[vname1];
-        
-        for (auto& pair : vtx.nbrs) {
-            string nbr = pair.first;
-            if (processed.find(nbr) == processed.end()) {
-                if (hasPath(nbr, vname2, processed)) {
-                    return true;
-                }
-            }
+        route.reset(metric);
+        settled = 0;
+        if (s == CompactGraph::NO_STATION || t == CompactGraph::NO_STATION || !connected(s, t)) {
+            return false;
         }
+        const LineGraph& lg = lineGraphFor();
+        probe.phase("lookup");
+        if (instrumenting) {
+            countedLineSearch.run(g, lg, s, t, metric, objective);
+            probe.phase("search");
+            countedLineSearch.route(g, lg, route);
+            probe.phase("route");
+            probe.counters(countedLineSearch.counters());
+            settled = countedLineSearch.settledCount();
+            return route.found();
+        }
+        lineSearch.run(g, lg, s, t, metric, objective);
+        lineSearch.route(g, lg, route);
+        settled = lineSearch.settledCount();
+        return route.found();
+    }
+    
+    // Every Pareto-optimal route between two stations on time, distance and
+    // interchanges, fastest first, from one search. The fastest, shortest
+    // and fewest-changes routes are all among them. Empty if either station
+    // is unknown or dst is unreachable.
+    vector<RouteOption> routeOptions(const string& src, const string& dst) {
+        const CompactGraph& g = compact();
+        uint32_t s = g.id(src), t = g.id(dst);
         
-        return false;
+        vector<RouteOption> options;
+        settled = 0;
+        if (s == CompactGraph::NO_STATION || t == CompactGraph::NO_STATION) {
+            return options;
+        }
+        const LineGraph& lg = lineGraphFor();
+        pareto.run(g, lg, s, t);
+        pareto.options(g, lg, options);
+        settled = pareto.settledCount();
+        return options;
     }
     
-    int dijkstra(string src, string des, bool nan) {
-        int val = 0;
-        unordered_map<string, pair<int, string>> map; // cost, psf
-        Heap heap;
+    // The k cheapest loopless routes, cheapest first, for when the best one
+    // is disrupted. Fewer if there are not k.
+    vector<Route> kShortestPaths(const string& src, const string& dst, Metric metric, size_t k) {
+        const CompactGraph& g = compact();
+        uint32_t s = g.id(src), t = g.id(dst);
         
-        for (auto& pair : vtces) {
-            string key = pair.first;
-            int cost = INT_MAX;
-            string psf = "";
-            
-            if (key == src) {
-                cost = 0;
-                psf = key;
-            }
-            
-            heap.add(key, psf, cost);
-            map[key] = make_pair(cost, psf);
+        vector<Route> routes;
+        settled = 0;
+        if (s == CompactGraph::NO_STATION || t == CompactGraph::NO_STATION) {
+            return routes;
         }
+        alternatives.kShortest(g, s, t, metric, k, routes);
+        settled = alternatives.settledCount();
+        return routes;
+    }
+    
+    // Up to k routes that mostly avoid each other's track, best first; see
+    // DiversityOptions for how far they may stray.
+    vector<Route> diverseRoutes(const string& src, const string& dst, Metric metric, size_t k,
+                                const DiversityOptions& options = DiversityOptions()) {
+        const CompactGraph& g = compact();
+        uint32_t s = g.id(src), t = g.id(dst);
         
-        while (!heap.isEmpty()) {
-            string rpVname, rpPsf;
-            int rpCost;
-            heap.remove(rpVname, rpPsf, rpCost);
-            
-            if (rpVname == des) {
-                val = rpCost;
-                break;
-            }
-            
-            map.erase(rpVname);
-            
-            Vertex& v = vtces[rpVname];
-            for (auto& nbrPair : v.nbrs) {
-                string nbr = nbrPair.first;
-                if (map.find(nbr) != map.end()) {
-                    int oc = map[nbr].first;
-                    int nc;
-                    
-                    if (nan)
-                        nc = rpCost + 120 + 40 * nbrPair.second;
-                    else
-                        nc = rpCost + nbrPair.second;
-                    
-                    if (nc < oc) {
-                        map[nbr].first = nc;
-                        map[nbr].second = rpPsf + nbr;
-                        heap.add(nbr, rpPsf + nbr, nc);
-                    }
-                }
-            }
+        vector<Route> routes;
+        settled = 0;
+        if (s == CompactGraph::NO_STATION || t == CompactGraph::NO_STATION) {
+            return routes;
         }
-        return val;
+        alternatives.diverse(g, s, t, metric, k, options, routes);
+        settled = alternatives.settledCount();
+        return routes;
     }
     
-    string Get_Minimum_Distance(string src, string dst) {
-        int min = INT_MAX;
-        string ans = "";
-        unordered_map<string, bool> processed;
-        list<Pair> stack;
+    // Cost of one interchange under LineObjective::Weighted, in km or
+    // seconds. Defaults: 2 km, 300 s.
+    void setTransferPenalty(Metric metric, int penalty) {
+        lineSearch.setTransferPenalty(metric, penalty);
+        countedLineSearch.setTransferPenalty(metric, penalty);
+    }
+    
+    // Single-source search that stops once dst is settled. Returns an empty
+    // route if either station is unknown or dst is unreachable.
+    Route shortestPath(const string& src, const string& dst, Metric metric) {
+        Route route;
+        shortestPath(src, dst, metric, route);
+        return route;
+    }
+    
+    // The same into a caller's Route, reusing its buffers (see
+    // Get_Minimum_Distance). Returns route.found().
+    bool shortestPath(const string& src, const string& dst, Metric metric, Route& route) {
+        QueryProbe probe(instrumenting, "shortest_path");
+        const CompactGraph& g = compact();
+        uint32_t s = g.id(src), t = g.id(dst);
+        probe.stations(s, t);
+        probe.phase("lookup");
         
-        Pair sp;
-        sp.vname = src;
-        sp.psf = src + "  ";
-        sp.min_dis = 0;
-        sp.min_time = 0;
+        route.reset(metric);
+        if (s == CompactGraph::NO_STATION || t == CompactGraph::NO_STATION || !connected(s, t)) {
+            return false;
+        }
         
-        stack.push_front(sp);
+        if (allPairsEnabled) {
+            refreshAllPairs();
+            allPairsFor(metric).route(g, s, t, route);
+            return route.found();
+        }
         
-        while (!stack.empty()) {
-            Pair rp = stack.front();
-            stack.pop_front();
-            
-            if (processed.find(rp.vname) != processed.end()) {
-                continue;
-            }
-            
-            processed[rp.vname] = true;
-            
-            if (rp.vname == dst) {
-                int temp = rp.min_dis;
-                if (temp < min) {
-                    ans = rp.psf;
-                    min = temp;
-                }
-                continue;
-            }
-            
-            Vertex& rpvtx = vtces[rp.vname];
-            
-            for (auto& nbrPair : rpvtx.nbrs) {
-                string nbr = nbrPair.first;
-                if (processed.find(nbr) == processed.end()) {
-                    Pair np;
-                    np.vname = nbr;
-                    np.psf = rp.psf + nbr + "  ";
-                    np.min_dis = rp.min_dis + nbrPair.second;
-                    stack.push_front(np);
-                }
-            }
+        shared_ptr<const Route> cached;
+        if (cachingRoutes && (cached = pathCache.find(s, t, metric, versionNumber))) {
+            probe.cacheHit();
+            route = *cached;
+            return route.found();
+        }
+        if (instrumenting) {
+            countedSearch.run(g, s, t, metric);
+            probe.phase("search");
+            countedSearch.route(g, t, route);
+            probe.phase("route");
+            probe.counters(countedSearch.counters());
+        } else {
+            search.run(g, s, t, metric);
+            search.route(g, t, route);
         }
-        ans += to_string(min);
-        return ans;
+        if (cachingRoutes) {
+            pathCache.insert(s, t, metric, versionNumber, make_shared<const Route>(route));
+        }
+        return route.found();
     }
     
-    string Get_Minimum_Time(string src, string dst) {
-        int min = INT_MAX;
-        string ans = "";
-        unordered_map<string, bool> processed;
-        list<Pair> stack;
-        
-        Pair sp;
-        sp.vname = src;
-        sp.psf = src + "  ";
-        sp.min_dis = 0;
-        sp.min_time = 0;
+    // Point-to-point query with an explicit engine, bypassing the all-pairs
+    // tables. ALT landmarks are computed on first use and again after the
+    // graph changes. lastSettledCount() reports the work done.
+    Route shortestPath(const string& src, const string& dst, Metric metric, SearchMode mode) {
+        const CompactGraph& g = compact();
+        uint32_t s = g.id(src), t = g.id(dst);
         
-        stack.push_front(sp);
+        Route route;
+        route.metric = metric;
+        settled = 0;
+        if (s == CompactGraph::NO_STATION || t == CompactGraph::NO_STATION || !connected(s, t)) {
+            return route;
+        }
         
-        while (!stack.empty()) {
-            Pair rp = stack.front();
-            stack.pop_front();
-            
-            if (processed.find(rp.vname) != processed.end()) {
-                continue;
-            }
-            
-            processed[rp.vname] = true;
-            
-            if (rp.vname == dst) {
-                int temp = rp.min_time;
-                if (temp < min) {
-                    ans = rp.psf;
-                    min = temp;
-                }
-                continue;
+        if (mode == SearchMode::Bidirectional) {
+            bidirectional.run(g, s, t, metric);
+            bidirectional.route(g, route);
+            settled = bidirectional.settledCount();
+        } else if (mode == SearchMode::CH) {
+            const ContractionHierarchy& ch = hierarchyFor(metric);
+            chSearch.run(ch, s, t);
+            chSearch.route(g, ch, route);
+            settled = chSearch.settledCount();
+        } else if (mode == SearchMode::ALT) {
+            alt.run(g, landmarksFor(metric), s, t);
+            alt.route(g, route);
+            settled = alt.settledCount();
+        } else {
+            search.run(g, s, t, metric);
+            search.route(g, t, route);
+            settled = search.settledCount();
+        }
+        return route;
+    }
+    
+    uint32_t lastSettledCount() {
+        return settled;
+    }
+    
+    // True if the loaded network file had service or trip records.
+    bool hasTimetable() {
+        return timetable != nullptr;
+    }
+    
+    // Whether v has a stop in the loaded timetable. Stations added since it
+    // was loaded have ids past its arrays, and no trains.
+    bool onTimetable(uint32_t v) const {
+        return timetable && v < timetable->numStops;
+    }
+    
+    // Earliest arrival at dst leaving src at departure (seconds after
+    // midnight), waiting for trains and changing as the timetable allows.
+    // Empty journey if there is no timetable or no connection that day.
+    Journey earliestArrival(const string& src, const string& dst, int departure) {
+        Journey journey;
+        journey.departure = departure;
+        uint32_t s = stationId(src), t = stationId(dst);
+        if (!onTimetable(s) || !onTimetable(t)) {
+            return journey;
+        }
+        csa.earliestArrival(*timetable, s, t, departure);
+        csa.journey(*timetable, journey);
+        return journey;
+    }
+    
+    // All worthwhile departures from src to dst between from and to, each
+    // with its earliest arrival.
+    vector<ProfileEntry> departureProfile(const string& src, const string& dst, int from, int to) {
+        vector<ProfileEntry> out;
+        uint32_t s = stationId(src), t = stationId(dst);
+        if (onTimetable(s) && onTimetable(t)) {
+            csa.profile(*timetable, s, t, from, to, out);
+        }
+        return out;
+    }
+    
+    // Writes the contraction hierarchy for a metric (building it first if
+    // needed) so a later process can load it instead of preprocessing.
+    bool saveHierarchy(Metric metric, const string& path) {
+        const ContractionHierarchy& ch = hierarchyFor(metric);
+        ofstream out(path.c_str(), ios::binary);
+        ch.save(out);
+        return (bool)out;
+    }
+    
+    // Loads a hierarchy written by saveHierarchy. Fails if the file is
+    // unreadable or was built from a different network.
+    bool loadHierarchy(Metric metric, const string& path) {
+        int m = (int)metric;
+        shared_ptr<const CompactGraph> g = snapshot();
+        ifstream in(path.c_str(), ios::binary);
+        if (!in || !hierarchies[m].load(in, *g) || hierarchies[m].metricType() != metric) {
+            hierarchyGraph[m].reset();
+            return false;
+        }
+        hierarchyGraph[m] = g;
+        return true;
+    }
+    
+    // Number of landmarks used by SearchMode::ALT (default 8).
+    void setLandmarkCount(uint32_t count) {
+        landmarkCount = count;
+        landmarkGraph[0].reset();
+        landmarkGraph[1].reset();
+    }
+    
+    // Answers many OD queries (by station id) in parallel against the
+    // current graph snapshot. results[i] answers queries[i].
+    vector<Route> batchQuery(const vector<ODQuery>& queries, unsigned threads = 0) {
+        if (!batch || (threads != 0 && batch->threads() != threads)) {
+            batch.reset(new BatchQueryEngine(threads));
+        }
+        vector<Route> results;
+        batch->run(snapshot(), queries, results);
+        return results;
+    }
+    
+    // Many-to-many variant of batchQuery: queries sharing a source (or a
+    // target) are answered from one sweep.
+    vector<Route> manyToMany(const vector<ODQuery>& queries, unsigned threads = 0) {
+        if (!batch || (threads != 0 && batch->threads() != threads)) {
+            batch.reset(new BatchQueryEngine(threads));
+        }
+        vector<Route> results;
+        batch->runGrouped(snapshot(), queries, results);
+        return results;
+    }
+    
+    // Costs to every station from src plus the shortest-path tree, in one
+    // sweep. Returns an empty tree if src is unknown.
+    ShortestPathTree oneToAll(const string& src, Metric metric) {
+        const CompactGraph& g = compact();
+        ShortestPathTree tree;
+        tree.metric = metric;
+        uint32_t s = g.id(src);
+        if (s != CompactGraph::NO_STATION) {
+            search.tree(g, s, metric, tree);
+        }
+        return tree;
+    }
+    
+    // Costs from each station in sources to every station, one row per
+    // source: table[i * numVertex() + v] for station id v (stationId), or
+    // INT_MAX where unreachable. An unknown source gives a row of INT_MAX.
+    // Sixteen sources share each sweep (ManySource.h), which is far cheaper
+    // than a oneToAll per source; the first call for a metric builds its
+    // contraction hierarchy.
+    void distanceTable(const vector<string>& sources, Metric metric, vector<int>& table) {
+        const CompactGraph& g = compact();
+        vector<uint32_t> ids(sources.size());
+        for (size_t i = 0; i < sources.size(); i++) {
+            ids[i] = g.id(sources[i]);
+        }
+        sweepFor(metric).run(ids.data(), ids.size(), table);
+    }
+    
+    // Kernel for distanceTable's sweeps; the default is the fastest this
+    // CPU supports, and asking for one it lacks falls back to that.
+    void setSweepKernel(SweepKernel kernel) {
+        sweeps[0].setKernel(kernel);
+        sweeps[1].setKernel(kernel);
+    }
+    
+    SweepKernel sweepKernel() const {
+        return sweeps[0].currentKernel();
+    }
+    
+    // Shortest-path tree from src that later addEdge and removeEdge calls
+    // repair in place of a fresh sweep (see TreeRepair.h). The tree returned
+    // is never changed afterwards: an edit publishes a repaired copy, so
+    // callers holding this one can keep reading it. Call again for the
+    // current tree. Null if src is unknown.
+    shared_ptr<const ShortestPathTree> liveTree(const string& src, Metric metric) {
+        const CompactGraph& g = compact();
+        uint32_t s = g.id(src);
+        if (s == CompactGraph::NO_STATION) {
+            return nullptr;
+        }
+        for (const shared_ptr<ShortestPathTree>& tree : liveTrees) {
+            if (tree->root == s && tree->metric == metric) {
+                return tree;
             }
-            
-            Vertex& rpvtx = vtces[rp.vname];
-            
-            for (auto& nbrPair : rpvtx.nbrs) {
-                string nbr = nbrPair.first;
-                if (processed.find(nbr) == processed.end()) {
-                    Pair np;
-                    np.vname = nbr;
-                    np.psf = rp.psf + nbr + "  ";
-                    np.min_time = rp.min_time + 120 + 40 * nbrPair.second;
-                    stack.push_front(np);
-                }
+        }
+        shared_ptr<ShortestPathTree> tree = make_shared<ShortestPathTree>();
+        search.tree(g, s, metric, *tree);
+        liveTrees.push_back(tree);
+        return tree;
+    }
+    
+    // Stops repairing the live tree from src.
+    void dropLiveTree(const string& src, Metric metric) {
+        uint32_t s = stationId(src);
+        for (size_t i = 0; i < liveTrees.size(); i++) {
+            if (liveTrees[i]->root == s && liveTrees[i]->metric == metric) {
+                liveTrees.erase(liveTrees.begin() + i);
+                return;
             }
         }
-        double minutes = ceil((double)min / 60);
-        ans += to_string(minutes);
-        return ans;
     }
     
-    vector<string> get_Interchanges(string str) {
+    // Formats a route for the menu: the stations in order, with "A ==> B"
+    // marking a change of line at A, then the interchange count and the cost
+    // (km, or minutes rounded up).
+    vector<string> get_Interchanges(const Route& route) {
+        const CompactGraph& g = compact();
         vector<string> arr;
-        vector<string> res;
-        
-        stringstream ss(str);
-        string token;
-        while (ss >> token) {
-            if (!token.empty())
-                res.push_back(token);
-        }
+        const vector<size_t>& changes = route.changes;
+        size_t last = route.stations.size() - 1;
+        size_t c = 0;
         
-        arr.push_back(res[0]);
-        int count = 0;
-        
-        for (int i = 1; i < res.size() - 1; i++) {
-            int index = res[i].find('~');
-            string s = res[i].substr(index + 1);
-            
-            if (s.length() == 2) {
-                string prev = res[i - 1].substr(res[i - 1].find('~') + 1);
-                string next = res[i + 1].substr(res[i + 1].find('~') + 1);
-                
-                if (prev == next) {
-                    arr.push_back(res[i]);
-                } else {
-                    arr.push_back(res[i] + " ==> " + res[i + 1]);
+        arr.push_back(g.names[route.stations[0]]);
+        size_t i = 1;
+        for (; i < last; i++) {
+            string name = g.names[route.stations[i]];
+            if (c < changes.size() && changes[c] == i) {
+                arr.push_back(name + " ==> " + g.names[route.stations[i + 1]]);
+                c++;
+                i++;
+                // Back-to-back changes stay on one entry.
+                while (i < last && c < changes.size() && changes[c] == i) {
+                    arr.back() += " ==> " + g.names[route.stations[i + 1]];
+                    c++;
                     i++;
-                    count++;
                 }
             } else {
-                arr.push_back(res[i]);
+                arr.push_back(name);
             }
         }
-        arr.push_back(to_string(count));
-        arr.push_back(res[res.size() - 1]);
+        if (i == last) {
+            arr.push_back(g.names[route.stations[last]]);
+        }
+        
+        arr.push_back(to_string(changes.size()));
+        if (route.metric == Metric::Time) {
+            arr.push_back(to_string(toMinutes(route.cost)));
+        } else {
+            arr.push_back(to_string(route.cost));
+        }
         return arr;
     }
     
     vector<string> getKeys() {
-        vector<string> keys;
-        for (auto& pair : vtces) {
-            keys.push_back(pair.first);
-        }
-        return keys;
+        return compact().names.toVector();
     }
     
     static void Create_Metro_Map(Graph_M& g) {
@@ -436,7 +1248,6 @@ public:
         g.addVertex("Salt Lake Sector V~GO");
         
         // Orange Line (Line 6) - Kavi Subhash to Hemanta Mukhopadhyay
-        g.addVertex("Kavi Subhash~BO");
         g.addVertex("Hemanta Mukhopadhyay~O");
         g.addVertex("Kavi Nazrul~O");
         g.addVertex("City Centre~O");
@@ -456,8 +1267,6 @@ public:
         g.addVertex("Majerhat~P");
         
         // Yellow Line (Line 5) - Noapara to Jai Hind
-        g.addVertex("Noapara~BY");
-        g.addVertex("Baranagar~BP");
         g.addVertex("Biman Bandar~YO");
         g.addVertex("Jai Hind~YO");
         
@@ -522,46 +1331,27 @@ public:
         g.addEdge("Noapara~BY", "Biman Bandar~YO", 3);
         g.addEdge("Biman Bandar~YO", "Jai Hind~YO", 1);
         g.addEdge("Jai Hind~YO", "Beleghata~O", 2);
+        
+        g.freeze();
     }
     
     vector<string> printCodelist() {
         cout << "List of station along with their codes:\n" << endl;
-        vector<string> keys = getKeys();
-        vector<string> codes(keys.size());
+        const CompactGraph& g = compact();
+        const StationIndex& index = stationIndexFor();
+        vector<string> codes(g.numVertex());
         int i = 1, m = 1;
         
-        for (int idx = 0; idx < keys.size(); idx++) {
-            string key = keys[idx];
-            string code = "";
-            stringstream ss(key);
-            string temp;
-            
-            while (ss >> temp) {
-                int j = 0;
-                char c = temp[0];
-                while (j < temp.length() && c >= '0' && c <= '9') {
-                    code += c;
-                    j++;
-                    if (j < temp.length())
-                        c = temp[j];
-                }
-                if (j < temp.length() && (c < '0' || c > '9') && c < 123) {
-                    code += c;
-                }
-            }
-            
-            if (code.length() < 2 && temp.length() > 1) {
-                code += toupper(temp[1]);
-            }
-            
-            codes[idx] = code;
+        for (uint32_t idx = 0; idx < g.numVertex(); idx++) {
+            string key = g.names[idx];
+            codes[idx] = index.code(idx);
             
             cout << i << ". " << key << "\t";
-            if (key.length() < (22 - m))
+            if ((int)key.length() < 22 - m)
                 cout << "\t";
-            if (key.length() < (14 - m))
+            if ((int)key.length() < 14 - m)
                 cout << "\t";
-            if (key.length() < (6 - m))
+            if ((int)key.length() < 6 - m)
                 cout << "\t";
             cout << codes[idx] << endl;
             
@@ -573,9 +1363,139 @@ public:
     }
 };
 
-int main() {
+// Tools that drive Graph_M directly (benchmark.cpp) include this file with
+// METROPATH_NO_MAIN defined and bring their own main.
+#ifndef METROPATH_NO_MAIN
+#ifndef _WIN32
+static QueryServer* servingNow = nullptr;
+
+static void stopServing(int) {
+    if (servingNow) {
+        servingNow->stop();
+    }
+}
+
+// Headless mode: answers JSON requests (see Server.h) until SIGINT/SIGTERM.
+// With a metrics file, requests are instrumented and the file is kept
+// current for scraping.
+static int serve(Graph_M& g, const string& endpoint, unsigned threads, const string& metrics) {
+    g.freeze();
+    QueryServer server(g.publishedVersions(), threads);
+    if (!metrics.empty()) {
+        server.setInstrumentation(true);
+        server.setMetricsFile(metrics);
+    }
+    string error;
+    if (!server.listen(endpoint, error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    servingNow = &server;
+    signal(SIGINT, stopServing);
+    signal(SIGTERM, stopServing);
+    cerr << "serving " << g.numVertex() << " stations on " << endpoint << " with " << server.threads()
+         << " threads" << endl;
+    server.run();
+    servingNow = nullptr;
+    cerr << "served " << server.served() << " requests" << endl;
+    return 0;
+}
+#endif
+
+// Full name of a station the rider typed, in any form resolveStation
+// accepts. Input that names no station comes back unchanged, after a hint
+// at the closest names, so the caller's own check still rejects it.
+static string resolveInput(Graph_M& g, const string& text) {
+    uint32_t v = g.resolveStation(text);
+    if (v != CompactGraph::NO_STATION) {
+        return g.stationName(v);
+    }
+    vector<StationMatch> near = g.closestStations(text);
+    if (near.empty()) {
+        near = g.completeStation(text, 1, 5);
+    }
+    if (!near.empty()) {
+        cout << "NO STATION NAMED \"" << text << "\". DID YOU MEAN: ";
+        for (size_t i = 0; i < near.size(); i++) {
+            cout << (i ? ", " : "") << g.stationName(near[i].station);
+        }
+        cout << "?" << endl;
+    }
+    return text;
+}
+
+// Writes the query trace and metrics asked for on the command line.
+static void writeReports(Graph_M& g, const string& trace, const string& metrics) {
+    if (!trace.empty()) {
+        ofstream out(trace.c_str());
+        g.writeTrace(out);
+    }
+    if (!metrics.empty()) {
+        ofstream out(metrics.c_str());
+        g.writeMetrics(out);
+    }
+}
+
+static int usage() {
+    cerr << "usage: metro [NETWORK_FILE | SNAPSHOT] [--serve ENDPOINT [--threads N]]\n"
+         << "             [--metrics FILE] [--trace FILE]" << endl;
+    return 2;
+}
+
+// metro [network file or snapshot] [--serve ENDPOINT [--threads N]]
+//       [--metrics FILE] [--trace FILE]
+int main(int argc, char* argv[]) {
     Graph_M g;
-    Graph_M::Create_Metro_Map(g);
+    string network, endpoint, metrics, trace;
+    unsigned threads = 0;
+    for (int i = 1; i < argc; i++) {
+        string arg = argv[i];
+        if (arg.compare(0, 1, "-") != 0) {
+            if (!network.empty()) {
+                return usage(); // only one network
+            }
+            network = arg;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return usage(); // every flag takes a value
+        }
+        string value = argv[++i];
+        if (arg == "--serve") {
+            endpoint = value;
+        } else if (arg == "--threads") {
+            threads = (unsigned)atoi(value.c_str());
+        } else if (arg == "--metrics") {
+            metrics = value;
+        } else if (arg == "--trace") {
+            trace = value;
+        } else {
+            return usage();
+        }
+    }
+    if (!network.empty()) {
+        string error;
+        if (!g.loadAny(network, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+    } else {
+        Graph_M::Create_Metro_Map(g);
+    }
+    if (!endpoint.empty()) {
+#ifndef _WIN32
+        return serve(g, endpoint, threads, metrics);
+#else
+        cerr << "--serve needs a POSIX system" << endl;
+        return 1;
+#endif
+    }
+    // Larger networks, e.g. ones loaded from a file, keep answering with a
+    // Dijkstra search per query.
+    if (g.numVertex() <= Graph_M::ALL_PAIRS_MAX_STATIONS) {
+        g.enableAllPairs();
+    }
+    g.setInstrumentation(!metrics.empty() || !trace.empty());
     
     cout << "\n\t\t\t****WELCOME TO THE METRO APP*****" << endl;
     
@@ -588,7 +1508,9 @@ int main() {
         cout << "5. GET SHORTEST PATH (DISTANCE WISE) TO REACH FROM A 'SOURCE' STATION TO 'DESTINATION' STATION" << endl;
         cout << "6. GET SHORTEST PATH (TIME WISE) TO REACH FROM A 'SOURCE' STATION TO 'DESTINATION' STATION" << endl;
         cout << "7. EXIT THE MENU" << endl;
-        cout << "\nENTER YOUR CHOICE FROM THE ABOVE LIST (1 to 7) : ";
+        cout << "8. GET EARLIEST ARRIVAL FOR A DEPARTURE TIME (TIMETABLE)" << endl;
+        cout << "9. COMPARE ROUTES (FASTEST / FEWEST CHANGES / SHORTEST)" << endl;
+        cout << "\nENTER YOUR CHOICE FROM THE ABOVE LIST (1 to 9) : ";
         
         int choice = -1;
         cin >> choice;
@@ -597,6 +1519,7 @@ int main() {
         cout << "\n***********************************************************\n" << endl;
         
         if (choice == 7) {
+            writeReports(g, trace, metrics);
             break;
         }
         
@@ -610,8 +1533,7 @@ int main() {
                 break;
             
             case 3: {
-                vector<string> keys = g.getKeys();
-                vector<string> codes = g.printCodelist();
+                g.printCodelist();
                 cout << "\n1. TO ENTER SERIAL NO. OF STATIONS\n2. TO ENTER CODE OF STATIONS\n3. TO ENTER NAME OF STATIONS\n" << endl;
                 cout << "ENTER YOUR CHOICE:" << endl;
                 int ch;
@@ -622,39 +1544,30 @@ int main() {
                 cout << "ENTER THE SOURCE AND DESTINATION STATIONS" << endl;
                 
                 if (ch == 1) {
-                    int idx1, idx2;
+                    size_t idx1 = 0, idx2 = 0;
                     cin >> idx1 >> idx2;
                     cin.ignore();
-                    st1 = keys[idx1 - 1];
-                    st2 = keys[idx2 - 1];
+                    size_t n = g.numVertex();
+                    st1 = idx1 >= 1 && idx1 <= n ? g.stationName((uint32_t)(idx1 - 1)) : "";
+                    st2 = idx2 >= 1 && idx2 <= n ? g.stationName((uint32_t)(idx2 - 1)) : "";
                 } else if (ch == 2) {
                     string a, b;
                     getline(cin, a);
-                    transform(a.begin(), a.end(), a.begin(), ::toupper);
-                    int j;
-                    for (j = 0; j < keys.size(); j++) {
-                        if (a == codes[j])
-                            break;
-                    }
-                    st1 = keys[j];
-                    
                     getline(cin, b);
-                    transform(b.begin(), b.end(), b.begin(), ::toupper);
-                    for (j = 0; j < keys.size(); j++) {
-                        if (b == codes[j])
-                            break;
-                    }
-                    st2 = keys[j];
+                    uint32_t v1 = g.stationByCode(a), v2 = g.stationByCode(b);
+                    st1 = v1 != CompactGraph::NO_STATION ? g.stationName(v1) : a;
+                    st2 = v2 != CompactGraph::NO_STATION ? g.stationName(v2) : b;
                 } else if (ch == 3) {
                     getline(cin, st1);
+                    st1 = resolveInput(g, st1);
                     getline(cin, st2);
+                    st2 = resolveInput(g, st2);
                 } else {
                     cout << "Invalid choice" << endl;
                     return 0;
                 }
                 
-                unordered_map<string, bool> processed;
-                if (!g.containsVertex(st1) || !g.containsVertex(st2) || !g.hasPath(st1, st2, processed)) {
+                if (!g.containsVertex(st1) || !g.containsVertex(st2) || !g.hasPath(st1, st2)) {
                     cout << "THE INPUTS ARE INVALID" << endl;
                 } else {
                     cout << "SHORTEST DISTANCE FROM " << st1 << " TO " << st2 << " IS " 
@@ -667,12 +1580,14 @@ int main() {
                 cout << "ENTER THE SOURCE STATION: ";
                 string sat1;
                 getline(cin, sat1);
+                sat1 = resolveInput(g, sat1);
                 cout << "ENTER THE DESTINATION STATION: ";
                 string sat2;
                 getline(cin, sat2);
+                sat2 = resolveInput(g, sat2);
                 
                 cout << "SHORTEST TIME FROM (" << sat1 << ") TO (" << sat2 << ") IS " 
-                     << g.dijkstra(sat1, sat2, true) / 60 << " MINUTES\n\n" << endl;
+                     << toMinutes(g.dijkstra(sat1, sat2, true)) << " MINUTES\n\n" << endl;
                 break;
             }
             
@@ -680,10 +1595,11 @@ int main() {
                 cout << "ENTER THE SOURCE AND DESTINATION STATIONS" << endl;
                 string s1, s2;
                 getline(cin, s1);
+                s1 = resolveInput(g, s1);
                 getline(cin, s2);
+                s2 = resolveInput(g, s2);
                 
-                unordered_map<string, bool> processed2;
-                if (!g.containsVertex(s1) || !g.containsVertex(s2) || !g.hasPath(s1, s2, processed2)) {
+                if (!g.containsVertex(s1) || !g.containsVertex(s2) || !g.hasPath(s1, s2)) {
                     cout << "THE INPUTS ARE INVALID" << endl;
                 } else {
                     vector<string> str = g.get_Interchanges(g.Get_Minimum_Distance(s1, s2));
@@ -707,12 +1623,13 @@ int main() {
                 cout << "ENTER THE SOURCE STATION: ";
                 string ss1;
                 getline(cin, ss1);
+                ss1 = resolveInput(g, ss1);
                 cout << "ENTER THE DESTINATION STATION: ";
                 string ss2;
                 getline(cin, ss2);
+                ss2 = resolveInput(g, ss2);
                 
-                unordered_map<string, bool> processed3;
-                if (!g.containsVertex(ss1) || !g.containsVertex(ss2) || !g.hasPath(ss1, ss2, processed3)) {
+                if (!g.containsVertex(ss1) || !g.containsVertex(ss2) || !g.hasPath(ss1, ss2)) {
                     cout << "THE INPUTS ARE INVALID" << endl;
                 } else {
                     vector<string> str = g.get_Interchanges(g.Get_Minimum_Time(ss1, ss2));
@@ -732,11 +1649,106 @@ int main() {
                 break;
             }
             
+            case 8: {
+                if (!g.hasTimetable()) {
+                    cout << "NO TIMETABLE LOADED (START WITH A NETWORK FILE THAT HAS SERVICE RECORDS)" << endl;
+                    break;
+                }
+                cout << "ENTER THE SOURCE STATION: ";
+                string ts1;
+                getline(cin, ts1);
+                ts1 = resolveInput(g, ts1);
+                cout << "ENTER THE DESTINATION STATION: ";
+                string ts2;
+                getline(cin, ts2);
+                ts2 = resolveInput(g, ts2);
+                cout << "ENTER THE DEPARTURE TIME (HH:MM): ";
+                string when;
+                getline(cin, when);
+                
+                int departure;
+                if (!g.containsVertex(ts1) || !g.containsVertex(ts2) || !parseClock(when, departure)) {
+                    cout << "THE INPUTS ARE INVALID" << endl;
+                    break;
+                }
+                Journey journey = g.earliestArrival(ts1, ts2, departure);
+                if (!journey.found()) {
+                    cout << "NO TRAIN GETS THERE AFTER " << when << endl;
+                    break;
+                }
+                const CompactGraph& cg = g.compact();
+                cout << "LEAVE AT " << formatClock(journey.departure) << ", ARRIVE AT "
+                     << formatClock(journey.arrival) << " (" << toMinutes(journey.arrival - departure)
+                     << " MINUTES, " << journey.changes() << " INTERCHANGES)" << endl;
+                cout << "~~~~~~~~~~~~~" << endl;
+                for (const JourneyLeg& leg : journey.legs) {
+                    string line = cg.lineNames[leg.line];
+                    if (line.empty()) {
+                        line = string(1, (char)('A' + leg.line));
+                    }
+                    cout << formatClock(leg.departure) << "  " << cg.names[leg.from] << "  ==>  "
+                         << formatClock(leg.arrival) << "  " << cg.names[leg.to] << "  [" << line << "]" << endl;
+                }
+                cout << "~~~~~~~~~~~~~" << endl;
+                break;
+            }
+            
+            case 9: {
+                cout << "ENTER THE SOURCE STATION: ";
+                string ps1;
+                getline(cin, ps1);
+                ps1 = resolveInput(g, ps1);
+                cout << "ENTER THE DESTINATION STATION: ";
+                string ps2;
+                getline(cin, ps2);
+                ps2 = resolveInput(g, ps2);
+                
+                vector<RouteOption> options = g.routeOptions(ps1, ps2);
+                if (options.empty()) {
+                    cout << "THE INPUTS ARE INVALID" << endl;
+                    break;
+                }
+                int fewest = INT_MAX, shortest = INT_MAX;
+                for (const RouteOption& o : options) {
+                    fewest = min(fewest, o.interchanges);
+                    shortest = min(shortest, o.distance);
+                }
+                for (size_t k = 0; k < options.size(); k++) {
+                    const RouteOption& o = options[k];
+                    string tags;
+                    if (k == 0) {
+                        tags += " [FASTEST]";
+                    }
+                    if (o.interchanges == fewest) {
+                        tags += " [FEWEST CHANGES]";
+                    }
+                    if (o.distance == shortest) {
+                        tags += " [SHORTEST]";
+                    }
+                    vector<string> str = g.get_Interchanges(o.route);
+                    int len = str.size();
+                    cout << "OPTION " << k + 1 << tags << endl;
+                    cout << "TIME : " << toMinutes(o.time) << " MINUTES, DISTANCE : " << o.distance
+                         << "KM, INTERCHANGES : " << o.interchanges << ", FARE : Rs " << o.fare << endl;
+                    cout << "~~~~~~~~~~~~~" << endl;
+                    cout << "START  ==>  " << str[0] << endl;
+                    for (int i = 1; i < len - 3; i++) {
+                        cout << str[i] << endl;
+                    }
+                    if (len > 3) {
+                        cout << str[len - 3] << "   ==>    END" << endl;
+                    }
+                    cout << "~~~~~~~~~~~~~\n" << endl;
+                }
+                break;
+            }
+            
             default:
                 cout << "Please enter a valid option! " << endl;
-                cout << "The options you can choose are from 1 to 7. " << endl;
+                cout << "The options you can choose are from 1 to 9. " << endl;
         }
     }
     
     return 0;
-}
\ No newline at end of file
+}
+#endif
@@ -0,0 +1,173 @@
+#ifndef METROPATH_INDEXED_HEAP_H
+#define METROPATH_INDEXED_HEAP_H
+
+#include <cstdint>
+#include <vector>
+
+// Min-heap over integer ids [0, capacity) with a position map, so a queued id
+// can have its key lowered in place instead of being pushed a second time.
+// Dijkstra therefore performs at most one add per vertex. The heap is 4-ary:
+// shallower than a binary heap and the four children share a cache line.
+template <typename Key>
+class IndexedHeap {
+public:
+    static const uint32_t NOT_IN_HEAP = UINT32_MAX;
+
+    explicit IndexedHeap(uint32_t capacity = 0) {
+        resize(capacity);
+    }
+
+    // Grows or shrinks the id range. Empties the heap.
+    void resize(uint32_t capacity) {
+        data.clear();
+        pos.assign(capacity, NOT_IN_HEAP);
+    }
+
+    // Empties the heap in O(entries left), keeping the position map allocated.
+    void clear() {
+        for (const Entry& e : data) {
+            pos[e.id] = NOT_IN_HEAP;
+        }
+        data.clear();
+    }
+
+    uint32_t capacity() const {
+        return (uint32_t)pos.size();
+    }
+
+    uint32_t size() const {
+        return (uint32_t)data.size();
+    }
+
+    bool isEmpty() const {
+        return data.empty();
+    }
+
+    bool contains(uint32_t id) const {
+        return pos[id] != NOT_IN_HEAP;
+    }
+
+    const Key& key(uint32_t id) const {
+        return data[pos[id]].key;
+    }
+
+    uint32_t top() const {
+        return data[0].id;
+    }
+
+    const Key& topKey() const {
+        return data[0].key;
+    }
+
+    void add(uint32_t id, const Key& key) {
+        pos[id] = (uint32_t)data.size();
+        data.push_back(Entry{key, id});
+        upheapify(pos[id]);
+    }
+
+    // Lowers the key of a queued id; larger keys are ignored.
+    void updatePriority(uint32_t id, const Key& key) {
+        uint32_t i = pos[id];
+        if (key < data[i].key) {
+            data[i].key = key;
+            upheapify(i);
+        }
+    }
+
+    // Sets the key of a queued id in either direction.
+    void setKey(uint32_t id, const Key& key) {
+        uint32_t i = pos[id];
+        bool lower = key < data[i].key;
+        data[i].key = key;
+        if (lower) {
+            upheapify(i);
+        } else {
+            downheapify(i);
+        }
+    }
+
+    // Inserts the id or lowers its key. Returns false if the id was already
+    // queued with a key that is not larger.
+    bool addOrUpdate(uint32_t id, const Key& key) {
+        if (!contains(id)) {
+            add(id, key);
+            return true;
+        }
+        if (key < data[pos[id]].key) {
+            updatePriority(id, key);
+            return true;
+        }
+        return false;
+    }
+
+    void remove(uint32_t& id, Key& key) {
+        id = data[0].id;
+        key = data[0].key;
+        pos[id] = NOT_IN_HEAP;
+
+        Entry last = data.back();
+        data.pop_back();
+        if (!data.empty()) {
+            data[0] = last;
+            pos[last.id] = 0;
+            downheapify(0);
+        }
+    }
+
+private:
+    static const uint32_t ARITY = 4;
+
+    struct Entry {
+        Key key;
+        uint32_t id;
+    };
+
+    std::vector<Entry> data;
+    std::vector<uint32_t> pos;
+
+    void upheapify(uint32_t ci) {
+        Entry e = data[ci];
+        while (ci > 0) {
+            uint32_t pi = (ci - 1) / ARITY;
+            if (!(e.key < data[pi].key)) {
+                break;
+            }
+            data[ci] = data[pi];
+            pos[data[ci].id] = ci;
+            ci = pi;
+        }
+        data[ci] = e;
+        pos[e.id] = ci;
+    }
+
+    void downheapify(uint32_t pi) {
+        Entry e = data[pi];
+        uint32_t n = (uint32_t)data.size();
+        while (true) {
+            uint32_t first = pi * ARITY + 1;
+            if (first >= n) {
+                break;
+            }
+            uint32_t last = first + ARITY < n ? first + ARITY : n;
+            uint32_t mini = first;
+            for (uint32_t c = first + 1; c < last; c++) {
+                if (data[c].key < data[mini].key) {
+                    mini = c;
+                }
+            }
+            if (!(data[mini].key < e.key)) {
+                break;
+            }
+            data[pi] = data[mini];
+            pos[data[pi].id] = pi;
+            pi = mini;
+        }
+        data[pi] = e;
+        pos[e.id] = pi;
+    }
+};
+
+template <typename Key>
+const uint32_t IndexedHeap<Key>::NOT_IN_HEAP;
+
+#endif
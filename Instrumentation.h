@@ -0,0 +1,460 @@
+#ifndef METROPATH_INSTRUMENTATION_H
+#define METROPATH_INSTRUMENTATION_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// What one search did. The engines take a counter policy as a template
+// argument: NoCounters compiles every hook away, SearchCounters counts.
+// Heaps with decrease-key never pop a superseded label, so stalePops stays
+// 0 for them; it is there for the lazy-deletion queues.
+struct SearchCounters {
+    uint64_t settled = 0;
+    uint64_t relaxed = 0;     // arcs scanned
+    uint64_t improved = 0;    // arcs that lowered a label
+    uint64_t heapPushes = 0;
+    uint64_t heapUpdates = 0; // keys lowered in place
+    uint64_t heapPops = 0;
+    uint64_t stalePops = 0;   // pops of labels already superseded
+
+    void clear() {
+        *this = SearchCounters();
+    }
+
+    void settle() {
+        settled++;
+    }
+    void relax() {
+        relaxed++;
+    }
+    void improve(bool pushed) {
+        improved++;
+        if (pushed) {
+            heapPushes++;
+        } else {
+            heapUpdates++;
+        }
+    }
+    void push() {
+        heapPushes++;
+    }
+    void pop(bool stale = false) {
+        heapPops++;
+        if (stale) {
+            stalePops++;
+        }
+    }
+
+    SearchCounters& operator+=(const SearchCounters& o) {
+        settled += o.settled;
+        relaxed += o.relaxed;
+        improved += o.improved;
+        heapPushes += o.heapPushes;
+        heapUpdates += o.heapUpdates;
+        heapPops += o.heapPops;
+        stalePops += o.stalePops;
+        return *this;
+    }
+};
+
+struct NoCounters {
+    void clear() {}
+    void settle() {}
+    void relax() {}
+    void improve(bool) {}
+    void push() {}
+    void pop(bool = false) {}
+};
+
+// Heap allocations made by the process so far. Only counted in a program
+// that defines METROPATH_COUNT_ALLOCATIONS before including this header,
+// which replaces the global operator new; do that in one translation unit.
+inline std::atomic<uint64_t>& allocationCount() {
+    static std::atomic<uint64_t> count{0};
+    return count;
+}
+
+inline std::atomic<uint64_t>& allocatedBytes() {
+    static std::atomic<uint64_t> bytes{0};
+    return bytes;
+}
+
+#ifdef METROPATH_COUNT_ALLOCATIONS
+// Every replaceable form, so each new is paired with its own delete. They
+// are kept out of line: inlined, GCC would see a pointer from operator new
+// reach free() and warn (-Wmismatched-new-delete) at every delete site.
+namespace instrumentdetail {
+
+inline void* countedAlloc(std::size_t size) noexcept {
+    allocationCount().fetch_add(1, std::memory_order_relaxed);
+    allocatedBytes().fetch_add(size, std::memory_order_relaxed);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+} // namespace instrumentdetail
+
+__attribute__((noinline)) void* operator new(std::size_t size) {
+    if (void* p = instrumentdetail::countedAlloc(size)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+__attribute__((noinline)) void* operator new[](std::size_t size) {
+    return operator new(size);
+}
+
+__attribute__((noinline)) void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    return instrumentdetail::countedAlloc(size);
+}
+
+__attribute__((noinline)) void* operator new[](std::size_t size, const std::nothrow_t&) noexcept {
+    return instrumentdetail::countedAlloc(size);
+}
+
+__attribute__((noinline)) void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+__attribute__((noinline)) void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+__attribute__((noinline)) void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
+#endif
+
+namespace instrumentdetail {
+
+typedef std::chrono::steady_clock Clock;
+
+// Nanoseconds since the first call, the time base of every trace.
+inline uint64_t now() {
+    static const Clock::time_point epoch = Clock::now();
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - epoch).count();
+}
+
+// Small stable number for the calling thread, for trace viewers.
+inline uint32_t threadNumber() {
+    static std::atomic<uint32_t> next{1};
+    static thread_local uint32_t mine = next.fetch_add(1);
+    return mine;
+}
+
+} // namespace instrumentdetail
+
+// One instrumented query: when it ran, how long each phase took and what
+// the search did.
+struct QueryTrace {
+    enum : uint32_t { MAX_PHASES = 4 };
+
+    const char* kind = "";
+    uint32_t src = 0;
+    uint32_t dst = 0;
+    uint32_t thread = 0;
+    uint64_t start = 0; // ns, see instrumentdetail::now
+    uint64_t end = 0;
+    const char* phaseName[MAX_PHASES];
+    uint64_t phaseEnd[MAX_PHASES];
+    uint32_t phases = 0;
+    SearchCounters counters;
+    uint64_t allocations = 0;
+    bool cacheHit = false;
+};
+
+// The last traces recorded in the process, in a bounded ring. Dumped as
+// Chrome trace JSON, which chrome://tracing and Perfetto both open.
+class TraceLog {
+public:
+    static TraceLog& instance() {
+        static TraceLog log;
+        return log;
+    }
+
+    void setCapacity(size_t records) {
+        std::lock_guard<std::mutex> lock(m);
+        ring.clear();
+        ring.reserve(records);
+        capacity = records == 0 ? 1 : records;
+        next = 0;
+    }
+
+    void record(const QueryTrace& t) {
+        std::lock_guard<std::mutex> lock(m);
+        if (ring.size() < capacity) {
+            ring.push_back(t);
+        } else {
+            ring[next] = t;
+            next = (next + 1) % capacity;
+        }
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock(m);
+        return ring.size();
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(m);
+        ring.clear();
+        next = 0;
+    }
+
+    // Each query is a complete ("X") event with its counters as args, and
+    // each phase a nested event on the same thread.
+    void writeChromeTrace(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(m);
+        out << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [";
+        bool first = true;
+        for (size_t i = 0; i < ring.size(); i++) {
+            const QueryTrace& t = ring[(next + i) % ring.size()];
+            event(out, first, t.kind, t.thread, t.start, t.end);
+            const SearchCounters& c = t.counters;
+            out << ", \"args\": {\"src\": " << t.src << ", \"dst\": " << t.dst
+                << ", \"cache_hit\": " << (t.cacheHit ? "true" : "false") << ", \"settled\": " << c.settled
+                << ", \"relaxed\": " << c.relaxed << ", \"improved\": " << c.improved
+                << ", \"heap_pushes\": " << c.heapPushes << ", \"heap_updates\": " << c.heapUpdates
+                << ", \"heap_pops\": " << c.heapPops << ", \"stale_pops\": " << c.stalePops
+                << ", \"allocations\": " << t.allocations << "}}";
+            uint64_t from = t.start;
+            for (uint32_t p = 0; p < t.phases; p++) {
+                event(out, first, t.phaseName[p], t.thread, from, t.phaseEnd[p]);
+                out << "}";
+                from = t.phaseEnd[p];
+            }
+        }
+        out << "\n]}" << std::endl;
+    }
+
+private:
+    mutable std::mutex m;
+    std::vector<QueryTrace> ring;
+    size_t capacity = 100000;
+    size_t next = 0; // oldest record once the ring is full
+
+    TraceLog() {}
+
+    static void event(std::ostream& out, bool& first, const char* name, uint32_t thread, uint64_t from,
+                      uint64_t to) {
+        out << (first ? "\n" : ",\n") << "{\"name\": \"" << name
+            << "\", \"cat\": \"query\", \"ph\": \"X\", \"pid\": 1, \"tid\": " << thread << ", \"ts\": ";
+        micros(out, from);
+        out << ", \"dur\": ";
+        micros(out, to - from);
+        first = false;
+    }
+
+    // Trace timestamps are microseconds; ours are nanoseconds.
+    static void micros(std::ostream& out, uint64_t ns) {
+        char frac[8];
+        std::snprintf(frac, sizeof(frac), ".%03u", (unsigned)(ns % 1000));
+        out << ns / 1000 << frac;
+    }
+};
+
+// Process-wide totals per query kind, written in the Prometheus text
+// exposition format. Cheap enough to feed per query from one thread; a
+// pool should add up locally and merge() once per batch.
+class MetricsRegistry {
+public:
+    enum : unsigned { BUCKETS = 8 };
+
+    struct Series {
+        uint64_t queries = 0;
+        uint64_t cacheHits = 0;
+        uint64_t allocations = 0;
+        double seconds = 0;
+        uint64_t buckets[BUCKETS] = {}; // latency histogram, not cumulative
+        SearchCounters counters;
+
+        void observe(double s, const SearchCounters& c, uint64_t allocs, bool hit) {
+            queries++;
+            cacheHits += hit ? 1 : 0;
+            allocations += allocs;
+            seconds += s;
+            unsigned b = 0;
+            while (b + 1 < BUCKETS && s > bound(b)) {
+                b++;
+            }
+            buckets[b]++;
+            counters += c;
+        }
+
+        void merge(const Series& o) {
+            queries += o.queries;
+            cacheHits += o.cacheHits;
+            allocations += o.allocations;
+            seconds += o.seconds;
+            for (unsigned b = 0; b < BUCKETS; b++) {
+                buckets[b] += o.buckets[b];
+            }
+            counters += o.counters;
+        }
+    };
+
+    static MetricsRegistry& instance() {
+        static MetricsRegistry registry;
+        return registry;
+    }
+
+    // Upper bound of histogram bucket b in seconds: 10 us to 1 s, then +Inf.
+    static double bound(unsigned b) {
+        static const double bounds[BUCKETS - 1] = {1e-5, 1e-4, 1e-3, 3e-3, 1e-2, 1e-1, 1};
+        return bounds[b];
+    }
+
+    void observe(const std::string& kind, double seconds, const SearchCounters& c, uint64_t allocs, bool hit) {
+        std::lock_guard<std::mutex> lock(m);
+        series[kind].observe(seconds, c, allocs, hit);
+    }
+
+    void merge(const std::string& kind, const Series& s) {
+        if (s.queries == 0) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(m);
+        series[kind].merge(s);
+    }
+
+    // The stale-pop ratio is metropath_heap_stale_pops_total over
+    // metropath_heap_pops_total.
+    void writePrometheus(std::ostream& out) const {
+        std::lock_guard<std::mutex> lock(m);
+        counter(out, "queries_total", "Queries answered.", &Series::queries);
+        counter(out, "cache_hits_total", "Queries answered from a route cache.", &Series::cacheHits);
+        searchCounter(out, "settled_total", "Vertices settled.", &SearchCounters::settled);
+        searchCounter(out, "relaxed_arcs_total", "Arcs scanned.", &SearchCounters::relaxed);
+        searchCounter(out, "improved_arcs_total", "Arcs that lowered a label.", &SearchCounters::improved);
+        searchCounter(out, "heap_pushes_total", "Heap insertions.", &SearchCounters::heapPushes);
+        searchCounter(out, "heap_updates_total", "Heap keys lowered in place.", &SearchCounters::heapUpdates);
+        searchCounter(out, "heap_pops_total", "Heap removals.", &SearchCounters::heapPops);
+        searchCounter(out, "heap_stale_pops_total", "Heap removals of superseded labels.",
+                      &SearchCounters::stalePops);
+        counter(out, "allocations_total", "Heap allocations made while answering.", &Series::allocations);
+
+        out << "# HELP metropath_query_seconds Query latency.\n# TYPE metropath_query_seconds histogram\n";
+        for (const auto& kv : series) {
+            const Series& s = kv.second;
+            uint64_t cumulative = 0;
+            for (unsigned b = 0; b < BUCKETS; b++) {
+                cumulative += s.buckets[b];
+                out << "metropath_query_seconds_bucket{kind=\"" << kv.first << "\",le=\"";
+                if (b + 1 < BUCKETS) {
+                    out << bound(b);
+                } else {
+                    out << "+Inf";
+                }
+                out << "\"} " << cumulative << "\n";
+            }
+            out << "metropath_query_seconds_sum{kind=\"" << kv.first << "\"} " << s.seconds << "\n"
+                << "metropath_query_seconds_count{kind=\"" << kv.first << "\"} " << s.queries << "\n";
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(m);
+        series.clear();
+    }
+
+private:
+    mutable std::mutex m;
+    std::map<std::string, Series> series;
+
+    MetricsRegistry() {}
+
+    void counter(std::ostream& out, const char* name, const char* help, uint64_t Series::*field) const {
+        out << "# HELP metropath_" << name << " " << help << "\n# TYPE metropath_" << name << " counter\n";
+        for (const auto& kv : series) {
+            out << "metropath_" << name << "{kind=\"" << kv.first << "\"} " << kv.second.*field << "\n";
+        }
+    }
+
+    void searchCounter(std::ostream& out, const char* name, const char* help,
+                       uint64_t SearchCounters::*field) const {
+        out << "# HELP metropath_" << name << " " << help << "\n# TYPE metropath_" << name << " counter\n";
+        for (const auto& kv : series) {
+            out << "metropath_" << name << "{kind=\"" << kv.first << "\"} " << kv.second.counters.*field
+                << "\n";
+        }
+    }
+};
+
+// Times one query in phases and, when it goes out of scope, records it in
+// the TraceLog and the MetricsRegistry. Constructed disabled it does
+// nothing but test a flag, so it can stay in the query path.
+class QueryProbe {
+public:
+    QueryProbe(bool enabled, const char* kind) : enabled(enabled) {
+        if (enabled) {
+            trace.kind = kind;
+            trace.thread = instrumentdetail::threadNumber();
+            trace.allocations = allocationCount().load(std::memory_order_relaxed);
+            trace.start = instrumentdetail::now();
+        }
+    }
+
+    ~QueryProbe() {
+        if (!enabled) {
+            return;
+        }
+        trace.end = instrumentdetail::now();
+        trace.allocations = allocationCount().load(std::memory_order_relaxed) - trace.allocations;
+        TraceLog::instance().record(trace);
+        MetricsRegistry::instance().observe(trace.kind, (trace.end - trace.start) * 1e-9, trace.counters,
+                                            trace.allocations, trace.cacheHit);
+    }
+
+    QueryProbe(const QueryProbe&) = delete;
+    QueryProbe& operator=(const QueryProbe&) = delete;
+
+    // Ends the phase that began where the previous one ended.
+    void phase(const char* name) {
+        if (enabled && trace.phases < QueryTrace::MAX_PHASES) {
+            trace.phaseName[trace.phases] = name;
+            trace.phaseEnd[trace.phases++] = instrumentdetail::now();
+        }
+    }
+
+    void stations(uint32_t src, uint32_t dst) {
+        trace.src = src;
+        trace.dst = dst;
+    }
+
+    void counters(const SearchCounters& c) {
+        trace.counters = c;
+    }
+
+    void cacheHit() {
+        trace.cacheHit = true;
+    }
+
+private:
+    bool enabled;
+    QueryTrace trace;
+};
+
+#endif
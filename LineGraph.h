@@ -0,0 +1,322 @@
+#ifndef METROPATH_LINE_GRAPH_H
+#define METROPATH_LINE_GRAPH_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include "CompactGraph.h"
+#include "IndexedHeap.h"
+#include "Instrumentation.h"
+#include "Route.h"
+
+// What a line-aware search optimises. Costs are in the metric's unit.
+enum class LineObjective {
+    Weighted,             // cost + transfer penalty per interchange
+    MinInterchanges,      // fewest interchanges, then lowest cost
+    CostThenInterchanges, // lowest cost, then fewest interchanges
+};
+
+// Station x line expansion of a CompactGraph. Every station gets one route
+// node per line serving it (from the lines recorded on its arcs); ride arcs
+// join route nodes of the same line along the network's edges, and transfer
+// arcs join the route nodes of one station. A path through this graph says
+// which line every leg is ridden on, so interchanges become part of what the
+// search optimises instead of being guessed afterwards.
+//
+// Arcs whose lines are unknown (mask 0) are ridden on a pseudo-line of their
+// own, UNASSIGNED_LINE.
+class LineGraph {
+public:
+    enum : uint32_t { UNASSIGNED_LINE = 26, TRANSFER = UINT32_MAX };
+
+    void build(const CompactGraph& g) {
+        uint32_t n = g.numVertex();
+        std::vector<uint32_t> served(n, 0);
+        for (uint32_t v = 0; v < n; v++) {
+            for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                served[v] |= lineBits(g.arcLines[a]);
+            }
+        }
+
+        stationFirst.assign(n + 1, 0);
+        nodeStation.clear();
+        nodeLine.clear();
+        for (uint32_t v = 0; v < n; v++) {
+            for (uint32_t mask = served[v]; mask != 0; mask &= mask - 1) {
+                nodeStation.push_back(v);
+                nodeLine.push_back(firstLine(mask));
+            }
+            stationFirst[v + 1] = (uint32_t)nodeStation.size();
+        }
+
+        uint32_t nodes = numNodes();
+        offsets.assign(nodes + 1, 0);
+        targets.clear();
+        arcOf.clear();
+        for (uint32_t x = 0; x < nodes; x++) {
+            uint32_t v = nodeStation[x];
+            uint32_t line = nodeLine[x];
+            for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                if (lineBits(g.arcLines[a]) & (1u << line)) {
+                    targets.push_back(node(g.targets[a], line));
+                    arcOf.push_back(a);
+                }
+            }
+            for (uint32_t y = stationFirst[v]; y < stationFirst[v + 1]; y++) {
+                if (y != x) {
+                    targets.push_back(y);
+                    arcOf.push_back(TRANSFER);
+                }
+            }
+            offsets[x + 1] = (uint32_t)targets.size();
+        }
+    }
+
+    uint32_t numNodes() const {
+        return (uint32_t)nodeStation.size();
+    }
+
+    uint32_t station(uint32_t x) const {
+        return nodeStation[x];
+    }
+
+    uint32_t line(uint32_t x) const {
+        return nodeLine[x];
+    }
+
+    // Route nodes of station v are [firstNode(v), firstNode(v + 1)).
+    uint32_t firstNode(uint32_t v) const {
+        return stationFirst[v];
+    }
+
+    uint32_t begin(uint32_t x) const {
+        return offsets[x];
+    }
+
+    uint32_t end(uint32_t x) const {
+        return offsets[x + 1];
+    }
+
+    uint32_t target(uint32_t e) const {
+        return targets[e];
+    }
+
+    // Underlying CompactGraph arc of a ride arc, TRANSFER for a transfer.
+    uint32_t originalArc(uint32_t e) const {
+        return arcOf[e];
+    }
+
+private:
+    std::vector<uint32_t> stationFirst;
+    std::vector<uint32_t> nodeStation;
+    std::vector<uint32_t> nodeLine;
+    std::vector<uint32_t> offsets;
+    std::vector<uint32_t> targets;
+    std::vector<uint32_t> arcOf;
+
+    static uint32_t lineBits(uint32_t mask) {
+        return mask == 0 ? 1u << UNASSIGNED_LINE : mask;
+    }
+
+    uint32_t node(uint32_t v, uint32_t line) const {
+        uint32_t x = stationFirst[v];
+        while (nodeLine[x] != line) {
+            x++;
+        }
+        return x;
+    }
+};
+
+// Turns a path of route nodes into a Route: stations, leg weights under
+// metric, the line of every leg and the stations where a transfer arc was
+// taken. cost is the sum of the legs.
+inline void routeFromNodes(const CompactGraph& g, const LineGraph& lg,
+                           const std::vector<uint32_t>& path, Metric metric, Route& out) {
+    out.reset(metric);
+    if (path.empty()) {
+        return;
+    }
+    const int* w = g.weights(metric);
+    out.cost = 0;
+    out.stations.push_back(lg.station(path[0]));
+    for (size_t i = 1; i < path.size(); i++) {
+        uint32_t v = lg.station(path[i]);
+        if (v == out.stations.back()) {
+            out.changes.push_back(out.stations.size() - 1); // a transfer arc
+            continue;
+        }
+        uint32_t line = lg.line(path[i]);
+        out.legs.push_back(w[g.arc(out.stations.back(), v)]);
+        out.lines.push_back(line == LineGraph::UNASSIGNED_LINE ? NO_LINE : line);
+        out.stations.push_back(v);
+        out.cost += out.legs.back();
+    }
+}
+
+// Dijkstra over a LineGraph with a two-part key, so every LineObjective is
+// an ordinary label-setting search: the key is (primary, secondary) packed
+// into 64 bits and compared lexicographically. The search starts on every
+// route node of src at no cost (boarding is free) and stops at the first
+// settled route node of dst. Counters as for BasicDijkstraSearch.
+template <typename Counters = NoCounters>
+class BasicLineAwareSearch {
+public:
+    // Penalty in the metric's unit added per interchange by Weighted.
+    void setTransferPenalty(Metric metric, int penalty) {
+        penalties[(int)metric] = penalty;
+    }
+
+    int transferPenalty(Metric metric) const {
+        return penalties[(int)metric];
+    }
+
+    bool run(const CompactGraph& g, const LineGraph& lg, uint32_t src, uint32_t dst, Metric metric,
+             LineObjective objective) {
+        reset(lg.numNodes());
+        this->metric = metric;
+        this->objective = objective;
+        this->src = src;
+        this->dst = dst;
+        found = src == dst;
+        reached = NONE;
+        if (found) {
+            return true;
+        }
+        const int* w = g.weights(metric);
+        int penalty = penalties[(int)metric];
+
+        for (uint32_t x = lg.firstNode(src); x < lg.firstNode(src + 1); x++) {
+            labelled[x] = round;
+            cost[x] = 0;
+            transfers[x] = 0;
+            pred[x] = NONE;
+            heap.add(x, 0);
+            stats.push();
+        }
+
+        while (!heap.isEmpty()) {
+            uint32_t x;
+            uint64_t k;
+            heap.remove(x, k);
+            stats.pop();
+            settled++;
+            stats.settle();
+            if (lg.station(x) == dst) {
+                reached = x;
+                found = true;
+                return true;
+            }
+            for (uint32_t e = lg.begin(x); e < lg.end(x); e++) {
+                uint32_t y = lg.target(e);
+                uint32_t a = lg.originalArc(e);
+                int nc = cost[x] + (a == LineGraph::TRANSFER ? 0 : w[a]);
+                int nt = transfers[x] + (a == LineGraph::TRANSFER ? 1 : 0);
+                uint64_t nk = key(nc, nt, penalty);
+                stats.relax();
+                if (labelled[y] != round || nk < key(cost[y], transfers[y], penalty)) {
+                    labelled[y] = round;
+                    cost[y] = nc;
+                    transfers[y] = nt;
+                    pred[y] = x;
+                    stats.improve(!heap.contains(y));
+                    heap.addOrUpdate(y, nk);
+                }
+            }
+        }
+        return false;
+    }
+
+    uint32_t settledCount() const {
+        return settled;
+    }
+
+    const Counters& counters() const {
+        return stats;
+    }
+
+    // The route found by the last run: stations, leg weights, the line of
+    // every leg and the stations where the rider changes. cost is the
+    // metric cost without penalties.
+    void route(const CompactGraph& g, const LineGraph& lg, Route& out) const {
+        out.reset(metric);
+        if (!found) {
+            return;
+        }
+        if (reached == NONE) {
+            out.cost = 0;
+            out.stations.push_back(src);
+            return;
+        }
+        path.clear();
+        for (uint32_t x = reached; x != NONE; x = pred[x]) {
+            path.push_back(x);
+        }
+        std::reverse(path.begin(), path.end());
+        routeFromNodes(g, lg, path, metric, out);
+    }
+
+private:
+    enum : uint32_t { NONE = UINT32_MAX };
+
+    int penalties[2] = {2, 300}; // km, seconds
+    std::vector<int> cost;       // these three are valid where labelled == round,
+    std::vector<int> transfers;  // so a query starts without clearing them
+    std::vector<uint32_t> pred;
+    std::vector<uint32_t> labelled;
+    uint32_t round = 0;
+    IndexedHeap<uint64_t> heap;
+    mutable std::vector<uint32_t> path;
+    Metric metric = Metric::Distance;
+    LineObjective objective = LineObjective::Weighted;
+    uint32_t src = 0;
+    uint32_t dst = 0;
+    uint32_t reached = NONE; // settled route node of dst
+    bool found = false;
+    uint32_t settled = 0;
+    Counters stats;
+
+    uint64_t key(int c, int t, int penalty) const {
+        uint64_t primary, secondary;
+        switch (objective) {
+        case LineObjective::MinInterchanges:
+            primary = (uint64_t)t;
+            secondary = (uint64_t)c;
+            break;
+        case LineObjective::CostThenInterchanges:
+            primary = (uint64_t)c;
+            secondary = (uint64_t)t;
+            break;
+        default:
+            primary = (uint64_t)c + (uint64_t)t * (uint64_t)penalty;
+            secondary = (uint64_t)t;
+            break;
+        }
+        return primary << 32 | secondary;
+    }
+
+    void reset(uint32_t nodes) {
+        if (labelled.size() != nodes) {
+            cost.resize(nodes);
+            transfers.resize(nodes);
+            pred.resize(nodes);
+            labelled.assign(nodes, 0);
+            round = 0;
+        }
+        if (++round == 0) {
+            std::fill(labelled.begin(), labelled.end(), 0);
+            round = 1;
+        }
+        if (heap.capacity() != nodes) {
+            heap.resize(nodes);
+        } else {
+            heap.clear();
+        }
+        settled = 0;
+        stats.clear();
+    }
+};
+
+typedef BasicLineAwareSearch<> LineAwareSearch;
+
+#endif
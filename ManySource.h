@@ -0,0 +1,233 @@
+#ifndef METROPATH_MANY_SOURCE_H
+#define METROPATH_MANY_SOURCE_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include "CompactGraph.h"
+#include "ContractionHierarchy.h"
+#include "IndexedHeap.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define METROPATH_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+// Distances from many sources to every station, for fare tables and
+// accessibility jobs. This is PHAST over a ContractionHierarchy: a small
+// upward search from each source, then one linear sweep over the stations
+// from the most important down, each pulling from its higher-ranked
+// neighbours (which are final by then). The sweep does the same work for
+// every source, so it carries LANES sources at once: every station has a
+// row of LANES labels, and relaxing an arc is one vector add and min over
+// the row. Stations are renumbered in sweep order, so the sweep reads the
+// label rows front to back.
+//
+// The row kernel is picked at run time: AVX-512, AVX2, or a plain loop
+// where neither is available (or on other architectures).
+enum class SweepKernel {
+    Scalar,
+    AVX2,
+    AVX512
+};
+
+namespace sweepdetail {
+
+enum {
+    LANES = 16,
+    UNREACHED = INT_MAX / 2 // + any arc weight still fits in an int
+};
+
+// Sweeps positions [0, n): row p becomes the lane-wise min of itself and
+// row from[a] + weight[a] for each of its arcs.
+inline void sweepScalar(const uint32_t* first, const uint32_t* from, const int* weight,
+                        uint32_t n, int* labels) {
+    for (uint32_t p = 0; p < n; p++) {
+        int* row = labels + (size_t)p * LANES;
+        for (uint32_t a = first[p]; a < first[p + 1]; a++) {
+            const int* up = labels + (size_t)from[a] * LANES;
+            int w = weight[a];
+            for (int l = 0; l < LANES; l++) {
+                row[l] = std::min(row[l], up[l] + w);
+            }
+        }
+    }
+}
+
+#ifdef METROPATH_X86_KERNELS
+__attribute__((target("avx2"))) inline void sweepAvx2(const uint32_t* first, const uint32_t* from,
+                                                      const int* weight, uint32_t n, int* labels) {
+    for (uint32_t p = 0; p < n; p++) {
+        __m256i* row = (__m256i*)(labels + (size_t)p * LANES);
+        __m256i lo = _mm256_loadu_si256(row);
+        __m256i hi = _mm256_loadu_si256(row + 1);
+        for (uint32_t a = first[p]; a < first[p + 1]; a++) {
+            const __m256i* up = (const __m256i*)(labels + (size_t)from[a] * LANES);
+            __m256i w = _mm256_set1_epi32(weight[a]);
+            lo = _mm256_min_epi32(lo, _mm256_add_epi32(_mm256_loadu_si256(up), w));
+            hi = _mm256_min_epi32(hi, _mm256_add_epi32(_mm256_loadu_si256(up + 1), w));
+        }
+        _mm256_storeu_si256(row, lo);
+        _mm256_storeu_si256(row + 1, hi);
+    }
+}
+
+__attribute__((target("avx512f"))) inline void sweepAvx512(const uint32_t* first, const uint32_t* from,
+                                                           const int* weight, uint32_t n, int* labels) {
+    const __mmask16 ALL_LANES = 0xFFFF;
+    for (uint32_t p = 0; p < n; p++) {
+        int* row = labels + (size_t)p * LANES;
+        __m512i best = _mm512_loadu_si512(row);
+        for (uint32_t a = first[p]; a < first[p + 1]; a++) {
+            __m512i up = _mm512_loadu_si512(labels + (size_t)from[a] * LANES);
+            // The all-lanes masked min, as plain _mm512_min_epi32 passes
+            // an uninitialised register to the builtin and GCC warns.
+            best = _mm512_maskz_min_epi32(ALL_LANES, best, _mm512_add_epi32(up, _mm512_set1_epi32(weight[a])));
+        }
+        _mm512_storeu_si512(row, best);
+    }
+}
+#endif
+
+} // namespace sweepdetail
+
+class ManySourceSweep {
+public:
+    enum {
+        LANES = sweepdetail::LANES
+    };
+
+    ManySourceSweep() : kernel(bestKernel()) {}
+
+    // The fastest kernel this CPU runs.
+    static SweepKernel bestKernel() {
+#ifdef METROPATH_X86_KERNELS
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f")) {
+            return SweepKernel::AVX512;
+        }
+        if (__builtin_cpu_supports("avx2")) {
+            return SweepKernel::AVX2;
+        }
+#endif
+        return SweepKernel::Scalar;
+    }
+
+    static const char* kernelName(SweepKernel k) {
+        return k == SweepKernel::AVX512 ? "avx512" : k == SweepKernel::AVX2 ? "avx2" : "scalar";
+    }
+
+    // Asks for a kernel, e.g. to compare them; one the CPU lacks falls
+    // back to the best it has.
+    void setKernel(SweepKernel k) {
+        SweepKernel best = bestKernel();
+        kernel = (int)k <= (int)best ? k : best;
+    }
+
+    SweepKernel currentKernel() const {
+        return kernel;
+    }
+
+    // Copies the hierarchy out in sweep order; runs only read the copy.
+    // Needed once per hierarchy, before the first run.
+    void prepare(const ContractionHierarchy& ch) {
+        n = ch.numVertex();
+        vertexAt.resize(n);
+        positionOf.resize(n);
+        for (uint32_t v = 0; v < n; v++) {
+            positionOf[v] = n - 1 - ch.rankOf(v);
+            vertexAt[positionOf[v]] = v;
+        }
+        first.resize(n + 1);
+        from.resize(ch.numArcs());
+        weight.resize(ch.numArcs());
+        uint32_t arcs = 0;
+        for (uint32_t p = 0; p < n; p++) {
+            first[p] = arcs;
+            uint32_t v = vertexAt[p];
+            for (uint32_t a = ch.begin(v); a < ch.end(v); a++) {
+                from[arcs] = positionOf[ch.target(a)];
+                weight[arcs] = ch.weight(a);
+                arcs++;
+            }
+        }
+        first[n] = arcs;
+        if (heap.capacity() != n) {
+            heap.resize(n);
+        }
+    }
+
+    // Costs from each of count sources to every station, row by row:
+    // out[i * n + v] for station v, INT_MAX where unreachable. A source of
+    // CompactGraph::NO_STATION gives a row of INT_MAX.
+    void run(const uint32_t* sources, size_t count, std::vector<int>& out) {
+        out.resize(count * n);
+        labels.resize((size_t)n * LANES);
+        for (size_t base = 0; base < count; base += LANES) {
+            size_t lanes = std::min((size_t)LANES, count - base);
+            std::fill(labels.begin(), labels.end(), (int)sweepdetail::UNREACHED);
+            for (size_t l = 0; l < lanes; l++) {
+                if (sources[base + l] != CompactGraph::NO_STATION) {
+                    upward(positionOf[sources[base + l]], (uint32_t)l);
+                }
+            }
+            sweep();
+            for (uint32_t p = 0; p < n; p++) {
+                const int* row = labels.data() + (size_t)p * LANES;
+                uint32_t v = vertexAt[p];
+                for (size_t l = 0; l < lanes; l++) {
+                    out[(base + l) * n + v] = row[l] >= sweepdetail::UNREACHED ? INT_MAX : row[l];
+                }
+            }
+        }
+    }
+
+private:
+    SweepKernel kernel;
+    uint32_t n = 0;
+    std::vector<uint32_t> vertexAt; // station at each sweep position
+    std::vector<uint32_t> positionOf;
+    std::vector<uint32_t> first;    // upward arcs by position, n + 1 entries
+    std::vector<uint32_t> from;     // their higher-ranked end, as a position
+    std::vector<int> weight;
+    std::vector<int> labels;        // LANES per position
+    IndexedHeap<int> heap;
+
+    // Upward Dijkstra from position start into one lane of the label rows.
+    void upward(uint32_t start, uint32_t lane) {
+        int* lab = labels.data() + lane;
+        heap.clear();
+        lab[(size_t)start * LANES] = 0;
+        heap.add(start, 0);
+        while (!heap.isEmpty()) {
+            uint32_t p;
+            int cost;
+            heap.remove(p, cost);
+            for (uint32_t a = first[p]; a < first[p + 1]; a++) {
+                int nc = cost + weight[a];
+                int& label = lab[(size_t)from[a] * LANES];
+                if (nc < label) {
+                    label = nc;
+                    heap.addOrUpdate(from[a], nc);
+                }
+            }
+        }
+    }
+
+    void sweep() {
+#ifdef METROPATH_X86_KERNELS
+        if (kernel == SweepKernel::AVX512) {
+            sweepdetail::sweepAvx512(first.data(), from.data(), weight.data(), n, labels.data());
+            return;
+        }
+        if (kernel == SweepKernel::AVX2) {
+            sweepdetail::sweepAvx2(first.data(), from.data(), weight.data(), n, labels.data());
+            return;
+        }
+#endif
+        sweepdetail::sweepScalar(first.data(), from.data(), weight.data(), n, labels.data());
+    }
+};
+
+#endif
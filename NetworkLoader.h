@@ -0,0 +1,351 @@
+#ifndef METROPATH_NETWORK_LOADER_H
+#define METROPATH_NETWORK_LOADER_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "CompactGraph.h"
+#include "ConnectionScan.h"
+
+// Streams a network file straight into a CompactGraph, so map updates can be
+// deployed without recompiling Create_Metro_Map.
+//
+// The file is a list of records, one per line. Fields are separated by
+// commas or tabs (whichever the first record uses); surrounding spaces and
+// double quotes are stripped. Blank lines and lines starting with '#' are
+// skipped.
+//
+//   line,<letter>,<display name>          e.g.  line,B,Blue Line
+//   station,<name>                        e.g.  station,Esplanade~BGP
+//   edge,<from>,<to>,<km>[,<line letters>]
+//   service,<letter>,<first>,<last>,<headway min>,<station>,<station>,...
+//   trip,<letter>,<station>,<time>,<station>,<time>,...
+//
+// service and trip records describe the timetable (see ConnectionScan.h).
+// A service runs a train along the listed stations, in that direction,
+// every headway minutes from first to last departure ("06:50"), each leg
+// taking the edge's static travel time. A trip is a single train with an
+// explicit time at every stop. Both may only name stations that appear in
+// a station or edge record.
+//
+// "L", "S" and "E" are accepted as short record kinds. Stations named in an
+// edge are created on first use, so station records are only needed for
+// isolated stations or to fix the id order. Without a line column an edge
+// belongs to every line its two stations share. Repeated stations are
+// ignored and a repeated edge keeps its first distance. Distances are whole
+// km, at most MAX_EDGE_KM per edge.
+//
+// Fields are parsed in place in the read buffer; the only string created per
+// station is its interned name.
+class NetworkLoader {
+public:
+    // If timetable is given it receives the service and trip records;
+    // otherwise they are parsed and ignored.
+    bool loadFile(const std::string& path, CompactGraph& out, std::string& error, Timetable* timetable = nullptr) {
+        FILE* f = std::fopen(path.c_str(), "rb");
+        if (f == nullptr) {
+            error = path + ": cannot open file";
+            return false;
+        }
+        start(path);
+
+        std::vector<char> buf(CHUNK);
+        size_t used = 0;
+        bool ok = true;
+        while (ok) {
+            if (used == buf.size()) {
+                buf.resize(buf.size() * 2); // a single line longer than the buffer
+            }
+            size_t got = std::fread(buf.data() + used, 1, buf.size() - used, f);
+            used += got;
+            bool last = got == 0;
+
+            size_t consumed = 0;
+            ok = parseLines(buf.data(), used, last, consumed, error);
+            std::memmove(buf.data(), buf.data() + consumed, used - consumed);
+            used -= consumed;
+            if (last) {
+                break;
+            }
+        }
+        std::fclose(f);
+        return ok && finish(out, timetable, error);
+    }
+
+    // Same as loadFile for a network already in memory.
+    bool loadBuffer(const char* data, size_t size, CompactGraph& out, std::string& error,
+                    const std::string& sourceName = "<buffer>", Timetable* timetable = nullptr) {
+        start(sourceName);
+        size_t consumed = 0;
+        return parseLines(data, size, true, consumed, error) && finish(out, timetable, error);
+    }
+
+private:
+    static const size_t CHUNK = 1 << 20;
+
+    struct Field {
+        const char* p;
+        size_t n;
+
+        bool is(const char* s) const {
+            return std::strlen(s) == n && std::memcmp(p, s, n) == 0;
+        }
+    };
+
+    std::string source;
+    size_t lineNo = 0;
+    char separator = 0;
+
+    std::vector<std::string> names;
+    std::vector<uint64_t> nameHash;
+    std::vector<uint32_t> slots; // id + 1 per slot, 0 = empty
+    std::vector<char> declared; // per station: named by a station or edge record
+    std::vector<EdgeRecord> edges;
+    std::vector<std::string> lineNames;
+    std::vector<ServiceRecord> services;
+    std::vector<Field> fields;
+
+    void start(const std::string& name) {
+        source = name;
+        lineNo = 0;
+        separator = 0;
+        names.clear();
+        nameHash.clear();
+        slots.assign(1024, 0);
+        declared.clear();
+        edges.clear();
+        lineNames.assign(26, std::string());
+        services.clear();
+    }
+
+    bool fail(const std::string& message, std::string& error) const {
+        error = source + ":" + std::to_string(lineNo) + ": " + message;
+        return false;
+    }
+
+    // Parses every complete line in [data, data + size). If final, a
+    // trailing line without a newline is parsed too. consumed is set to the
+    // number of bytes handled.
+    bool parseLines(const char* data, size_t size, bool final, size_t& consumed, std::string& error) {
+        const char* p = data;
+        const char* end = data + size;
+        while (p < end) {
+            const char* nl = (const char*)std::memchr(p, '\n', end - p);
+            if (nl == nullptr && !final) {
+                break;
+            }
+            const char* lineEnd = nl == nullptr ? end : nl;
+            lineNo++;
+            if (!parseLine(p, lineEnd, error)) {
+                consumed = p - data;
+                return false;
+            }
+            p = nl == nullptr ? end : nl + 1;
+        }
+        consumed = p - data;
+        return true;
+    }
+
+    static Field trim(const char* b, const char* e) {
+        while (b < e && (*b == ' ' || *b == '\r' || *b == '\t')) {
+            b++;
+        }
+        while (e > b && (e[-1] == ' ' || e[-1] == '\r' || e[-1] == '\t')) {
+            e--;
+        }
+        if (e - b >= 2 && *b == '"' && e[-1] == '"') {
+            b++;
+            e--;
+        }
+        return Field{b, (size_t)(e - b)};
+    }
+
+    bool parseLine(const char* b, const char* e, std::string& error) {
+        Field whole = trim(b, e);
+        if (whole.n == 0 || whole.p[0] == '#') {
+            return true;
+        }
+        if (separator == 0) {
+            separator = std::memchr(whole.p, '\t', whole.n) != nullptr ? '\t' : ',';
+        }
+
+        fields.clear();
+        const char* p = whole.p;
+        const char* end = whole.p + whole.n;
+        while (true) {
+            const char* sep = (const char*)std::memchr(p, separator, end - p);
+            fields.push_back(trim(p, sep == nullptr ? end : sep));
+            if (sep == nullptr) {
+                break;
+            }
+            p = sep + 1;
+        }
+        const Field* f = fields.data();
+        size_t count = fields.size();
+
+        const Field& kind = f[0];
+        if (kind.is("edge") || kind.is("E")) {
+            if (count < 4 || count > 5) {
+                return fail("edge needs <from>,<to>,<km>[,<lines>]", error);
+            }
+            int km;
+            if (f[1].n == 0 || f[2].n == 0) {
+                return fail("empty station name", error);
+            }
+            if (!parseInt(f[3], km)) {
+                return fail("bad distance '" + std::string(f[3].p, f[3].n) + "'", error);
+            }
+            if (km > MAX_EDGE_KM) {
+                return fail("distance '" + std::string(f[3].p, f[3].n) + "' over the limit of " +
+                            std::to_string(MAX_EDGE_KM) + " km", error);
+            }
+            uint32_t lines = count == 5 ? lineMask(f[4].p, f[4].n) : 0;
+            edges.push_back(EdgeRecord{declare(f[1]), declare(f[2]), km, lines});
+        } else if (kind.is("station") || kind.is("S")) {
+            if (count != 2 || f[1].n == 0) {
+                return fail("station needs <name>", error);
+            }
+            declare(f[1]);
+        } else if (kind.is("service") || kind.is("trip")) {
+            return parseService(f, count, kind.is("trip"), error);
+        } else if (kind.is("line") || kind.is("L")) {
+            if (count != 3 || f[1].n != 1 || f[1].p[0] < 'A' || f[1].p[0] > 'Z') {
+                return fail("line needs <letter A-Z>,<name>", error);
+            }
+            lineNames[f[1].p[0] - 'A'].assign(f[2].p, f[2].n);
+        } else {
+            return fail("unknown record '" + std::string(kind.p, kind.n) + "'", error);
+        }
+        return true;
+    }
+
+    bool parseService(const Field* f, size_t count, bool trip, std::string& error) {
+        if (f[1].n != 1 || f[1].p[0] < 'A' || f[1].p[0] > 'Z') {
+            return fail("service line must be a letter A-Z", error);
+        }
+        ServiceRecord s;
+        s.line = f[1].p[0] - 'A';
+        s.lineNo = lineNo;
+        if (trip) {
+            if (count < 6 || count % 2 != 0) {
+                return fail("trip needs <line>,<station>,<time>,<station>,<time>,...", error);
+            }
+            for (size_t i = 2; i < count; i += 2) {
+                int t;
+                if (!parseClock(f[i + 1].p, f[i + 1].n, t)) {
+                    return fail("bad time '" + std::string(f[i + 1].p, f[i + 1].n) + "'", error);
+                }
+                s.stops.push_back(intern(f[i]));
+                s.times.push_back(t);
+            }
+        } else {
+            int minutes;
+            if (count < 7) {
+                return fail("service needs <line>,<first>,<last>,<headway>,<station>,<station>,...", error);
+            }
+            if (!parseClock(f[2].p, f[2].n, s.first) || !parseClock(f[3].p, f[3].n, s.last) || s.last < s.first) {
+                return fail("bad service hours", error);
+            }
+            if (!parseInt(f[4], minutes) || minutes == 0) {
+                return fail("bad headway '" + std::string(f[4].p, f[4].n) + "'", error);
+            }
+            s.headway = minutes * 60;
+            for (size_t i = 5; i < count; i++) {
+                s.stops.push_back(intern(f[i]));
+            }
+        }
+        services.push_back(std::move(s));
+        return true;
+    }
+
+    static bool parseInt(const Field& f, int& value) {
+        if (f.n == 0 || f.n > 9) {
+            return false;
+        }
+        value = 0;
+        for (size_t i = 0; i < f.n; i++) {
+            if (f.p[i] < '0' || f.p[i] > '9') {
+                return false;
+            }
+            value = value * 10 + (f.p[i] - '0');
+        }
+        return true;
+    }
+
+    // Open-addressing lookup keyed by the bytes in the read buffer; a
+    // std::string is only built the first time a name is seen.
+    uint32_t intern(const Field& f) {
+        uint64_t h = hashName(f.p, f.n);
+        size_t mask = slots.size() - 1;
+        for (size_t i = h & mask;; i = (i + 1) & mask) {
+            uint32_t slot = slots[i];
+            if (slot == 0) {
+                uint32_t id = (uint32_t)names.size();
+                names.push_back(std::string(f.p, f.n));
+                nameHash.push_back(h);
+                slots[i] = id + 1;
+                if (names.size() * 2 > slots.size()) {
+                    grow();
+                }
+                return id;
+            }
+            const std::string& name = names[slot - 1];
+            if (nameHash[slot - 1] == h && name.size() == f.n && std::memcmp(name.data(), f.p, f.n) == 0) {
+                return slot - 1;
+            }
+        }
+    }
+
+    uint32_t declare(const Field& f) {
+        uint32_t id = intern(f);
+        if (declared.size() <= id) {
+            declared.resize(id + 1, 0);
+        }
+        declared[id] = 1;
+        return id;
+    }
+
+    void grow() {
+        slots.assign(slots.size() * 2, 0);
+        size_t mask = slots.size() - 1;
+        for (uint32_t id = 0; id < names.size(); id++) {
+            size_t i = nameHash[id] & mask;
+            while (slots[i] != 0) {
+                i = (i + 1) & mask;
+            }
+            slots[i] = id + 1;
+        }
+    }
+
+    bool finish(CompactGraph& out, Timetable* timetable, std::string& error) {
+        if (names.empty()) {
+            error = source + ": no stations";
+            return false;
+        }
+        declared.resize(names.size(), 0);
+        for (const ServiceRecord& s : services) {
+            for (uint32_t stop : s.stops) {
+                if (!declared[stop]) {
+                    error = source + ":" + std::to_string(s.lineNo) + ": unknown station '" + names[stop] + "'";
+                    return false;
+                }
+            }
+        }
+
+        // Names only mentioned by a bad service were rejected above, so
+        // every interned name is a real station.
+        out = CompactGraph();
+        out.lineNames.swap(lineNames);
+        buildCompactGraph(names, edges, out);
+        bool ok = timetable == nullptr || buildTimetable(out, services, source, *timetable, error);
+        names.clear();
+        edges.clear();
+        nameHash.clear();
+        services.clear();
+        return ok;
+    }
+};
+
+#endif
@@ -0,0 +1,218 @@
+#ifndef METROPATH_PARETO_H
+#define METROPATH_PARETO_H
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+#include "CompactGraph.h"
+#include "LineGraph.h"
+#include "Route.h"
+
+// One Pareto-optimal way of getting between two stations: no other route is
+// at least as good on time, distance and interchanges and better on one.
+// route holds the stations, the time of every leg and the lines ridden.
+struct RouteOption {
+    int time = 0;         // seconds
+    int distance = 0;     // km
+    int interchanges = 0;
+    int fare = 0;         // rupees, fareFor(distance)
+    Route route;
+};
+
+// Multi-criteria label-setting search over a LineGraph. Every route node
+// keeps a bag of mutually non-dominated labels (time, distance,
+// interchanges); labels are settled in lexicographic order of that triple,
+// so a settled label is never dominated later and every label reaching dst
+// that survives the front found so far is Pareto-optimal. One run yields the
+// whole front: the fastest, the shortest and the fewest-changes routes are
+// all in it.
+//
+// Fare is not a criterion of its own: it only ever rises with distance, so a
+// route dominated on distance can never be cheaper. It is filled in on the
+// options.
+//
+// All labels live in one pool indexed by uint32_t, with the bags threaded
+// through it as linked lists; the pool, bags and queue are reused between
+// runs.
+class ParetoSearch {
+public:
+    // Returns false if dst cannot be reached from src.
+    bool run(const CompactGraph& g, const LineGraph& lg, uint32_t src, uint32_t dst) {
+        reset(lg.numNodes());
+        this->src = src;
+        sameStation = src == dst;
+        if (sameStation) {
+            return true;
+        }
+        const int* time = g.weights(Metric::Time);
+        const int* distance = g.weights(Metric::Distance);
+
+        for (uint32_t x = lg.firstNode(src); x < lg.firstNode(src + 1); x++) {
+            insert(x, Label{0, 0, 0, x, NONE, NONE, false});
+        }
+
+        while (!queue.empty()) {
+            std::pop_heap(queue.begin(), queue.end(), later);
+            QueueEntry e = queue.back();
+            queue.pop_back();
+            Label l = labels[e.label];
+            if (l.dead) {
+                continue;
+            }
+            settled++;
+            if (lg.station(l.node) == dst) {
+                if (!dominatedByFront(l)) {
+                    front.push_back(e.label);
+                }
+                continue;
+            }
+            if (dominatedByFront(l)) {
+                continue;
+            }
+            for (uint32_t a = lg.begin(l.node); a < lg.end(l.node); a++) {
+                uint32_t arc = lg.originalArc(a);
+                Label next = l;
+                next.node = lg.target(a);
+                next.parent = e.label;
+                if (arc == LineGraph::TRANSFER) {
+                    next.interchanges++;
+                } else {
+                    next.time += time[arc];
+                    next.distance += distance[arc];
+                }
+                if (!dominatedByFront(next)) {
+                    insert(next.node, next);
+                }
+            }
+        }
+        return !front.empty();
+    }
+
+    uint32_t settledCount() const {
+        return settled;
+    }
+
+    // Labels created by the last run, settled or not.
+    uint32_t labelCount() const {
+        return (uint32_t)labels.size();
+    }
+
+    // The front found by the last run, fastest first. Options with equal
+    // criteria are reported once.
+    void options(const CompactGraph& g, const LineGraph& lg, std::vector<RouteOption>& out) const {
+        out.clear();
+        if (sameStation) {
+            out.push_back(RouteOption());
+            out.back().fare = fareFor(0);
+            out.back().route.metric = Metric::Time;
+            out.back().route.cost = 0;
+            out.back().route.stations.push_back(src);
+            return;
+        }
+        for (uint32_t i : front) {
+            const Label& l = labels[i];
+            path.clear();
+            for (uint32_t k = i; k != NONE; k = labels[k].parent) {
+                path.push_back(labels[k].node);
+            }
+            std::reverse(path.begin(), path.end());
+
+            out.push_back(RouteOption());
+            RouteOption& option = out.back();
+            option.time = l.time;
+            option.distance = l.distance;
+            option.interchanges = (int)l.interchanges;
+            option.fare = fareFor(l.distance);
+            routeFromNodes(g, lg, path, Metric::Time, option.route);
+        }
+    }
+
+private:
+    enum : uint32_t { NONE = UINT32_MAX };
+
+    struct Label {
+        int time;
+        int distance;
+        uint32_t interchanges;
+        uint32_t node;
+        uint32_t parent;  // label this one was extended from
+        uint32_t nextInBag;
+        bool dead;        // dominated after it was queued
+    };
+
+    struct QueueEntry {
+        int time;
+        int distance;
+        uint32_t interchanges;
+        uint32_t label;
+    };
+
+    std::vector<Label> labels;
+    std::vector<uint32_t> bags; // first label of each route node's bag
+    std::vector<QueueEntry> queue;
+    std::vector<uint32_t> front;
+    mutable std::vector<uint32_t> path;
+    uint32_t src = 0;
+    bool sameStation = false;
+    uint32_t settled = 0;
+
+    static bool later(const QueueEntry& a, const QueueEntry& b) {
+        if (a.time != b.time) {
+            return a.time > b.time;
+        }
+        if (a.distance != b.distance) {
+            return a.distance > b.distance;
+        }
+        return a.interchanges > b.interchanges;
+    }
+
+    static bool dominates(const Label& a, const Label& b) {
+        return a.time <= b.time && a.distance <= b.distance && a.interchanges <= b.interchanges;
+    }
+
+    bool dominatedByFront(const Label& l) const {
+        for (uint32_t i : front) {
+            if (dominates(labels[i], l)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Adds l to the bag of route node x unless a label there is at least as
+    // good, dropping the labels l dominates.
+    void insert(uint32_t x, const Label& l) {
+        for (uint32_t i = bags[x]; i != NONE; i = labels[i].nextInBag) {
+            if (dominates(labels[i], l)) {
+                return;
+            }
+        }
+        uint32_t* link = &bags[x];
+        while (*link != NONE) {
+            Label& other = labels[*link];
+            if (dominates(l, other)) {
+                other.dead = true;
+                *link = other.nextInBag;
+            } else {
+                link = &other.nextInBag;
+            }
+        }
+
+        uint32_t id = (uint32_t)labels.size();
+        labels.push_back(l);
+        labels.back().nextInBag = bags[x];
+        bags[x] = id;
+        queue.push_back(QueueEntry{l.time, l.distance, l.interchanges, id});
+        std::push_heap(queue.begin(), queue.end(), later);
+    }
+
+    void reset(uint32_t nodes) {
+        labels.clear();
+        bags.assign(nodes, NONE);
+        queue.clear();
+        front.clear();
+        settled = 0;
+    }
+};
+
+#endif
@@ -0,0 +1,241 @@
+#ifndef METROPATH_RCU_H
+#define METROPATH_RCU_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Epoch-based reclamation shared by every RcuPointer in the process.
+//
+// A reader announces the global epoch in its thread's slot before it loads
+// a published pointer and clears the slot when done. A writer that swaps a
+// pointer out stamps the old object with the epoch current at the swap;
+// the object can be freed once every announced epoch is newer than that
+// stamp, since any reader that could have loaded it announced an epoch no
+// newer. Readers never lock, never wait and never touch a reference count.
+//
+// A thread keeps its slot until it exits. Threads beyond MAX_THREADS share
+// one overflow slot under a lock instead: it announces the epoch of the
+// oldest reader in it, and clears only once all of them are done, so heavy
+// overflow traffic can hold back reclamation but never breaks it.
+class EpochDomain {
+public:
+    enum : unsigned { MAX_THREADS = 512 };
+
+    static EpochDomain& instance() {
+        static EpochDomain domain;
+        return domain;
+    }
+
+    // Pins the calling thread at the current epoch. Nests: only the
+    // outermost pin/unpin pair announces.
+    void pin() {
+        ThreadSlot& t = threadSlot();
+        if (t.depth++ == 0) {
+            if (t.index != OVERFLOW_SLOT) {
+                slots[t.index].epoch.store(epoch.load());
+                return;
+            }
+            std::lock_guard<std::mutex> lock(overflowLock);
+            if (overflowReaders++ == 0) {
+                slots[OVERFLOW_SLOT].epoch.store(epoch.load());
+            }
+        }
+    }
+
+    void unpin() {
+        ThreadSlot& t = threadSlot();
+        if (--t.depth == 0) {
+            if (t.index != OVERFLOW_SLOT) {
+                slots[t.index].epoch.store(0, std::memory_order_release);
+                return;
+            }
+            std::lock_guard<std::mutex> lock(overflowLock);
+            if (--overflowReaders == 0) {
+                slots[OVERFLOW_SLOT].epoch.store(0, std::memory_order_release);
+            }
+        }
+    }
+
+    // Moves to a new epoch, returning the one that just ended.
+    uint64_t advance() {
+        return epoch.fetch_add(1);
+    }
+
+    // Oldest epoch a thread is pinned at, UINT64_MAX if none is.
+    uint64_t oldestPinned() const {
+        uint64_t oldest = UINT64_MAX;
+        for (unsigned i = 0; i <= OVERFLOW_SLOT; i++) {
+            uint64_t e = slots[i].epoch.load();
+            if (e != 0 && e < oldest) {
+                oldest = e;
+            }
+        }
+        return oldest;
+    }
+
+private:
+    enum : unsigned { OVERFLOW_SLOT = MAX_THREADS };
+
+    struct alignas(64) Slot {
+        std::atomic<uint64_t> epoch{0}; // 0: not reading
+        std::atomic<bool> owned{false};
+    };
+
+    // A thread's claim on a slot, given back when the thread exits.
+    struct ThreadSlot {
+        unsigned index;
+        unsigned depth = 0;
+
+        explicit ThreadSlot(EpochDomain& d) : index(d.claim()) {}
+
+        ~ThreadSlot() {
+            if (index != OVERFLOW_SLOT) {
+                EpochDomain::instance().slots[index].owned.store(false, std::memory_order_release);
+            }
+        }
+    };
+
+    Slot slots[MAX_THREADS + 1]; // the last is OVERFLOW_SLOT
+    std::atomic<uint64_t> epoch{1};
+    std::mutex overflowLock;
+    unsigned overflowReaders = 0;
+
+    EpochDomain() {}
+
+    // A free slot of its own for the calling thread, or OVERFLOW_SLOT if
+    // MAX_THREADS live threads already hold one. Never waits.
+    unsigned claim() {
+        for (unsigned i = 0; i < MAX_THREADS; i++) {
+            bool expected = false;
+            if (!slots[i].owned.load(std::memory_order_relaxed) &&
+                slots[i].owned.compare_exchange_strong(expected, true)) {
+                return i;
+            }
+        }
+        return OVERFLOW_SLOT;
+    }
+
+    ThreadSlot& threadSlot() {
+        static thread_local ThreadSlot t(*this);
+        return t;
+    }
+};
+
+// A pointer to an immutable T that many threads read while one writer
+// replaces it (read-copy-update). read() returns a guard that keeps the
+// version it saw alive for as long as the guard lives; publish() swaps in a
+// new version and frees old ones once no guard can still see them.
+//
+// Any number of threads may call read(). publish() and reclaim() must only
+// be called from one thread at a time.
+template <typename T>
+class RcuPointer {
+public:
+    class ReadGuard {
+    public:
+        ReadGuard(ReadGuard&& other) : value(other.value), pinned(other.pinned) {
+            other.pinned = false;
+        }
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        ~ReadGuard() {
+            if (pinned) {
+                EpochDomain::instance().unpin();
+            }
+        }
+
+        // Null if nothing has been published yet.
+        const T* get() const {
+            return value;
+        }
+
+        const T& operator*() const {
+            return *value;
+        }
+
+        const T* operator->() const {
+            return value;
+        }
+
+        explicit operator bool() const {
+            return value != nullptr;
+        }
+
+    private:
+        friend class RcuPointer;
+        const T* value;
+        bool pinned;
+
+        explicit ReadGuard(const std::atomic<const T*>& current) : pinned(true) {
+            EpochDomain::instance().pin();
+            value = current.load();
+        }
+    };
+
+    RcuPointer() {}
+    RcuPointer(const RcuPointer&) = delete;
+    RcuPointer& operator=(const RcuPointer&) = delete;
+
+    // No reader may be active any more.
+    ~RcuPointer() {
+        delete current.load();
+        for (const Retired& r : retired) {
+            delete r.value;
+        }
+    }
+
+    ReadGuard read() const {
+        return ReadGuard(current);
+    }
+
+    // Writer-side look at the current version, without pinning.
+    const T* peek() const {
+        return current.load(std::memory_order_relaxed);
+    }
+
+    void publish(std::unique_ptr<const T> next) {
+        const T* old = current.exchange(next.release());
+        if (old) {
+            retired.push_back(Retired{old, EpochDomain::instance().advance()});
+        }
+        reclaim();
+    }
+
+    // Frees retired versions no reader can still hold. publish() calls it;
+    // a writer that publishes rarely can call it to release memory sooner.
+    void reclaim() {
+        if (retired.empty()) {
+            return;
+        }
+        uint64_t oldest = EpochDomain::instance().oldestPinned();
+        size_t kept = 0;
+        for (const Retired& r : retired) {
+            if (r.epoch < oldest) {
+                delete r.value;
+            } else {
+                retired[kept++] = r;
+            }
+        }
+        retired.resize(kept);
+    }
+
+    // Versions waiting for readers to move on.
+    size_t retiredCount() const {
+        return retired.size();
+    }
+
+private:
+    struct Retired {
+        const T* value;
+        uint64_t epoch; // last epoch in which a reader could have loaded it
+    };
+
+    std::atomic<const T*> current{nullptr};
+    std::vector<Retired> retired;
+};
+
+#endif
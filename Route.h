@@ -0,0 +1,138 @@
+#ifndef METROPATH_ROUTE_H
+#define METROPATH_ROUTE_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "CompactGraph.h"
+
+const uint32_t NO_LINE = UINT32_MAX;
+
+// A journey rebuilt from a search's predecessor array. Searches only record
+// one predecessor id per vertex; the station list and leg weights are
+// materialised once, for the destination that was asked for.
+struct Route {
+    Metric metric = Metric::Distance;
+    int cost = INT_MAX;             // km or seconds; INT_MAX if unreachable
+    std::vector<uint32_t> stations; // source first, destination last
+    std::vector<int> legs;          // weight of stations[i] -> stations[i + 1]
+    std::vector<uint32_t> lines;    // line letter index of each leg, NO_LINE if unknown
+    std::vector<size_t> changes;    // positions in stations where the line changes
+
+    bool found() const {
+        return !stations.empty();
+    }
+
+    int interchanges() const {
+        return (int)changes.size();
+    }
+
+    // Empties the route but keeps its buffers, so a Route reused across
+    // queries stops allocating once it has held the longest answer.
+    void reset(Metric m) {
+        metric = m;
+        cost = INT_MAX;
+        stations.clear();
+        legs.clear();
+        lines.clear();
+        changes.clear();
+    }
+};
+
+inline int toMinutes(int seconds) {
+    return (seconds + 59) / 60;
+}
+
+// Single-journey fare in rupees for a trip of km kilometres, by distance
+// slab. Never decreases with distance.
+inline int fareFor(int km) {
+    static const int slabKm[] = {2, 5, 10, 20, 30};
+    static const int slabFare[] = {5, 10, 15, 20, 25};
+    for (int i = 0; i < 5; i++) {
+        if (km <= slabKm[i]) {
+            return slabFare[i];
+        }
+    }
+    return 30;
+}
+
+// Assigns a line to every leg so that the rider changes as rarely as
+// possible, using the lines that run over each arc. Greedy is optimal here:
+// stay on the set of lines common to all legs since the last change until
+// that set becomes empty, then change at the station where it did. Arcs with
+// no recorded line count as one unnamed line of their own (bit 26).
+inline void assignLines(const CompactGraph& g, Route& route) {
+    const uint32_t UNNAMED = 1u << 26;
+    route.lines.clear();
+    route.changes.clear();
+    size_t legs = route.stations.size() < 2 ? 0 : route.stations.size() - 1;
+    size_t runStart = 0;
+    uint32_t common = 0;
+    auto closeRun = [&](size_t end) {
+        if (end == runStart) {
+            return;
+        }
+        uint32_t line = common == UNNAMED ? NO_LINE : firstLine(common);
+        for (size_t k = runStart; k < end; k++) {
+            route.lines.push_back(line);
+        }
+    };
+    for (size_t i = 0; i < legs; i++) {
+        uint32_t mask = g.arcLines[g.arc(route.stations[i], route.stations[i + 1])];
+        if (mask == 0) {
+            mask = UNNAMED;
+        }
+        if (i > runStart && (common & mask) == 0) {
+            closeRun(i);
+            route.changes.push_back(i);
+            runStart = i;
+        }
+        common = i == runStart ? mask : common & mask;
+    }
+    closeRun(legs);
+}
+
+// Fills in the leg weights, leg lines and line changes of a route whose
+// station list is already set.
+inline void completeRoute(const CompactGraph& g, Route& route) {
+    route.legs.clear();
+    const int* w = g.weights(route.metric);
+    for (size_t i = 0; i + 1 < route.stations.size(); i++) {
+        route.legs.push_back(w[g.arc(route.stations[i], route.stations[i + 1])]);
+    }
+    assignLines(g, route);
+}
+
+// Walks pred back from dst. pred[src] must be CompactGraph::NO_STATION and
+// dst must have been reached by the search.
+inline void buildRoute(const CompactGraph& g, const std::vector<uint32_t>& pred,
+                       uint32_t dst, Metric metric, int cost, Route& route) {
+    route.metric = metric;
+    route.cost = cost;
+    route.stations.clear();
+
+    for (uint32_t v = dst; v != CompactGraph::NO_STATION; v = pred[v]) {
+        route.stations.push_back(v);
+    }
+    std::reverse(route.stations.begin(), route.stations.end());
+    completeRoute(g, route);
+}
+
+// Walks a tree rooted at the destination: pred points towards the root, so
+// following it from src yields the stations already in travel order. Used
+// when a batch is answered by sweeping backwards from each target.
+inline void buildRouteToRoot(const CompactGraph& g, const std::vector<uint32_t>& pred,
+                             uint32_t src, Metric metric, int cost, Route& route) {
+    route.metric = metric;
+    route.cost = cost;
+    route.stations.clear();
+
+    for (uint32_t v = src; v != CompactGraph::NO_STATION; v = pred[v]) {
+        route.stations.push_back(v);
+    }
+    completeRoute(g, route);
+}
+
+#endif
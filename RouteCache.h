@@ -0,0 +1,177 @@
+#ifndef METROPATH_ROUTE_CACHE_H
+#define METROPATH_ROUTE_CACHE_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include "CompactGraph.h"
+#include "Route.h"
+
+// Routes already answered, keyed by (src, dst, metric, graph version).
+// Traffic is skewed towards a few station pairs, so even a small cache
+// answers most queries without a search.
+//
+// The version is part of the key, so an edit that publishes a new version
+// invalidates everything at once without touching the cache: old entries
+// simply stop matching. Eviction treats them as the first to go.
+//
+// The cache is split into shards, each with its own lock, so threads
+// looking up different pairs rarely contend. Within a shard, entries live
+// in a fixed ring and are evicted with the CLOCK algorithm (a second
+// chance for entries hit since the hand last passed), which approximates
+// LRU without reordering anything on a hit. Memory is bounded by the entry
+// count given to the constructor.
+class RouteCache {
+public:
+    struct Stats {
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        size_t entries = 0;
+    };
+
+    // capacity: entries over all shards, at least one per shard.
+    explicit RouteCache(size_t capacity = 4096, unsigned shards = 16)
+        : shards(shards == 0 ? 1 : shards) {
+        size_t perShard = capacity / this->shards.size();
+        for (Shard& s : this->shards) {
+            s.slots.resize(perShard == 0 ? 1 : perShard);
+            s.index.reserve(s.slots.size());
+        }
+    }
+
+    RouteCache(const RouteCache&) = delete;
+    RouteCache& operator=(const RouteCache&) = delete;
+
+    // Null on a miss.
+    std::shared_ptr<const Route> find(uint32_t src, uint32_t dst, Metric metric, uint64_t version) {
+        Key k{src, dst, (uint32_t)metric, version};
+        Shard& s = shardFor(k);
+        std::lock_guard<std::mutex> lock(s.m);
+        auto it = s.index.find(k);
+        if (it == s.index.end()) {
+            s.misses++;
+            return nullptr;
+        }
+        Slot& slot = s.slots[it->second];
+        slot.referenced = true;
+        s.hits++;
+        return slot.route;
+    }
+
+    void insert(uint32_t src, uint32_t dst, Metric metric, uint64_t version,
+                std::shared_ptr<const Route> route) {
+        Key k{src, dst, (uint32_t)metric, version};
+        Shard& s = shardFor(k);
+        std::lock_guard<std::mutex> lock(s.m);
+        if (version > s.newest) {
+            s.newest = version;
+        }
+        auto it = s.index.find(k);
+        if (it != s.index.end()) {
+            s.slots[it->second].route = std::move(route);
+            return;
+        }
+
+        uint32_t victim = s.hand;
+        while (true) {
+            Slot& slot = s.slots[s.hand];
+            uint32_t here = s.hand;
+            s.hand = s.hand + 1 == s.slots.size() ? 0 : s.hand + 1;
+            if (!slot.used || slot.key.version < s.newest || !slot.referenced) {
+                victim = here;
+                break;
+            }
+            slot.referenced = false;
+        }
+
+        Slot& slot = s.slots[victim];
+        if (slot.used) {
+            s.index.erase(slot.key);
+            s.evictions++;
+        }
+        slot.key = k;
+        slot.route = std::move(route);
+        slot.used = true;
+        slot.referenced = false;
+        s.index[k] = victim;
+    }
+
+    void clear() {
+        for (Shard& s : shards) {
+            std::lock_guard<std::mutex> lock(s.m);
+            s.index.clear();
+            for (Slot& slot : s.slots) {
+                slot = Slot();
+            }
+            s.hand = 0;
+            s.newest = 0;
+        }
+    }
+
+    // Totals over all shards. Each shard is read under its lock, so the sum
+    // is only a snapshot while other threads are using the cache.
+    Stats stats() const {
+        Stats total;
+        for (const Shard& s : shards) {
+            std::lock_guard<std::mutex> lock(s.m);
+            total.hits += s.hits;
+            total.misses += s.misses;
+            total.evictions += s.evictions;
+            total.entries += s.index.size();
+        }
+        return total;
+    }
+
+private:
+    struct Key {
+        uint32_t src;
+        uint32_t dst;
+        uint32_t metric;
+        uint64_t version;
+
+        bool operator==(const Key& o) const {
+            return src == o.src && dst == o.dst && metric == o.metric && version == o.version;
+        }
+    };
+
+    struct KeyHash {
+        size_t operator()(const Key& k) const {
+            uint64_t h = ((uint64_t)k.src << 32 | k.dst) * 0x9E3779B97F4A7C15ULL;
+            h ^= (k.version << 1 | k.metric) * 0xC2B2AE3D27D4EB4FULL;
+            return (size_t)(h ^ (h >> 29));
+        }
+    };
+
+    struct Slot {
+        Key key{0, 0, 0, 0};
+        std::shared_ptr<const Route> route;
+        bool used = false;
+        bool referenced = false; // hit since the clock hand last passed
+    };
+
+    // Padded rather than alignas(64): std::vector only honours extended
+    // alignment from C++17, and the padding alone keeps one shard's lock
+    // and counters off the next shard's cache line.
+    struct Shard {
+        mutable std::mutex m;
+        std::unordered_map<Key, uint32_t, KeyHash> index;
+        std::vector<Slot> slots;
+        uint32_t hand = 0;
+        uint64_t newest = 0; // newest version inserted; older entries go first
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t evictions = 0;
+        char padding[64];
+    };
+
+    std::vector<Shard> shards;
+
+    Shard& shardFor(const Key& k) {
+        return shards[(KeyHash()(k) >> 7) % shards.size()];
+    }
+};
+
+#endif
@@ -0,0 +1,879 @@
+#ifndef METROPATH_SERVER_H
+#define METROPATH_SERVER_H
+
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <vector>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include "CompactGraph.h"
+#include "Instrumentation.h"
+#include "Rcu.h"
+#include "Route.h"
+#include "RouteCache.h"
+#include "ShortestPath.h"
+#include "ThreadPool.h"
+
+// Headless query server. Clients send one JSON object per line and get one
+// JSON object per line back, in the order they asked; they may send many
+// requests without waiting (pipelining).
+//
+//   {"id": 1, "from": "Howrah~G", "to": "Kavi Subhash~BO", "metric": "time"}
+//   {"id": 1, "ok": true, "version": 3, "found": true, "metric": "time",
+//    "cost": 2280, "interchanges": 1, "stations": ["Howrah~G", ...]}
+//
+// Fields: "type" is "route" (default), "cost" (no station list),
+// "stations" (all station names), "version" or "stats" (route cache
+// counters); "metric" is "distance" (km, default) or "time" (seconds); "id"
+// is echoed back as given. A bad request gets {"id": ..., "ok": false,
+// "error": "..."}. Answered routes are cached per graph version, so
+// repeated pairs skip the search until the network changes.
+//
+// POSIX only. Endpoints are written "unix:/path/to.sock", "tcp:PORT"
+// (loopback) or "tcp:HOST:PORT".
+
+struct Endpoint {
+    bool local = false; // Unix domain socket
+    std::string path;
+    std::string host;
+    int port = 0;
+};
+
+inline bool parseEndpoint(const std::string& spec, Endpoint& out, std::string& error) {
+    out = Endpoint();
+    if (spec.compare(0, 5, "unix:") == 0 && spec.size() > 5) {
+        out.local = true;
+        out.path = spec.substr(5);
+        if (out.path.size() >= sizeof(sockaddr_un().sun_path)) {
+            error = spec + ": socket path too long";
+            return false;
+        }
+        return true;
+    }
+    if (spec.compare(0, 4, "tcp:") == 0) {
+        std::string rest = spec.substr(4);
+        size_t colon = rest.rfind(':');
+        out.host = colon == std::string::npos ? "127.0.0.1" : rest.substr(0, colon);
+        std::string port = colon == std::string::npos ? rest : rest.substr(colon + 1);
+        char* end;
+        long p = std::strtol(port.c_str(), &end, 10);
+        in_addr addr;
+        if (port.empty() || *end != '\0' || p <= 0 || p > 65535 || inet_pton(AF_INET, out.host.c_str(), &addr) != 1) {
+            error = spec + ": expected tcp:PORT or tcp:HOST:PORT";
+            return false;
+        }
+        out.port = (int)p;
+        return true;
+    }
+    error = spec + ": expected unix:PATH or tcp:[HOST:]PORT";
+    return false;
+}
+
+namespace serverdetail {
+
+inline socklen_t fillAddress(const Endpoint& e, sockaddr_storage& storage) {
+    std::memset(&storage, 0, sizeof(storage));
+    if (e.local) {
+        sockaddr_un& a = (sockaddr_un&)storage;
+        a.sun_family = AF_UNIX;
+        std::memcpy(a.sun_path, e.path.c_str(), e.path.size() + 1);
+        return (socklen_t)sizeof(a);
+    }
+    sockaddr_in& a = (sockaddr_in&)storage;
+    a.sin_family = AF_INET;
+    a.sin_port = htons((uint16_t)e.port);
+    inet_pton(AF_INET, e.host.c_str(), &a.sin_addr);
+    return (socklen_t)sizeof(a);
+}
+
+inline void tuneSocket(int fd, bool local) {
+    if (!local) {
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+}
+
+inline std::string systemError(const std::string& what) {
+    return what + ": " + std::strerror(errno);
+}
+
+// Removes path only if it is a socket, so a mistyped endpoint never
+// deletes a regular file; bind then fails on it instead.
+inline void unlinkSocket(const std::string& path) {
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+}
+
+} // namespace serverdetail
+
+// Listening socket for e, or -1 with error set. A stale Unix socket file
+// left by an earlier run is replaced.
+inline int listenOn(const Endpoint& e, std::string& error) {
+    int fd = socket(e.local ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error = serverdetail::systemError("socket");
+        return -1;
+    }
+    if (e.local) {
+        serverdetail::unlinkSocket(e.path);
+    } else {
+        int one = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    }
+    sockaddr_storage addr;
+    socklen_t len = serverdetail::fillAddress(e, addr);
+    if (bind(fd, (sockaddr*)&addr, len) != 0 || listen(fd, 128) != 0) {
+        error = serverdetail::systemError("bind");
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// Blocking connection to e, or -1 with error set.
+inline int connectTo(const Endpoint& e, std::string& error) {
+    int fd = socket(e.local ? AF_UNIX : AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        error = serverdetail::systemError("socket");
+        return -1;
+    }
+    sockaddr_storage addr;
+    socklen_t len = serverdetail::fillAddress(e, addr);
+    if (connect(fd, (sockaddr*)&addr, len) != 0) {
+        error = serverdetail::systemError("connect");
+        close(fd);
+        return -1;
+    }
+    serverdetail::tuneSocket(fd, e.local);
+    return fd;
+}
+
+// Appends s to out as a JSON string literal.
+inline void appendJsonString(std::string& out, const char* s, size_t n) {
+    out += '"';
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += (char)c;
+        } else if (c < 0x20) {
+            char buf[8];
+            std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        } else {
+            out += (char)c;
+        }
+    }
+    out += '"';
+}
+
+// One parsed request line. Strings keep their capacity between requests.
+struct ServerRequest {
+    std::string id; // JSON token echoed back: a re-encoded string, a number, true, false or null
+    std::string type;
+    std::string from;
+    std::string to;
+    std::string metric;
+
+    // Reads a flat JSON object of string, number and literal values.
+    // Unknown keys are ignored; nested objects and arrays are rejected.
+    bool parse(const char* p, const char* end, const char*& error) {
+        id.clear();
+        type.clear();
+        from.clear();
+        to.clear();
+        metric.clear();
+
+        skipSpace(p, end);
+        if (p == end || *p != '{') {
+            error = "expected a JSON object";
+            return false;
+        }
+        p++;
+        skipSpace(p, end);
+        if (p != end && *p == '}') {
+            return true;
+        }
+        while (true) {
+            skipSpace(p, end);
+            if (!readString(p, end, key)) {
+                error = "expected a string key";
+                return false;
+            }
+            skipSpace(p, end);
+            if (p == end || *p != ':') {
+                error = "expected ':'";
+                return false;
+            }
+            p++;
+            skipSpace(p, end);
+
+            std::string* target = key == "id" ? &id : key == "type" ? &type : key == "from" ? &from
+                                : key == "to" ? &to : key == "metric" ? &metric : nullptr;
+            const char* start = p;
+            if (p != end && *p == '"') {
+                std::string& s = target ? *target : skipped;
+                if (!readString(p, end, s)) {
+                    error = "bad string";
+                    return false;
+                }
+                if (target == &id) {
+                    skipped.swap(id);
+                    id.clear();
+                    appendJsonString(id, skipped.data(), skipped.size());
+                }
+            } else if (p != end && (*p == '{' || *p == '[')) {
+                error = "nested values are not supported";
+                return false;
+            } else {
+                while (p != end && *p != ',' && *p != '}' && *p != ' ' && *p != '\t' && *p != '\r') {
+                    p++;
+                }
+                if (p == start) {
+                    error = "expected a value";
+                    return false;
+                }
+                if (!isLiteral(start, p)) {
+                    error = "expected a string, number, true, false or null";
+                    return false;
+                }
+                if (target) {
+                    target->assign(start, p);
+                }
+            }
+            skipSpace(p, end);
+            if (p != end && *p == ',') {
+                p++;
+                continue;
+            }
+            if (p != end && *p == '}') {
+                return true;
+            }
+            error = "expected ',' or '}'";
+            return false;
+        }
+    }
+
+private:
+    std::string key;
+    std::string skipped;
+
+    // A JSON number, true, false or null, and nothing else.
+    static bool isLiteral(const char* p, const char* end) {
+        size_t n = (size_t)(end - p);
+        if ((n == 4 && (std::memcmp(p, "true", 4) == 0 || std::memcmp(p, "null", 4) == 0)) ||
+            (n == 5 && std::memcmp(p, "false", 5) == 0)) {
+            return true;
+        }
+        auto digits = [&p, end]() {
+            const char* first = p;
+            while (p != end && *p >= '0' && *p <= '9') {
+                p++;
+            }
+            return p != first;
+        };
+        if (p != end && *p == '-') {
+            p++;
+        }
+        if (p != end && *p == '0') {
+            p++;
+        } else if (!digits()) {
+            return false;
+        }
+        if (p != end && *p == '.') {
+            p++;
+            if (!digits()) {
+                return false;
+            }
+        }
+        if (p != end && (*p == 'e' || *p == 'E')) {
+            p++;
+            if (p != end && (*p == '+' || *p == '-')) {
+                p++;
+            }
+            if (!digits()) {
+                return false;
+            }
+        }
+        return p == end;
+    }
+
+    static void skipSpace(const char*& p, const char* end) {
+        while (p != end && (*p == ' ' || *p == '\t' || *p == '\r')) {
+            p++;
+        }
+    }
+
+    // Decodes a string literal; \u escapes outside ASCII become UTF-8.
+    static bool readString(const char*& p, const char* end, std::string& out) {
+        if (p == end || *p != '"') {
+            return false;
+        }
+        p++;
+        out.clear();
+        while (p != end && *p != '"') {
+            char c = *p++;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (p == end) {
+                return false;
+            }
+            char e = *p++;
+            switch (e) {
+            case 'n': out += '\n'; break;
+            case 't': out += '\t'; break;
+            case 'r': out += '\r'; break;
+            case 'b': out += '\b'; break;
+            case 'f': out += '\f'; break;
+            case 'u': {
+                if (end - p < 4) {
+                    return false;
+                }
+                char hex[5] = {p[0], p[1], p[2], p[3], 0};
+                char* stop;
+                unsigned long cp = std::strtoul(hex, &stop, 16);
+                if (stop != hex + 4) {
+                    return false;
+                }
+                p += 4;
+                if (cp < 0x80) {
+                    out += (char)cp;
+                } else if (cp < 0x800) {
+                    out += (char)(0xC0 | (cp >> 6));
+                    out += (char)(0x80 | (cp & 0x3F));
+                } else {
+                    out += (char)(0xE0 | (cp >> 12));
+                    out += (char)(0x80 | ((cp >> 6) & 0x3F));
+                    out += (char)(0x80 | (cp & 0x3F));
+                }
+                break;
+            }
+            default: out += e; break; // \" \\ \/
+            }
+        }
+        if (p == end) {
+            return false;
+        }
+        p++;
+        return true;
+    }
+};
+
+// Serves queries against whatever version is published in versions, so the
+// owner can keep editing and publishing the graph on its own thread while
+// the server runs. One I/O thread polls every connection; each round, all
+// complete request lines from all connections form one batch that the
+// thread pool answers, each worker with its own search buffers and one
+// pinned version per chunk. Responses are queued per connection in request
+// order and written back without blocking.
+class QueryServer {
+public:
+    // cacheEntries bounds the route cache; 0 turns it off.
+    explicit QueryServer(const RcuPointer<GraphVersion>& versions, unsigned threads = 0,
+                         size_t cacheEntries = 1 << 16)
+        : versions(versions), pool(threads), workers(pool.size() + 1),
+          cache(cacheEntries == 0 ? 1 : cacheEntries), caching(cacheEntries > 0) {}
+
+    ~QueryServer() {
+        for (Connection& c : connections) {
+            close(c.fd);
+        }
+        if (listener >= 0) {
+            close(listener);
+            if (endpoint.local) {
+                serverdetail::unlinkSocket(endpoint.path);
+            }
+        }
+    }
+
+    QueryServer(const QueryServer&) = delete;
+    QueryServer& operator=(const QueryServer&) = delete;
+
+    bool listen(const std::string& spec, std::string& error) {
+        if (!parseEndpoint(spec, endpoint, error)) {
+            return false;
+        }
+        listener = listenOn(endpoint, error);
+        if (listener < 0) {
+            return false;
+        }
+        fcntl(listener, F_SETFL, O_NONBLOCK);
+        return true;
+    }
+
+    // Serves until stop() is called. Returns false if not listening.
+    bool run() {
+        if (listener < 0) {
+            return false;
+        }
+        uint64_t lastWrite = 0;
+        while (!stopping.load(std::memory_order_relaxed)) {
+            pollOnce(100);
+            if (!metricsPath.empty() && instrumentdetail::now() - lastWrite >= 1000000000ULL) {
+                writeMetricsFile();
+                lastWrite = instrumentdetail::now();
+            }
+        }
+        if (!metricsPath.empty()) {
+            writeMetricsFile();
+        }
+        return true;
+    }
+
+    // Safe from any thread and from a signal handler.
+    void stop() {
+        stopping.store(true);
+    }
+
+    unsigned threads() const {
+        return pool.size();
+    }
+
+    // Requests answered so far (readable from any thread).
+    uint64_t served() const {
+        return answered.load(std::memory_order_relaxed);
+    }
+
+    RouteCache::Stats cacheStats() const {
+        return cache.stats();
+    }
+
+    // Counts every search and times every request into the process-wide
+    // MetricsRegistry, under kind "server". Safe from any thread.
+    void setInstrumentation(bool on) {
+        instrumented.store(on, std::memory_order_relaxed);
+    }
+
+    // Rewrites path with writeMetrics() about once a second while serving,
+    // for a Prometheus textfile collector or anything else that scrapes it.
+    // Call before run().
+    void setMetricsFile(const std::string& path) {
+        metricsPath = path;
+    }
+
+    void writeMetrics(std::ostream& out) const {
+        MetricsRegistry::instance().writePrometheus(out);
+        RouteCache::Stats stats = cache.stats();
+        out << "# TYPE metropath_server_requests_total counter\nmetropath_server_requests_total " << served()
+            << "\n# TYPE metropath_server_connections gauge\nmetropath_server_connections " << connections.size()
+            << "\n# TYPE metropath_route_cache_hits_total counter\nmetropath_route_cache_hits_total " << stats.hits
+            << "\n# TYPE metropath_route_cache_misses_total counter\nmetropath_route_cache_misses_total "
+            << stats.misses << "\n# TYPE metropath_route_cache_evictions_total counter\n"
+            << "metropath_route_cache_evictions_total " << stats.evictions
+            << "\n# TYPE metropath_route_cache_entries gauge\nmetropath_route_cache_entries " << stats.entries
+            << "\n";
+    }
+
+private:
+    enum : size_t {
+        READ_CHUNK = 64 * 1024,
+        MAX_LINE = 64 * 1024,
+        MAX_BACKLOG = 1024 * 1024, // unsent output at which a connection stops being read
+        INLINE_BATCH = 8, // smaller batches are answered on the I/O thread
+        GRAIN = 16,
+    };
+
+    struct Connection {
+        int fd;
+        std::string in;
+        std::string out;
+        size_t outSent = 0;
+        bool closing = false;  // peer is done or misbehaved: flush, then close
+        bool overlong = false; // sent a line over MAX_LINE: refuse it once the rest is answered
+    };
+
+    struct Pending {
+        uint32_t connection;
+        uint32_t begin; // line inside the connection's input buffer
+        uint32_t length;
+    };
+
+    struct Worker {
+        DijkstraSearch search;
+        ServerRequest request;
+        Route route; // reused while caching is off
+
+        // Used while instrumented: what the last request's search did, and
+        // the chunk's totals until they are merged into the registry.
+        bool counting = false;
+        BasicDijkstraSearch<SearchCounters> countedSearch;
+        SearchCounters last;
+        bool lastHit = false;
+        MetricsRegistry::Series series;
+    };
+
+    const RcuPointer<GraphVersion>& versions;
+    ThreadPool pool;
+    std::vector<Worker> workers; // one per pool thread, plus the I/O thread's
+    Endpoint endpoint;
+    int listener = -1;
+    std::atomic<bool> stopping{false};
+    std::atomic<uint64_t> answered{0};
+    RouteCache cache;
+    bool caching;
+    std::atomic<bool> instrumented{false};
+    std::string metricsPath;
+
+    std::vector<Connection> connections;
+    std::vector<pollfd> fds;
+    std::vector<Pending> pending;
+    std::vector<std::string> responses;
+    std::vector<size_t> consumed; // per connection, bytes of input used up
+
+    void pollOnce(int timeoutMs) {
+        fds.resize(connections.size() + 1);
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < connections.size(); i++) {
+            Connection& c = connections[i];
+            fds[i + 1].fd = c.fd;
+            bool reading = !c.closing && !backlogged(c);
+            fds[i + 1].events = (short)((reading ? POLLIN : 0) | (c.outSent < c.out.size() ? POLLOUT : 0));
+            fds[i + 1].revents = 0;
+        }
+        fds[0].revents = 0;
+        if (poll(fds.data(), fds.size(), timeoutMs) <= 0) {
+            return;
+        }
+
+        size_t open = connections.size();
+        for (size_t i = 0; i < open; i++) {
+            if ((fds[i + 1].revents & (POLLIN | POLLHUP | POLLERR)) && !backlogged(connections[i])) {
+                readFrom(connections[i]);
+            }
+        }
+        collectLines();
+        if (!pending.empty()) {
+            answer();
+        }
+        consumeInput();
+        for (Connection& c : connections) {
+            flush(c);
+        }
+        dropClosed();
+        if (fds[0].revents & POLLIN) {
+            acceptAll();
+        }
+    }
+
+    // A client that pipelines requests without reading the answers is not
+    // read from again until it has taken most of them, so the server does
+    // not buffer its output without bound.
+    bool backlogged(const Connection& c) const {
+        return c.out.size() - c.outSent > MAX_BACKLOG;
+    }
+
+    void acceptAll() {
+        while (true) {
+            int fd = accept(listener, nullptr, nullptr);
+            if (fd < 0) {
+                return;
+            }
+            fcntl(fd, F_SETFL, O_NONBLOCK);
+            serverdetail::tuneSocket(fd, endpoint.local);
+            Connection c;
+            c.fd = fd;
+            connections.push_back(std::move(c));
+        }
+    }
+
+    void readFrom(Connection& c) {
+        char buf[READ_CHUNK];
+        while (true) {
+            ssize_t got = recv(c.fd, buf, sizeof(buf), 0);
+            if (got > 0) {
+                c.in.append(buf, (size_t)got);
+                if (c.in.size() > 16 * MAX_LINE) {
+                    return; // answer what is buffered before reading more
+                }
+                continue;
+            }
+            if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+                c.closing = true;
+            }
+            if (got < 0 && errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+    }
+
+    // Splits every connection's input into complete lines, oldest first.
+    void collectLines() {
+        pending.clear();
+        consumed.assign(connections.size(), 0);
+        for (size_t i = 0; i < connections.size(); i++) {
+            Connection& c = connections[i];
+            size_t pos = 0;
+            while (true) {
+                const char* start = c.in.data() + pos;
+                const char* nl = (const char*)std::memchr(start, '\n', c.in.size() - pos);
+                if (!nl) {
+                    break;
+                }
+                size_t len = (size_t)(nl - start);
+                if (len > 0 && start[len - 1] == '\r') {
+                    len--;
+                }
+                if (len > 0) {
+                    pending.push_back(Pending{(uint32_t)i, (uint32_t)pos, (uint32_t)len});
+                }
+                pos = (size_t)(nl - c.in.data()) + 1;
+            }
+            consumed[i] = pos;
+            if (c.in.size() - pos > MAX_LINE) {
+                // The complete lines before it still point into c.in, so
+                // it is dropped only after they are answered.
+                consumed[i] = c.in.size();
+                c.overlong = true;
+            }
+        }
+    }
+
+    // Drops the input answer() has used up. A connection that sent an
+    // overlong line gets its error after the answers to earlier lines,
+    // then is closed.
+    void consumeInput() {
+        for (size_t i = 0; i < connections.size(); i++) {
+            Connection& c = connections[i];
+            c.in.erase(0, consumed[i]);
+            if (c.overlong) {
+                c.out += "{\"ok\": false, \"error\": \"request line too long\"}\n";
+                c.overlong = false;
+                c.closing = true;
+            }
+        }
+    }
+
+    void answer() {
+        if (responses.size() < pending.size()) {
+            responses.resize(pending.size());
+        }
+        if (pending.size() < INLINE_BATCH) {
+            answerRange(workers[pool.size()], 0, pending.size());
+        } else {
+            pool.parallelFor(pending.size(), GRAIN, [this](unsigned worker, size_t begin, size_t end) {
+                answerRange(workers[worker], begin, end);
+            });
+        }
+        for (size_t i = 0; i < pending.size(); i++) {
+            connections[pending[i].connection].out += responses[i];
+        }
+        answered.fetch_add(pending.size(), std::memory_order_relaxed);
+    }
+
+    void answerRange(Worker& w, size_t begin, size_t end) {
+        RcuPointer<GraphVersion>::ReadGuard version = versions.read();
+        w.counting = instrumented.load(std::memory_order_relaxed);
+        for (size_t i = begin; i < end; i++) {
+            const Pending& p = pending[i];
+            const char* line = connections[p.connection].in.data() + p.begin;
+            responses[i].clear();
+            if (!w.counting) {
+                handle(w, version.get(), line, line + p.length, responses[i]);
+                continue;
+            }
+            w.last.clear();
+            w.lastHit = false;
+            uint64_t start = instrumentdetail::now();
+            handle(w, version.get(), line, line + p.length, responses[i]);
+            w.series.observe((instrumentdetail::now() - start) * 1e-9, w.last, 0, w.lastHit);
+        }
+        if (w.counting) {
+            MetricsRegistry::instance().merge("server", w.series);
+            w.series = MetricsRegistry::Series();
+        }
+    }
+
+    void handle(Worker& w, const GraphVersion* version, const char* begin, const char* end,
+                       std::string& out) {
+        ServerRequest& r = w.request;
+        const char* error = nullptr;
+        bool parsed = r.parse(begin, end, error);
+        out += "{\"id\": ";
+        out += r.id.empty() ? "null" : r.id;
+        if (!parsed) {
+            fail(out, error);
+            return;
+        }
+        if (!version || !version->graph) {
+            fail(out, "no network loaded");
+            return;
+        }
+        const CompactGraph& g = *version->graph;
+
+        bool route = r.type.empty() || r.type == "route";
+        bool info = r.type == "version" || r.type == "stations" || r.type == "stats";
+        if (!route && !info && r.type != "cost") {
+            fail(out, "unknown type");
+            return;
+        }
+        Metric metric = r.metric == "time" ? Metric::Time : Metric::Distance;
+        if (!r.metric.empty() && r.metric != "time" && r.metric != "distance") {
+            fail(out, "metric must be \"distance\" or \"time\"");
+            return;
+        }
+        uint32_t s = g.id(r.from), t = g.id(r.to);
+        if (!info && (s == CompactGraph::NO_STATION || t == CompactGraph::NO_STATION)) {
+            fail(out, "unknown station");
+            return;
+        }
+
+        out += ", \"ok\": true, \"version\": ";
+        out += std::to_string(version->number);
+        if (r.type == "version") {
+            out += "}\n";
+            return;
+        }
+        if (r.type == "stations") {
+            out += ", \"stations\": [";
+            for (uint32_t v = 0; v < g.numVertex(); v++) {
+                if (v > 0) {
+                    out += ", ";
+                }
+                appendJsonString(out, g.names.data(v), g.names.length(v));
+            }
+            out += "]}\n";
+            return;
+        }
+        if (r.type == "stats") {
+            RouteCache::Stats stats = cache.stats();
+            out += ", \"served\": " + std::to_string(served());
+            out += ", \"cache_hits\": " + std::to_string(stats.hits);
+            out += ", \"cache_misses\": " + std::to_string(stats.misses);
+            out += ", \"cache_evictions\": " + std::to_string(stats.evictions);
+            out += ", \"cache_entries\": " + std::to_string(stats.entries) + "}\n";
+            return;
+        }
+
+        // "cost" requests cache the whole route too, so a later "route" for
+        // the same pair is a hit.
+        // Without the cache the route goes into the worker's own buffer, so
+        // uncached requests allocate nothing once it has grown.
+        std::shared_ptr<const Route> found;
+        if (caching) {
+            found = cache.find(s, t, metric, version->number);
+            w.lastHit = found != nullptr;
+        }
+        if (!found) {
+            std::shared_ptr<Route> fresh;
+            Route* into = &w.route;
+            if (caching) {
+                fresh = std::make_shared<Route>();
+                into = fresh.get();
+            }
+            if (w.counting) {
+                w.countedSearch.run(g, s, t, metric);
+                w.countedSearch.route(g, t, *into);
+                w.last = w.countedSearch.counters();
+            } else {
+                w.search.run(g, s, t, metric);
+                w.search.route(g, t, *into);
+            }
+            if (caching) {
+                cache.insert(s, t, metric, version->number, fresh);
+                found = std::move(fresh);
+            }
+        }
+        const Route& path = found ? *found : w.route;
+        out += metric == Metric::Time ? ", \"metric\": \"time\"" : ", \"metric\": \"distance\"";
+        if (!path.found()) {
+            out += ", \"found\": false}\n";
+            return;
+        }
+        out += ", \"found\": true, \"cost\": ";
+        out += std::to_string(path.cost);
+        if (!route) {
+            out += "}\n";
+            return;
+        }
+        out += ", \"interchanges\": ";
+        out += std::to_string(path.interchanges());
+        out += ", \"stations\": [";
+        for (size_t i = 0; i < path.stations.size(); i++) {
+            if (i > 0) {
+                out += ", ";
+            }
+            uint32_t v = path.stations[i];
+            appendJsonString(out, g.names.data(v), g.names.length(v));
+        }
+        out += "]}\n";
+    }
+
+    // Written beside the target and renamed over it, so a scraper never
+    // reads half a file.
+    void writeMetricsFile() const {
+        std::string temp = metricsPath + ".tmp";
+        {
+            std::ofstream out(temp.c_str());
+            writeMetrics(out);
+            if (!out) {
+                return;
+            }
+        }
+        std::rename(temp.c_str(), metricsPath.c_str());
+    }
+
+    static void fail(std::string& out, const char* error) {
+        out += ", \"ok\": false, \"error\": ";
+        appendJsonString(out, error, std::strlen(error));
+        out += "}\n";
+    }
+
+    void flush(Connection& c) {
+        while (c.outSent < c.out.size()) {
+            ssize_t sent = send(c.fd, c.out.data() + c.outSent, c.out.size() - c.outSent, MSG_NOSIGNAL);
+            if (sent > 0) {
+                c.outSent += (size_t)sent;
+                continue;
+            }
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0 && errno != EAGAIN && errno != EWOULDBLOCK) {
+                c.closing = true;
+                c.out.clear();
+                c.outSent = 0;
+            }
+            return;
+        }
+        c.out.clear();
+        c.outSent = 0;
+    }
+
+    void dropClosed() {
+        size_t kept = 0;
+        for (size_t i = 0; i < connections.size(); i++) {
+            Connection& c = connections[i];
+            if (c.closing && c.out.empty()) {
+                close(c.fd);
+                continue;
+            }
+            if (kept != i) {
+                connections[kept] = std::move(c);
+            }
+            kept++;
+        }
+        connections.resize(kept);
+    }
+};
+
+#endif
@@ -0,0 +1,202 @@
+#ifndef METROPATH_SHORTEST_PATH_H
+#define METROPATH_SHORTEST_PATH_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include "CompactGraph.h"
+#include "IndexedHeap.h"
+#include "Instrumentation.h"
+#include "Route.h"
+
+// Result of a one-to-all sweep: the cost of every station from root and the
+// shortest-path tree as a predecessor array (pred[root] = NO_STATION,
+// unreachable stations have cost INT_MAX).
+struct ShortestPathTree {
+    Metric metric = Metric::Distance;
+    uint32_t root = CompactGraph::NO_STATION;
+    std::vector<int> cost;
+    std::vector<uint32_t> pred;
+
+    bool reachable(uint32_t v) const {
+        return cost[v] != INT_MAX;
+    }
+
+    // Route from root to t.
+    void route(const CompactGraph& g, uint32_t t, Route& out) const {
+        out.reset(metric);
+        if (reachable(t)) {
+            buildRoute(g, pred, t, metric, cost[t], out);
+        }
+    }
+};
+
+// Label-setting (Dijkstra) search over a CompactGraph. One instance owns the
+// distance, predecessor and heap buffers and reuses them across queries, so
+// keep one per thread rather than one per query. A label only counts if it
+// was stamped by the current query, so starting a query costs O(1) rather
+// than a pass over every station, and the steady state allocates nothing.
+// Counters is NoCounters or
+// SearchCounters (Instrumentation.h); DijkstraSearch is the uncounted one.
+template <typename Counters = NoCounters>
+class BasicDijkstraSearch {
+public:
+    // Settles vertices from src in cost order. Stops as soon as dst is
+    // settled; pass CompactGraph::NO_STATION to settle everything reachable.
+    // Returns whether dst (or, for a full sweep, anything) was reached.
+    bool run(const CompactGraph& g, uint32_t src, uint32_t dst, Metric metric) {
+        bool found = sweep(g, src, metric, [dst](uint32_t v) { return v == dst; });
+        return found || dst == CompactGraph::NO_STATION;
+    }
+
+    // Settles vertices from src until every station in targets is settled
+    // (or nothing more is reachable). Returns whether all were reached.
+    bool runToAll(const CompactGraph& g, uint32_t src, const uint32_t* targets,
+                  size_t count, Metric metric) {
+        if (wanted.size() != g.numVertex()) {
+            wanted.assign(g.numVertex(), 0);
+            stamp = 0;
+        }
+        if (++stamp == 0) {
+            std::fill(wanted.begin(), wanted.end(), 0);
+            stamp = 1;
+        }
+        size_t left = 0;
+        for (size_t i = 0; i < count; i++) {
+            if (wanted[targets[i]] != stamp) {
+                wanted[targets[i]] = stamp;
+                left++;
+            }
+        }
+        if (left == 0) {
+            return true;
+        }
+        return sweep(g, src, metric, [this, &left](uint32_t v) {
+            return wanted[v] == stamp && --left == 0;
+        });
+    }
+
+    // Full one-to-all sweep, copied out as a tree the caller can keep.
+    void tree(const CompactGraph& g, uint32_t src, Metric metric, ShortestPathTree& out) {
+        run(g, src, CompactGraph::NO_STATION, metric);
+        uint32_t n = g.numVertex();
+        out.metric = metric;
+        out.root = src;
+        out.cost.resize(n);
+        out.pred.resize(n);
+        for (uint32_t v = 0; v < n; v++) {
+            bool reached = labelled[v] == round;
+            out.cost[v] = reached ? dist[v] : INT_MAX;
+            out.pred[v] = reached ? pred[v] : CompactGraph::NO_STATION;
+        }
+    }
+
+    // Final for settled vertices; INT_MAX if v was not reached.
+    int cost(uint32_t v) const {
+        return labelled[v] == round ? dist[v] : INT_MAX;
+    }
+
+    // Only meaningful for reached vertices (cost() != INT_MAX); following
+    // it from one always ends at the source, whose entry is NO_STATION.
+    const std::vector<uint32_t>& predecessors() const {
+        return pred;
+    }
+
+    uint32_t settledCount() const {
+        return settled;
+    }
+
+    // What the last search did; all zero with NoCounters.
+    const Counters& counters() const {
+        return stats;
+    }
+
+    // Rebuilds the route to dst; empty if dst was not reached.
+    void route(const CompactGraph& g, uint32_t dst, Route& out) const {
+        if (cost(dst) == INT_MAX) {
+            out.reset(metric);
+            return;
+        }
+        buildRoute(g, pred, dst, metric, dist[dst], out);
+    }
+
+private:
+    std::vector<int> dist;       // valid where labelled == round
+    std::vector<uint32_t> pred;  // likewise
+    std::vector<uint32_t> labelled;
+    uint32_t round = 0;
+    IndexedHeap<int> heap;
+    Metric metric = Metric::Distance;
+    uint32_t settled = 0;
+    Counters stats;
+
+    std::vector<uint32_t> wanted; // == stamp marks a pending target
+    uint32_t stamp = 0;
+
+    // Core loop. stop(v) is called as each vertex is settled; returning
+    // true ends the search.
+    template <typename Stop>
+    bool sweep(const CompactGraph& g, uint32_t src, Metric metric, Stop stop) {
+        reset(g.numVertex());
+        this->metric = metric;
+        const int* w = g.weights(metric);
+
+        labelled[src] = round;
+        dist[src] = 0;
+        pred[src] = CompactGraph::NO_STATION;
+        heap.add(src, 0);
+        stats.push();
+
+        while (!heap.isEmpty()) {
+            uint32_t v;
+            int cost;
+            heap.remove(v, cost);
+            stats.pop();
+            settled++;
+            stats.settle();
+
+            if (stop(v)) {
+                return true;
+            }
+
+            for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                uint32_t nbr = g.targets[a];
+                int nc = cost + w[a];
+                stats.relax();
+                if (labelled[nbr] != round || nc < dist[nbr]) {
+                    labelled[nbr] = round;
+                    dist[nbr] = nc;
+                    pred[nbr] = v;
+                    stats.improve(!heap.contains(nbr));
+                    heap.addOrUpdate(nbr, nc);
+                }
+            }
+        }
+        return false;
+    }
+
+    void reset(uint32_t n) {
+        if (labelled.size() != n) {
+            dist.resize(n);
+            pred.resize(n);
+            labelled.assign(n, 0);
+            round = 0;
+        }
+        if (++round == 0) {
+            std::fill(labelled.begin(), labelled.end(), 0);
+            round = 1;
+        }
+        if (heap.capacity() != n) {
+            heap.resize(n);
+        } else {
+            heap.clear();
+        }
+        settled = 0;
+        stats.clear();
+    }
+};
+
+typedef BasicDijkstraSearch<> DijkstraSearch;
+
+#endif
@@ -0,0 +1,612 @@
+#ifndef METROPATH_SNAPSHOT_H
+#define METROPATH_SNAPSHOT_H
+
+#include <climits>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
+#include "AllPairs.h"
+#include "CompactGraph.h"
+#include "ContractionHierarchy.h"
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Versioned binary image of a frozen network that a process maps read-only
+// and queries in place: no parsing, no per-station allocation, and every
+// process on the host that maps the same file shares its physical pages.
+//
+// Layout, all integers in host byte order:
+//
+//   SnapshotHeader                          64 bytes
+//   SnapshotSection[sectionCount]           section table
+//   section payloads                        each 64-byte aligned
+//
+// The graph sections (station string table, name index, CSR arrays, arc
+// lines, line names) are always present. All-pairs tables and contraction
+// hierarchies are optional, one set of sections per metric. The checksum
+// covers everything after the header; it is only recomputed by verify(),
+// so that opening a snapshot never has to touch every page.
+
+struct SnapshotHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t byteOrder;
+    uint32_t sectionCount;
+    uint32_t numVertex;
+    uint64_t fileSize;
+    uint64_t checksum;
+    uint64_t fingerprint;
+    uint32_t numArcs;
+    uint32_t reserved[3];
+};
+
+struct SnapshotSection {
+    uint32_t kind;
+    uint32_t metric;
+    uint64_t offset;
+    uint64_t bytes;
+};
+
+static_assert(sizeof(SnapshotHeader) == 64, "snapshot header layout");
+static_assert(sizeof(SnapshotSection) == 24, "snapshot section layout");
+
+enum SnapshotSectionKind : uint32_t {
+    SECTION_NAME_OFFSETS = 1,
+    SECTION_NAME_CHARS = 2,
+    SECTION_NAME_SLOTS = 3,
+    SECTION_OFFSETS = 4,
+    SECTION_TARGETS = 5,
+    SECTION_DISTANCE = 6,
+    SECTION_TIME = 7,
+    SECTION_ARC_LINES = 8,
+    SECTION_LINE_NAMES = 9, // the 26 display names, each followed by '\n'
+
+    SECTION_ALL_PAIRS_COST = 16,
+    SECTION_ALL_PAIRS_NEXT = 17,
+
+    SECTION_CH_META = 32, // uint32 shortcut count
+    SECTION_CH_RANK = 33,
+    SECTION_CH_UP_OFFSETS = 34,
+    SECTION_CH_UP_TARGETS = 35,
+    SECTION_CH_UP_WEIGHTS = 36,
+    SECTION_CH_UP_MIDDLES = 37,
+};
+
+const char SNAPSHOT_MAGIC[8] = {'M', 'E', 'T', 'R', 'O', 'S', 'N', 'P'};
+const uint32_t SNAPSHOT_VERSION = 1;
+const uint32_t SNAPSHOT_BYTE_ORDER = 0x01020304;
+const uint64_t SNAPSHOT_ALIGN = 64;
+
+inline uint64_t snapshotChecksum(const char* data, size_t bytes) {
+    return hashName(data, bytes);
+}
+
+// True if the file starts with the snapshot magic, i.e. it should be opened
+// with Snapshot rather than NetworkLoader.
+inline bool isSnapshotFile(const std::string& path) {
+    FILE* f = std::fopen(path.c_str(), "rb");
+    if (f == nullptr) {
+        return false;
+    }
+    char magic[8];
+    bool match = std::fread(magic, 1, 8, f) == 8 && std::memcmp(magic, SNAPSHOT_MAGIC, 8) == 0;
+    std::fclose(f);
+    return match;
+}
+
+// A whole file mapped read-only. The mapping is shared, so the kernel backs
+// it with the page cache instead of private copies.
+class MappedFile {
+public:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    static std::shared_ptr<MappedFile> open(const std::string& path, std::string& error) {
+        std::shared_ptr<MappedFile> file(new MappedFile());
+        if (!file->map(path, error)) {
+            return nullptr;
+        }
+        return file;
+    }
+
+    ~MappedFile() {
+#ifdef _WIN32
+        if (base != nullptr) {
+            UnmapViewOfFile(base);
+        }
+#else
+        if (base != nullptr) {
+            munmap((void*)base, length);
+        }
+#endif
+    }
+
+    const char* data() const {
+        return base;
+    }
+
+    size_t size() const {
+        return length;
+    }
+
+private:
+    const char* base = nullptr;
+    size_t length = 0;
+
+    MappedFile() {}
+
+#ifdef _WIN32
+    bool map(const std::string& path, std::string& error) {
+        HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            error = path + ": cannot open file";
+            return false;
+        }
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+            CloseHandle(file);
+            error = path + ": empty or unreadable file";
+            return false;
+        }
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        CloseHandle(file);
+        if (mapping == nullptr) {
+            error = path + ": cannot map file";
+            return false;
+        }
+        base = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+        CloseHandle(mapping);
+        if (base == nullptr) {
+            error = path + ": cannot map file";
+            return false;
+        }
+        length = (size_t)size.QuadPart;
+        return true;
+    }
+#else
+    bool map(const std::string& path, std::string& error) {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            error = path + ": cannot open file";
+            return false;
+        }
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size == 0) {
+            ::close(fd);
+            error = path + ": empty or unreadable file";
+            return false;
+        }
+        void* p = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd);
+        if (p == MAP_FAILED) {
+            error = path + ": cannot map file";
+            return false;
+        }
+        base = (const char*)p;
+        length = (size_t)st.st_size;
+        return true;
+    }
+#endif
+};
+
+// What a snapshot carries besides the graph. Tables that are null (or
+// empty) are left out of the file.
+struct SnapshotExtras {
+    const AllPairsTable* allPairs[2] = {nullptr, nullptr};         // indexed by Metric
+    const ContractionHierarchy* hierarchies[2] = {nullptr, nullptr}; // indexed by Metric
+};
+
+// Writes g and the given extras to path. The file is written next to the
+// target and renamed into place, so a process mapping the old snapshot
+// never sees a half-written one.
+inline bool writeSnapshot(const std::string& path, const CompactGraph& g, const SnapshotExtras& extras,
+                          std::string& error) {
+    struct Payload {
+        uint32_t kind;
+        uint32_t metric;
+        const void* data;
+        uint64_t bytes;
+    };
+    std::vector<Payload> payloads;
+    auto add = [&payloads](uint32_t kind, uint32_t metric, const void* data, uint64_t bytes) {
+        payloads.push_back(Payload{kind, metric, data, bytes});
+    };
+
+    uint32_t n = g.numVertex();
+    uint32_t arcs = g.numArcs();
+    std::string lineText;
+    for (size_t i = 0; i < 26; i++) {
+        if (i < g.lineNames.size()) {
+            lineText += g.lineNames[i];
+        }
+        lineText += '\n';
+    }
+
+    add(SECTION_NAME_OFFSETS, 0, g.names.offsets.data(), (uint64_t)(n + 1) * 4);
+    add(SECTION_NAME_CHARS, 0, g.names.chars.data(), g.names.chars.size());
+    add(SECTION_NAME_SLOTS, 0, g.nameSlots.data(), (uint64_t)g.nameSlots.size() * 4);
+    add(SECTION_OFFSETS, 0, g.offsets.data(), (uint64_t)(n + 1) * 4);
+    add(SECTION_TARGETS, 0, g.targets.data(), (uint64_t)arcs * 4);
+    add(SECTION_DISTANCE, 0, g.distance.data(), (uint64_t)arcs * 4);
+    add(SECTION_TIME, 0, g.time.data(), (uint64_t)arcs * 4);
+    add(SECTION_ARC_LINES, 0, g.arcLines.data(), (uint64_t)arcs * 4);
+    add(SECTION_LINE_NAMES, 0, lineText.data(), lineText.size());
+
+    uint32_t shortcuts[2];
+    for (uint32_t m = 0; m < 2; m++) {
+        const AllPairsTable* ap = extras.allPairs[m];
+        if (ap != nullptr && !ap->empty()) {
+            if ((uint32_t)ap->metricType() != m) {
+                error = "all-pairs table stored under the wrong metric";
+                return false;
+            }
+            uint64_t cells = (uint64_t)n * n;
+            add(SECTION_ALL_PAIRS_COST, m, ap->costData(), cells * 4);
+            add(SECTION_ALL_PAIRS_NEXT, m, ap->nextData(), cells * 4);
+        }
+        const ContractionHierarchy* ch = extras.hierarchies[m];
+        if (ch != nullptr && !ch->empty()) {
+            if ((uint32_t)ch->metricType() != m || ch->numVertex() != n ||
+                ch->graphFingerprint() != g.fingerprint()) {
+                error = "hierarchy does not belong to this network";
+                return false;
+            }
+            ContractionHierarchy::Arrays a = ch->arrays();
+            uint64_t up = ch->numArcs();
+            shortcuts[m] = ch->numShortcuts();
+            add(SECTION_CH_META, m, &shortcuts[m], 4);
+            add(SECTION_CH_RANK, m, a.rank, (uint64_t)n * 4);
+            add(SECTION_CH_UP_OFFSETS, m, a.upOffsets, (uint64_t)(n + 1) * 4);
+            add(SECTION_CH_UP_TARGETS, m, a.upTargets, up * 4);
+            add(SECTION_CH_UP_WEIGHTS, m, a.upWeights, up * 4);
+            add(SECTION_CH_UP_MIDDLES, m, a.upMiddles, up * 4);
+        }
+    }
+
+    auto align = [](uint64_t x) {
+        return (x + SNAPSHOT_ALIGN - 1) / SNAPSHOT_ALIGN * SNAPSHOT_ALIGN;
+    };
+    std::vector<SnapshotSection> table;
+    uint64_t at = align(sizeof(SnapshotHeader) + payloads.size() * sizeof(SnapshotSection));
+    for (const Payload& p : payloads) {
+        table.push_back(SnapshotSection{p.kind, p.metric, at, p.bytes});
+        at = align(at + p.bytes);
+    }
+
+    // Assemble everything after the header in memory so the checksum can be
+    // computed in one pass; snapshots are written offline by a tool.
+    std::vector<char> body(at - sizeof(SnapshotHeader), 0);
+    std::memcpy(body.data(), table.data(), table.size() * sizeof(SnapshotSection));
+    for (size_t i = 0; i < payloads.size(); i++) {
+        if (payloads[i].bytes != 0) {
+            std::memcpy(body.data() + table[i].offset - sizeof(SnapshotHeader), payloads[i].data,
+                        payloads[i].bytes);
+        }
+    }
+
+    SnapshotHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, 8);
+    header.version = SNAPSHOT_VERSION;
+    header.byteOrder = SNAPSHOT_BYTE_ORDER;
+    header.sectionCount = (uint32_t)table.size();
+    header.numVertex = n;
+    header.fileSize = at;
+    header.checksum = snapshotChecksum(body.data(), body.size());
+    header.fingerprint = g.fingerprint();
+    header.numArcs = arcs;
+
+    std::string temp = path + ".tmp";
+    FILE* f = std::fopen(temp.c_str(), "wb");
+    if (f == nullptr) {
+        error = temp + ": cannot create file";
+        return false;
+    }
+    bool ok = std::fwrite(&header, sizeof(header), 1, f) == 1 &&
+              std::fwrite(body.data(), 1, body.size(), f) == body.size();
+    ok = std::fclose(f) == 0 && ok;
+    if (ok) {
+        std::remove(path.c_str()); // rename does not replace on Windows
+        ok = std::rename(temp.c_str(), path.c_str()) == 0;
+    }
+    if (!ok) {
+        std::remove(temp.c_str());
+        error = path + ": write failed";
+        return false;
+    }
+    return true;
+}
+
+// An opened snapshot. open() maps the file and checks the header, the
+// section table and the sizes of every section, which is O(sections); the
+// graph and tables it hands out point straight into the mapping and keep it
+// alive. verify() additionally checks the checksum and every array, and is
+// meant for tools rather than startup.
+class Snapshot {
+public:
+    bool open(const std::string& path, std::string& error) {
+        *this = Snapshot();
+        name = path;
+        file = MappedFile::open(path, error);
+        if (!file) {
+            return false;
+        }
+        const char* base = file->data();
+        if (file->size() < sizeof(SnapshotHeader)) {
+            return fail("file too short for a snapshot header", error);
+        }
+        std::memcpy(&header, base, sizeof(header));
+        if (std::memcmp(header.magic, SNAPSHOT_MAGIC, 8) != 0) {
+            return fail("not a MetroPath snapshot", error);
+        }
+        if (header.byteOrder != SNAPSHOT_BYTE_ORDER) {
+            return fail("snapshot was written on a machine with a different byte order", error);
+        }
+        if (header.version != SNAPSHOT_VERSION) {
+            return fail("unsupported snapshot version " + std::to_string(header.version), error);
+        }
+        if (header.fileSize != file->size()) {
+            return fail("file size does not match the header (truncated?)", error);
+        }
+        uint64_t tableEnd = sizeof(SnapshotHeader) + (uint64_t)header.sectionCount * sizeof(SnapshotSection);
+        if (tableEnd > file->size()) {
+            return fail("section table runs past the end of the file", error);
+        }
+        sections = (const SnapshotSection*)(base + sizeof(SnapshotHeader));
+        for (uint32_t i = 0; i < header.sectionCount; i++) {
+            const SnapshotSection& s = sections[i];
+            if (s.offset < tableEnd || s.offset % 8 != 0 || s.offset > file->size() ||
+                s.bytes > file->size() - s.offset || s.metric > 1) {
+                return fail("section " + std::to_string(i) + " is out of bounds", error);
+            }
+        }
+        return bindGraph(error);
+    }
+
+    const SnapshotHeader& info() const {
+        return header;
+    }
+
+    std::shared_ptr<const CompactGraph> graph() const {
+        return compact;
+    }
+
+    bool hasAllPairs(Metric metric) const {
+        return find(SECTION_ALL_PAIRS_COST, metric) != nullptr;
+    }
+
+    bool hasHierarchy(Metric metric) const {
+        return find(SECTION_CH_RANK, metric) != nullptr;
+    }
+
+    // Points table at the snapshot's all-pairs matrices for metric. Returns
+    // false (table unchanged) if the snapshot has none or they are malformed.
+    bool attachAllPairs(Metric metric, AllPairsTable& table) const {
+        uint64_t cells = (uint64_t)header.numVertex * header.numVertex;
+        const int* cost = array<int>(SECTION_ALL_PAIRS_COST, metric, cells);
+        const uint32_t* next = array<uint32_t>(SECTION_ALL_PAIRS_NEXT, metric, cells);
+        if (cost == nullptr || next == nullptr) {
+            return false;
+        }
+        table.attach(metric, header.numVertex, cost, next, file);
+        return true;
+    }
+
+    bool attachHierarchy(Metric metric, ContractionHierarchy& ch) const {
+        uint32_t n = header.numVertex;
+        ContractionHierarchy::Arrays a;
+        const uint32_t* meta = array<uint32_t>(SECTION_CH_META, metric, 1);
+        a.rank = array<uint32_t>(SECTION_CH_RANK, metric, n);
+        a.upOffsets = array<uint32_t>(SECTION_CH_UP_OFFSETS, metric, (uint64_t)n + 1);
+        if (meta == nullptr || a.rank == nullptr || a.upOffsets == nullptr) {
+            return false;
+        }
+        uint64_t up = n == 0 ? 0 : a.upOffsets[n];
+        a.upTargets = array<uint32_t>(SECTION_CH_UP_TARGETS, metric, up);
+        a.upWeights = array<int>(SECTION_CH_UP_WEIGHTS, metric, up);
+        a.upMiddles = array<uint32_t>(SECTION_CH_UP_MIDDLES, metric, up);
+        if (a.upTargets == nullptr || a.upWeights == nullptr || a.upMiddles == nullptr) {
+            return false;
+        }
+        ch.attach(metric, n, header.fingerprint, meta[0], a, file);
+        return true;
+    }
+
+    // Full check: checksum, then every array of the graph and the optional
+    // tables. Reads the whole file.
+    bool verify(std::string& error) const {
+        const char* base = file->data();
+        if (snapshotChecksum(base + sizeof(SnapshotHeader), file->size() - sizeof(SnapshotHeader)) !=
+            header.checksum) {
+            return fail("checksum mismatch", error);
+        }
+
+        const CompactGraph& g = *compact;
+        uint32_t n = g.numVertex();
+        for (uint32_t slot : g.nameSlots) {
+            if (slot > n) {
+                return fail("name index entry out of range", error);
+            }
+        }
+        for (uint32_t v = 0; v < n; v++) {
+            if (g.names.offsets[v] > g.names.offsets[v + 1]) {
+                return fail("station name table is not monotonic", error);
+            }
+            if (g.id(g.names.data(v), g.names.length(v)) != v) {
+                return fail("name index does not find station " + g.names[v], error);
+            }
+            if (g.offsets[v] > g.offsets[v + 1]) {
+                return fail("arc offsets are not monotonic", error);
+            }
+            for (uint32_t a = g.begin(v); a < g.end(v); a++) {
+                uint32_t t = g.targets[a];
+                if (t >= n || t == v || (a > g.begin(v) && g.targets[a - 1] >= t)) {
+                    return fail("adjacency of " + g.names[v] + " is not sorted or out of range", error);
+                }
+                uint32_t back = g.arc(t, v);
+                if (back == CompactGraph::NO_STATION || g.distance[back] != g.distance[a] ||
+                    g.arcLines[back] != g.arcLines[a]) {
+                    return fail("edge " + g.names[v] + " - " + g.names[t] + " is not symmetric", error);
+                }
+                if (g.distance[a] < 0 || g.time[a] != travelTime(g.distance[a])) {
+                    return fail("bad weight on " + g.names[v] + " - " + g.names[t], error);
+                }
+            }
+        }
+        if (g.fingerprint() != header.fingerprint) {
+            return fail("graph fingerprint does not match the header", error);
+        }
+
+        for (int m = 0; m < 2; m++) {
+            Metric metric = (Metric)m;
+            if (hasAllPairs(metric)) {
+                AllPairsTable table;
+                if (!attachAllPairs(metric, table)) {
+                    return fail("all-pairs sections are incomplete", error);
+                }
+                for (uint32_t s = 0; s < n; s++) {
+                    if (table.costOf(s, s) != 0 || table.nextHop(s, s) != s) {
+                        return fail("all-pairs diagonal is not zero", error);
+                    }
+                    for (uint32_t t = 0; t < n; t++) {
+                        uint32_t hop = table.nextHop(s, t);
+                        bool reach = table.costOf(s, t) != INT_MAX;
+                        if (reach != (hop != CompactGraph::NO_STATION) || (reach && hop >= n)) {
+                            return fail("all-pairs next hop out of range", error);
+                        }
+                    }
+                }
+            }
+            if (hasHierarchy(metric)) {
+                ContractionHierarchy ch;
+                if (!attachHierarchy(metric, ch)) {
+                    return fail("hierarchy sections are incomplete", error);
+                }
+                std::vector<char> seen(n, 0);
+                for (uint32_t v = 0; v < n; v++) {
+                    uint32_t r = ch.rankOf(v);
+                    if (r >= n || seen[r]) {
+                        return fail("hierarchy ranks are not a permutation", error);
+                    }
+                    seen[r] = 1;
+                }
+                for (uint32_t v = 0; v < n; v++) {
+                    if (ch.begin(v) > ch.end(v)) {
+                        return fail("hierarchy offsets are not monotonic", error);
+                    }
+                    for (uint32_t a = ch.begin(v); a < ch.end(v); a++) {
+                        uint32_t t = ch.target(a);
+                        if (t >= n || ch.rankOf(t) <= ch.rankOf(v)) {
+                            return fail("hierarchy arc does not lead upward", error);
+                        }
+                    }
+                }
+            }
+        }
+        return true;
+    }
+
+private:
+    std::string name;
+    std::shared_ptr<MappedFile> file;
+    SnapshotHeader header;
+    const SnapshotSection* sections = nullptr;
+    std::shared_ptr<const CompactGraph> compact;
+
+    bool fail(const std::string& message, std::string& error) const {
+        error = name + ": " + message;
+        return false;
+    }
+
+    const SnapshotSection* find(uint32_t kind, Metric metric) const {
+        for (uint32_t i = 0; i < header.sectionCount; i++) {
+            if (sections[i].kind == kind && sections[i].metric == (uint32_t)metric) {
+                return &sections[i];
+            }
+        }
+        return nullptr;
+    }
+
+    // Section contents as count elements of T, or null if the section is
+    // missing or has a different size.
+    template <typename T>
+    const T* array(uint32_t kind, Metric metric, uint64_t count) const {
+        const SnapshotSection* s = find(kind, metric);
+        if (s == nullptr || s->bytes != count * sizeof(T)) {
+            return nullptr;
+        }
+        return (const T*)(file->data() + s->offset);
+    }
+
+    bool bindGraph(std::string& error) {
+        uint32_t n = header.numVertex;
+        uint32_t arcs = header.numArcs;
+        Metric m = Metric::Distance;
+        const SnapshotSection* chars = find(SECTION_NAME_CHARS, m);
+        const SnapshotSection* slots = find(SECTION_NAME_SLOTS, m);
+        const SnapshotSection* lines = find(SECTION_LINE_NAMES, m);
+        if (chars == nullptr || slots == nullptr || lines == nullptr) {
+            return fail("missing graph section", error);
+        }
+        uint64_t slotCount = slots->bytes / 4;
+        if (slotCount < (uint64_t)n + 1 || (slotCount & (slotCount - 1)) != 0 || slots->bytes % 4 != 0) {
+            return fail("bad name index size", error);
+        }
+
+        std::shared_ptr<CompactGraph> g = std::make_shared<CompactGraph>();
+        const char* base = file->data();
+        const uint32_t* nameOffsets = array<uint32_t>(SECTION_NAME_OFFSETS, m, (uint64_t)n + 1);
+        const uint32_t* offsets = array<uint32_t>(SECTION_OFFSETS, m, (uint64_t)n + 1);
+        const uint32_t* targets = array<uint32_t>(SECTION_TARGETS, m, arcs);
+        const int* distance = array<int>(SECTION_DISTANCE, m, arcs);
+        const int* time = array<int>(SECTION_TIME, m, arcs);
+        const uint32_t* arcLines = array<uint32_t>(SECTION_ARC_LINES, m, arcs);
+        if (nameOffsets == nullptr || offsets == nullptr || targets == nullptr || distance == nullptr ||
+            time == nullptr || arcLines == nullptr) {
+            return fail("graph section has the wrong size", error);
+        }
+        if (nameOffsets[0] != 0 || nameOffsets[n] != chars->bytes || offsets[0] != 0 || offsets[n] != arcs) {
+            return fail("graph sections disagree with the header", error);
+        }
+
+        g->names.offsets = ArrayView<uint32_t>(nameOffsets, (size_t)n + 1);
+        g->names.chars = ArrayView<char>(base + chars->offset, chars->bytes);
+        g->nameSlots = ArrayView<uint32_t>((const uint32_t*)(base + slots->offset), slotCount);
+        g->offsets = ArrayView<uint32_t>(offsets, (size_t)n + 1);
+        g->targets = ArrayView<uint32_t>(targets, arcs);
+        g->distance = ArrayView<int>(distance, arcs);
+        g->time = ArrayView<int>(time, arcs);
+        g->arcLines = ArrayView<uint32_t>(arcLines, arcs);
+
+        const char* p = base + lines->offset;
+        const char* end = p + lines->bytes;
+        while (p < end && g->lineNames.size() < 26) {
+            const char* nl = (const char*)std::memchr(p, '\n', end - p);
+            if (nl == nullptr) {
+                break;
+            }
+            g->lineNames.push_back(std::string(p, nl));
+            p = nl + 1;
+        }
+        g->lineNames.resize(26);
+        g->storage = file;
+        compact = g;
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,493 @@
+#ifndef METROPATH_STATION_INDEX_H
+#define METROPATH_STATION_INDEX_H
+
+#include <algorithm>
+#include <cctype>
+#include <climits>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <utility>
+#include <vector>
+#include "CompactGraph.h"
+
+// Menu code of a station: the first character of each word (a leading
+// number is kept whole), plus the second letter of the last word when that
+// leaves a single character. "Dum Dum~B" is "DD", "Esplanade~BGP" is "ES".
+inline std::string stationCode(const std::string& name) {
+    std::string code;
+    std::string word;
+    size_t i = 0;
+    while (i < name.size()) {
+        while (i < name.size() && std::isspace((unsigned char)name[i])) {
+            i++;
+        }
+        if (i == name.size()) {
+            break;
+        }
+        size_t start = i;
+        while (i < name.size() && !std::isspace((unsigned char)name[i])) {
+            i++;
+        }
+        word.assign(name, start, i - start);
+        size_t j = 0;
+        while (j < word.size() && word[j] >= '0' && word[j] <= '9') {
+            code += word[j++];
+        }
+        if (j < word.size() && word[j] < 123) {
+            code += word[j];
+        }
+    }
+    if (code.size() < 2 && word.size() > 1) {
+        code += (char)std::toupper((unsigned char)word[1]);
+    }
+    return code;
+}
+
+// Name as a rider might type it: lower case, no surrounding blanks, one
+// space between words.
+inline std::string foldStationName(const char* p, size_t n) {
+    std::string out;
+    out.reserve(n);
+    bool gap = false;
+    for (size_t i = 0; i < n; i++) {
+        unsigned char c = (unsigned char)p[i];
+        if (std::isspace(c)) {
+            gap = !out.empty();
+            continue;
+        }
+        if (gap) {
+            out += ' ';
+            gap = false;
+        }
+        out += (char)std::tolower(c);
+    }
+    return out;
+}
+
+inline std::string foldStationName(const std::string& s) {
+    return foldStationName(s.data(), s.size());
+}
+
+// Perfect hash over a fixed set of distinct strings, built by hash and
+// displace: keys hash to small buckets, and each bucket gets the first
+// seed that sends all its keys to free slots. A lookup is one hash, one
+// seeded remix and one comparison, whatever the key. The table is a
+// little larger than the key count (NUM/DEN) to keep the build quick.
+class PerfectHash {
+public:
+    enum : uint32_t { NONE = UINT32_MAX };
+
+    void build(const std::vector<std::string>& keys) {
+        n = (uint32_t)keys.size();
+        size = n == 0 ? 0 : n + n * (DEN - NUM) / NUM + 1;
+        seeds.assign(n / BUCKET_KEYS + 1, 0);
+        slots.assign(size, NONE);
+
+        std::vector<std::vector<uint32_t>> buckets(seeds.size());
+        std::vector<uint64_t> hashes(n);
+        for (uint32_t k = 0; k < n; k++) {
+            hashes[k] = hashName(keys[k].data(), keys[k].size());
+            buckets[bucketOf(hashes[k])].push_back(k);
+        }
+        std::vector<uint32_t> order(buckets.size());
+        for (uint32_t b = 0; b < order.size(); b++) {
+            order[b] = b;
+        }
+        std::stable_sort(order.begin(), order.end(), [&buckets](uint32_t a, uint32_t b) {
+            return buckets[a].size() > buckets[b].size();
+        });
+
+        // Distinct keys with equal 64-bit hashes could never be separated;
+        // FNV-1a makes that vanishingly unlikely at station-list sizes.
+        std::vector<uint32_t> placed;
+        for (uint32_t b : order) {
+            const std::vector<uint32_t>& bucket = buckets[b];
+            if (bucket.empty()) {
+                break;
+            }
+            for (uint32_t seed = 0;; seed++) {
+                placed.clear();
+                for (uint32_t k : bucket) {
+                    uint32_t s = slotOf(hashes[k], seed);
+                    if (slots[s] != NONE || std::find(placed.begin(), placed.end(), s) != placed.end()) {
+                        break;
+                    }
+                    placed.push_back(s);
+                }
+                if (placed.size() == bucket.size()) {
+                    for (size_t i = 0; i < bucket.size(); i++) {
+                        slots[placed[i]] = bucket[i];
+                    }
+                    seeds[b] = seed;
+                    break;
+                }
+            }
+        }
+    }
+
+    // Index of the only key that can equal s; the caller compares.
+    uint32_t candidate(const char* s, size_t len) const {
+        if (n == 0) {
+            return NONE;
+        }
+        uint64_t h = hashName(s, len);
+        return slots[slotOf(h, seeds[bucketOf(h)])];
+    }
+
+private:
+    enum : uint32_t { BUCKET_KEYS = 4, NUM = 9, DEN = 10 };
+
+    uint32_t n = 0;
+    uint32_t size = 0;
+    std::vector<uint32_t> seeds; // per bucket
+    std::vector<uint32_t> slots; // key index or NONE
+
+    uint32_t bucketOf(uint64_t h) const {
+        return (uint32_t)((h >> 32) % seeds.size());
+    }
+
+    uint32_t slotOf(uint64_t h, uint32_t seed) const {
+        uint64_t x = h + (seed + 1) * 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        return (uint32_t)((x ^ (x >> 31)) % size);
+    }
+};
+
+// A station found by StationIndex::complete or closest, with the number of
+// typos it took.
+struct StationMatch {
+    uint32_t station;
+    uint32_t edits;
+};
+
+// Lookup structures over the station names, built once per set of names so
+// that resolving what a rider typed never scans the station list:
+//
+//  - exact: a perfect hash from each folded name, with and without its
+//    "~LINES" suffix (the bare form only when one station has it), and a
+//    second one from each menu code, to the station id;
+//  - autocomplete: a radix trie of the folded bare names. Every node covers
+//    a contiguous range of the alphabetically sorted names, so completing
+//    a prefix is a walk down the trie plus a copy. Typos are handled by
+//    carrying a row of the edit-distance table down the trie and pruning
+//    subtrees the row says cannot come within the bound.
+class StationIndex {
+public:
+    // Largest edit bound complete and closest accept.
+    enum { MAX_EDITS = 3 };
+
+    void build(const CompactGraph& g) {
+        uint32_t n = g.numVertex();
+        std::vector<std::string> bare(n);
+        std::vector<std::pair<std::string, uint32_t>> names;
+        std::vector<std::pair<std::string, uint32_t>> codeKeys;
+        names.reserve(2 * n);
+        codeKeys.reserve(n);
+        codes.resize(n);
+        for (uint32_t v = 0; v < n; v++) {
+            const char* p = g.names.data(v);
+            size_t len = g.names.length(v);
+            const char* tilde = std::find(p, p + len, '~');
+            names.emplace_back(foldStationName(p, len), v);
+            bare[v] = foldStationName(p, tilde - p);
+            codes[v] = stationCode(g.names[v]);
+            codeKeys.emplace_back(upper(codes[v]), v);
+        }
+
+        // A bare name counts as exact only when it is unique and is not
+        // some other station's full name.
+        std::vector<uint32_t> byBare(n);
+        for (uint32_t v = 0; v < n; v++) {
+            byBare[v] = v;
+        }
+        std::sort(byBare.begin(), byBare.end(), [&bare](uint32_t a, uint32_t b) {
+            return bare[a] < bare[b] || (bare[a] == bare[b] && a < b);
+        });
+        for (uint32_t i = 0; i < n; i++) {
+            uint32_t v = byBare[i];
+            bool shared = (i > 0 && bare[byBare[i - 1]] == bare[v]) ||
+                          (i + 1 < n && bare[byBare[i + 1]] == bare[v]);
+            if (!shared) {
+                names.emplace_back(bare[v], v);
+            }
+        }
+        exact.build(names);
+        byCode.build(codeKeys);
+        buildTrie(bare, byBare);
+    }
+
+    uint32_t numStations() const {
+        return (uint32_t)codes.size();
+    }
+
+    // Station named by text in any case, with or without its line suffix;
+    // NO_STATION if none (or several stations share the bare name).
+    uint32_t find(const std::string& text) const {
+        return exact.find(foldStationName(text));
+    }
+
+    // Station with the menu code, in any case; the first one if several
+    // stations share it.
+    uint32_t findCode(const std::string& code) const {
+        return byCode.find(upper(foldStationName(code)));
+    }
+
+    const std::string& code(uint32_t v) const {
+        return codes[v];
+    }
+
+    // Up to limit stations whose bare name starts with text, allowing up
+    // to maxEdits typos in it (capped at MAX_EDITS). Fewest typos first,
+    // then alphabetical.
+    void complete(const std::string& text, uint32_t maxEdits, size_t limit, std::vector<StationMatch>& out) const {
+        search(text, maxEdits, limit, true, out);
+    }
+
+    // Up to limit stations whose whole bare name is within maxEdits of
+    // text, closest first: what a rider probably meant by a name that
+    // does not resolve.
+    void closest(const std::string& text, uint32_t maxEdits, size_t limit, std::vector<StationMatch>& out) const {
+        search(text, maxEdits, limit, false, out);
+    }
+
+private:
+    // Perfect-hashed string keys, each with a station.
+    struct ExactTable {
+        PerfectHash hash;
+        std::string chars;
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> stations;
+
+        // The first entry wins when a key repeats.
+        void build(std::vector<std::pair<std::string, uint32_t>>& entries) {
+            std::stable_sort(entries.begin(), entries.end(),
+                             [](const std::pair<std::string, uint32_t>& a,
+                                const std::pair<std::string, uint32_t>& b) { return a.first < b.first; });
+            entries.erase(std::unique(entries.begin(), entries.end(),
+                                      [](const std::pair<std::string, uint32_t>& a,
+                                         const std::pair<std::string, uint32_t>& b) { return a.first == b.first; }),
+                          entries.end());
+            std::vector<std::string> keys;
+            keys.reserve(entries.size());
+            chars.clear();
+            offsets.assign(1, 0);
+            stations.clear();
+            for (std::pair<std::string, uint32_t>& e : entries) {
+                chars += e.first;
+                offsets.push_back((uint32_t)chars.size());
+                stations.push_back(e.second);
+                keys.push_back(std::move(e.first));
+            }
+            hash.build(keys);
+        }
+
+        uint32_t find(const std::string& key) const {
+            uint32_t k = hash.candidate(key.data(), key.size());
+            if (k == PerfectHash::NONE || offsets[k + 1] - offsets[k] != key.size() ||
+                std::memcmp(chars.data() + offsets[k], key.data(), key.size()) != 0) {
+                return CompactGraph::NO_STATION;
+            }
+            return stations[k];
+        }
+    };
+
+    // Trie node. The edge into it is chars[label, label + labelLength);
+    // the names below it are sorted[first, last), of which the first
+    // `ending` end exactly here. Children are nodes[child, child + children).
+    struct Node {
+        uint32_t label;
+        uint32_t labelLength;
+        uint32_t first;
+        uint32_t last;
+        uint32_t ending;
+        uint32_t child;
+        uint32_t children;
+    };
+
+    ExactTable exact;
+    ExactTable byCode;
+    std::vector<std::string> codes;    // by station
+    std::string chars;                 // sorted bare names end to end
+    std::vector<uint32_t> nameOffsets; // into chars, per sorted name
+    std::vector<uint32_t> sorted;      // station of each sorted name
+    std::vector<Node> nodes;           // nodes[0] is the root
+
+    // Search scratch; the index is read-only, so searches keep it local.
+    struct Walk {
+        const std::string& query;
+        uint32_t k;
+        size_t limit;
+        bool prefix;
+        std::vector<int> rows; // edit-distance rows by depth
+        std::vector<std::vector<uint32_t>> found; // by edit count
+    };
+
+    static std::string upper(std::string s) {
+        for (char& c : s) {
+            c = (char)std::toupper((unsigned char)c);
+        }
+        return s;
+    }
+
+    uint32_t nameLength(uint32_t i) const {
+        return nameOffsets[i + 1] - nameOffsets[i];
+    }
+
+    void buildTrie(const std::vector<std::string>& bare, const std::vector<uint32_t>& byBare) {
+        uint32_t n = (uint32_t)byBare.size();
+        chars.clear();
+        nameOffsets.assign(1, 0);
+        sorted = byBare;
+        for (uint32_t v : sorted) {
+            chars += bare[v];
+            nameOffsets.push_back((uint32_t)chars.size());
+        }
+        nodes.assign(1, Node{0, 0, 0, n, 0, 0, 0});
+        fill(0, 0);
+    }
+
+    // Fills in the node covering sorted names that share their first
+    // `depth` characters.
+    void fill(uint32_t node, uint32_t depth) {
+        uint32_t i = nodes[node].first, last = nodes[node].last;
+        while (i < last && nameLength(i) == depth) {
+            i++;
+        }
+        nodes[node].ending = i - nodes[node].first;
+
+        std::vector<std::pair<uint32_t, uint32_t>> groups; // by next character
+        while (i < last) {
+            char c = chars[nameOffsets[i] + depth];
+            uint32_t j = i + 1;
+            while (j < last && chars[nameOffsets[j] + depth] == c) {
+                j++;
+            }
+            groups.emplace_back(i, j);
+            i = j;
+        }
+        nodes[node].child = (uint32_t)nodes.size();
+        nodes[node].children = (uint32_t)groups.size();
+        for (const std::pair<uint32_t, uint32_t>& grp : groups) {
+            // Sorted, so the group's common prefix is that of its first and
+            // last names.
+            const char* a = chars.data() + nameOffsets[grp.first] + depth;
+            const char* b = chars.data() + nameOffsets[grp.second - 1] + depth;
+            uint32_t most = std::min(nameLength(grp.first), nameLength(grp.second - 1)) - depth;
+            uint32_t common = 1;
+            while (common < most && a[common] == b[common]) {
+                common++;
+            }
+            nodes.push_back(Node{nameOffsets[grp.first] + depth, common, grp.first, grp.second, 0, 0, 0});
+        }
+        for (uint32_t c = 0; c < groups.size(); c++) {
+            uint32_t child = nodes[node].child + c;
+            fill(child, depth + nodes[child].labelLength);
+        }
+    }
+
+    void search(const std::string& text, uint32_t maxEdits, size_t limit, bool prefix,
+                std::vector<StationMatch>& out) const {
+        out.clear();
+        if (limit == 0 || nodes.empty()) {
+            return;
+        }
+        std::string query = foldStationName(text);
+        Walk w{query, std::min(maxEdits, (uint32_t)MAX_EDITS), limit, prefix, {}, {}};
+        w.found.resize(w.k + 1);
+        size_t width = query.size() + 1;
+        w.rows.resize(width);
+        for (size_t j = 0; j < width; j++) {
+            w.rows[j] = (int)j;
+        }
+        visit(w, 0, 0, prefix ? w.rows[query.size()] : INT_MAX);
+
+        for (uint32_t e = 0; e <= w.k && out.size() < limit; e++) {
+            for (uint32_t i : w.found[e]) {
+                if (out.size() == limit) {
+                    break;
+                }
+                out.push_back(StationMatch{sorted[i], e});
+            }
+        }
+    }
+
+    // Whether the bucket for e, and every closer one, already holds limit
+    // names; later names in alphabetical order cannot make the cut.
+    static bool full(const Walk& w, uint32_t e) {
+        for (uint32_t i = 0; i <= e && i <= w.k; i++) {
+            if (w.found[i].size() < w.limit) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    static void take(Walk& w, uint32_t first, uint32_t last, uint32_t e) {
+        std::vector<uint32_t>& bucket = w.found[e];
+        for (uint32_t i = first; i < last && bucket.size() < w.limit; i++) {
+            bucket.push_back(i);
+        }
+    }
+
+    // Row `depth` of w.rows is the edit distance from every prefix of the
+    // query to the name spelled down to this node. best is the least
+    // distance from the whole query to a prefix of that name so far.
+    void visit(Walk& w, uint32_t node, uint32_t depth, int best) const {
+        const Node& nd = nodes[node];
+        size_t width = w.query.size() + 1;
+        const int* row = w.rows.data() + depth * width;
+        if (w.prefix && best <= (int)w.k) {
+            if (best == 0 || full(w, best - 1)) {
+                take(w, nd.first, nd.last, best); // deeper names cannot do better
+                return;
+            }
+        }
+        int here = w.prefix ? best : row[w.query.size()];
+        if (here <= (int)w.k) {
+            take(w, nd.first, nd.first + nd.ending, here); // names ending at this node
+        }
+        if (full(w, w.k)) {
+            return;
+        }
+        int least = *std::min_element(row, row + width);
+        if (least > (int)w.k) {
+            if (w.prefix && best <= (int)w.k) {
+                take(w, nd.first + nd.ending, nd.last, best);
+            }
+            return;
+        }
+
+        for (uint32_t c = nd.child; c < nd.child + nd.children; c++) {
+            const Node& ch = nodes[c];
+            uint32_t d = depth;
+            int childBest = best;
+            bool alive = true;
+            for (uint32_t l = 0; l < ch.labelLength && alive; l++, d++) {
+                if (w.rows.size() < (d + 2) * width) {
+                    w.rows.resize((d + 2) * width);
+                }
+                const int* prev = w.rows.data() + d * width;
+                int* next = w.rows.data() + (d + 1) * width;
+                char x = chars[ch.label + l];
+                next[0] = prev[0] + 1;
+                int rowLeast = next[0];
+                for (size_t j = 1; j < width; j++) {
+                    int sub = prev[j - 1] + (w.query[j - 1] == x ? 0 : 1);
+                    next[j] = std::min(sub, std::min(prev[j], next[j - 1]) + 1);
+                    rowLeast = std::min(rowLeast, next[j]);
+                }
+                if (w.prefix) {
+                    childBest = std::min(childBest, next[width - 1]);
+                }
+                alive = rowLeast <= (int)w.k || (w.prefix && childBest <= (int)w.k);
+            }
+            if (alive) {
+                visit(w, c, depth + ch.labelLength, childBest);
+            }
+        }
+    }
+};
+
+#endif
@@ -0,0 +1,161 @@
+#ifndef METROPATH_THREAD_POOL_H
+#define METROPATH_THREAD_POOL_H
+
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Fixed set of worker threads running data-parallel loops. Each worker owns
+// a deque of index ranges; it takes work from the back of its own deque and,
+// once that is empty, steals from the front of the others. Uneven query
+// costs therefore balance out without a shared queue on the hot path.
+class ThreadPool {
+public:
+    // threads = 0 uses one worker per hardware thread.
+    explicit ThreadPool(unsigned threads = 0) {
+        if (threads == 0) {
+            threads = std::thread::hardware_concurrency();
+        }
+        if (threads == 0) {
+            threads = 1;
+        }
+        for (unsigned i = 0; i < threads; i++) {
+            queues.push_back(std::unique_ptr<Queue>(new Queue()));
+        }
+        for (unsigned i = 0; i < threads; i++) {
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+        }
+    }
+
+    ~ThreadPool() {
+        {
+            std::lock_guard<std::mutex> lock(m);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread& t : workers) {
+            t.join();
+        }
+    }
+
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    unsigned size() const {
+        return (unsigned)workers.size();
+    }
+
+    // Calls fn(worker, begin, end) over [0, count) in chunks of at most
+    // `grain` indices and blocks until every chunk has run. worker is in
+    // [0, size()) and identifies the calling thread, so fn can keep
+    // per-worker scratch state. Not reentrant: one loop at a time.
+    void parallelFor(size_t count, size_t grain,
+                     const std::function<void(unsigned, size_t, size_t)>& fn) {
+        if (count == 0) {
+            return;
+        }
+        if (grain == 0) {
+            grain = 1;
+        }
+
+        std::lock_guard<std::mutex> serial(loopMutex);
+        size_t chunks = (count + grain - 1) / grain;
+        for (size_t c = 0; c < chunks; c++) {
+            size_t begin = c * grain;
+            size_t end = begin + grain < count ? begin + grain : count;
+            Queue& q = *queues[c % queues.size()];
+            std::lock_guard<std::mutex> lock(q.m);
+            q.ranges.push_back(std::make_pair(begin, end));
+        }
+
+        std::unique_lock<std::mutex> lock(m);
+        job = &fn;
+        remaining = chunks;
+        generation++;
+        wake.notify_all();
+        finished.wait(lock, [this]() { return remaining == 0 && busy == 0; });
+        job = nullptr;
+    }
+
+private:
+    struct Queue {
+        std::mutex m;
+        std::deque<std::pair<size_t, size_t>> ranges;
+    };
+
+    std::vector<std::unique_ptr<Queue>> queues;
+    std::vector<std::thread> workers;
+
+    std::mutex loopMutex;
+    std::mutex m;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    const std::function<void(unsigned, size_t, size_t)>* job = nullptr;
+    size_t remaining = 0; // chunks not yet completed, guarded by m
+    unsigned busy = 0;    // workers inside the current loop, guarded by m
+    unsigned long long generation = 0;
+    bool stopping = false;
+
+    bool take(unsigned self, std::pair<size_t, size_t>& range) {
+        {
+            Queue& own = *queues[self];
+            std::lock_guard<std::mutex> lock(own.m);
+            if (!own.ranges.empty()) {
+                range = own.ranges.back();
+                own.ranges.pop_back();
+                return true;
+            }
+        }
+        for (size_t k = 1; k < queues.size(); k++) {
+            Queue& victim = *queues[(self + k) % queues.size()];
+            std::lock_guard<std::mutex> lock(victim.m);
+            if (!victim.ranges.empty()) {
+                range = victim.ranges.front();
+                victim.ranges.pop_front();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void workerLoop(unsigned self) {
+        unsigned long long seen = 0;
+        while (true) {
+            const std::function<void(unsigned, size_t, size_t)>* fn;
+            {
+                std::unique_lock<std::mutex> lock(m);
+                wake.wait(lock, [this, seen]() { return stopping || generation != seen; });
+                if (stopping) {
+                    return;
+                }
+                seen = generation;
+                fn = job;
+                busy++;
+            }
+
+            // A worker that wakes only after the loop has finished sees no
+            // job and must not take chunks queued for the next loop.
+            size_t done = 0;
+            std::pair<size_t, size_t> range;
+            while (fn != nullptr && take(self, range)) {
+                (*fn)(self, range.first, range.second);
+                done++;
+            }
+
+            std::lock_guard<std::mutex> lock(m);
+            remaining -= done;
+            busy--;
+            if (remaining == 0 && busy == 0) {
+                finished.notify_all();
+            }
+        }
+    }
+};
+
+#endif
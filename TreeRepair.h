@@ -0,0 +1,147 @@
+#ifndef METROPATH_TREE_REPAIR_H
+#define METROPATH_TREE_REPAIR_H
+
+#include <algorithm>
+#include <climits>
+#include <cstdint>
+#include <vector>
+#include "CompactGraph.h"
+#include "IndexedHeap.h"
+#include "ShortestPath.h"
+
+// Keeps a ShortestPathTree exact across single edge edits without sweeping
+// from the root again (dynamic SSSP). Edges are undirected, so g always
+// holds both arcs of an edge with the same weight.
+//
+// An added edge can only lower costs: the cheaper endpoint seeds a search
+// that spreads only while it keeps improving. A removed edge can only raise
+// costs, and only below it in the tree: that subtree is cut loose, each cut
+// vertex is re-seeded from its cheapest neighbour outside the cut, and a
+// search confined to the cut settles it again. Either way the work is
+// proportional to the part of the tree that changes.
+class TreeRepair {
+public:
+    // Call after edge u - v of weight w (in the tree's metric) was added;
+    // g must be the graph that has it.
+    void edgeAdded(const CompactGraph& g, ShortestPathTree& tree, uint32_t u, uint32_t v, int w) {
+        start(g);
+        seedAdded(tree, u, v, w);
+        seedAdded(tree, v, u, w);
+        propagate(g, tree, false);
+    }
+
+    // Call after edge u - v was removed; g must be the graph without it.
+    void edgeRemoved(const CompactGraph& g, ShortestPathTree& tree, uint32_t u, uint32_t v) {
+        uint32_t child;
+        if (tree.pred[v] == u) {
+            child = v;
+        } else if (tree.pred[u] == v) {
+            child = u;
+        } else {
+            touched = 0; // not a tree edge: no cost changes
+            return;
+        }
+        start(g);
+        const int* w = g.weights(tree.metric);
+
+        // Children of x are the neighbours whose predecessor is x; the
+        // removed edge is already gone from g, so this stays in the subtree.
+        cut.clear();
+        cut.push_back(child);
+        inCut[child] = stamp;
+        for (size_t i = 0; i < cut.size(); i++) {
+            uint32_t x = cut[i];
+            for (uint32_t a = g.begin(x); a < g.end(x); a++) {
+                uint32_t y = g.targets[a];
+                if (tree.pred[y] == x && inCut[y] != stamp) {
+                    inCut[y] = stamp;
+                    cut.push_back(y);
+                }
+            }
+        }
+        for (uint32_t x : cut) {
+            tree.cost[x] = INT_MAX;
+            tree.pred[x] = CompactGraph::NO_STATION;
+        }
+
+        for (uint32_t x : cut) {
+            for (uint32_t a = g.begin(x); a < g.end(x); a++) {
+                uint32_t y = g.targets[a];
+                if (inCut[y] != stamp && tree.cost[y] != INT_MAX && tree.cost[y] + w[a] < tree.cost[x]) {
+                    tree.cost[x] = tree.cost[y] + w[a];
+                    tree.pred[x] = y;
+                }
+            }
+            if (tree.cost[x] != INT_MAX) {
+                heap.add(x, tree.cost[x]);
+            }
+        }
+        touched = (uint32_t)cut.size();
+        propagate(g, tree, true);
+    }
+
+    // Vertices whose entry was reset or lowered by the last repair.
+    uint32_t touchedCount() const {
+        return touched;
+    }
+
+private:
+    IndexedHeap<int> heap;
+    std::vector<uint32_t> inCut; // == stamp marks the cut subtree
+    std::vector<uint32_t> cut;
+    uint32_t stamp = 0;
+    uint32_t touched = 0;
+
+    void start(const CompactGraph& g) {
+        uint32_t n = g.numVertex();
+        if (heap.capacity() != n) {
+            heap.resize(n);
+            inCut.assign(n, 0);
+            stamp = 0;
+        } else {
+            heap.clear();
+        }
+        if (++stamp == 0) {
+            std::fill(inCut.begin(), inCut.end(), 0);
+            stamp = 1;
+        }
+        touched = 0;
+    }
+
+    void seedAdded(ShortestPathTree& tree, uint32_t from, uint32_t to, int w) {
+        if (tree.cost[from] != INT_MAX && tree.cost[from] + w < tree.cost[to]) {
+            tree.cost[to] = tree.cost[from] + w;
+            tree.pred[to] = from;
+            heap.addOrUpdate(to, tree.cost[to]);
+            touched++;
+        }
+    }
+
+    // Dijkstra from the queued vertices. When confined, only vertices of
+    // the cut are relaxed; every other cost is known to be unchanged.
+    void propagate(const CompactGraph& g, ShortestPathTree& tree, bool confined) {
+        const int* w = g.weights(tree.metric);
+        while (!heap.isEmpty()) {
+            uint32_t x;
+            int cost;
+            heap.remove(x, cost);
+            for (uint32_t a = g.begin(x); a < g.end(x); a++) {
+                uint32_t y = g.targets[a];
+                if (confined && inCut[y] != stamp) {
+                    continue;
+                }
+                int nc = cost + w[a];
+                if (nc < tree.cost[y]) {
+                    if (!confined && !heap.contains(y)) {
+                        touched++;
+                    }
+                    tree.cost[y] = nc;
+                    tree.pred[y] = x;
+                    heap.addOrUpdate(y, nc);
+                }
+            }
+        }
+    }
+};
+
+#endif
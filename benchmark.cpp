@@ -0,0 +1,731 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <new>
+#include <random>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+#define METROPATH_COUNT_ALLOCATIONS
+#define METROPATH_NO_MAIN
+#include "Graph_M.cpp"
+using namespace std;
+
+// Benchmarks the Graph_M queries and graph construction on the Kolkata map
+// and on generated networks, and writes the results as JSON so runs can be
+// compared across releases.
+//
+//   benchmark [--networks kolkata,grid,radial,lines] [--sizes 100,1000,...]
+//             [--network FILE] [--min-time SECONDS] [--max-iterations N]
+//             [--filter TEXT] [--seed N] [--cache] [--out FILE]
+//             [--instrument] [--trace FILE] [--metrics FILE] [--verify]
+//
+// Every benchmark repeats until --min-time has passed (or --max-iterations
+// is reached), and always runs at least once. Each iteration is timed on
+// its own, giving latency percentiles; allocations are counted through
+// METROPATH_COUNT_ALLOCATIONS (Instrumentation.h). The route cache is off
+// unless --cache is given, so repeated pairs measure the search rather
+// than the cache. A progress table goes to stderr, the JSON to stdout or
+// --out. --instrument runs the queries with Graph_M instrumentation on, to
+// measure what it costs; --trace and --metrics (which imply it) also write
+// what it recorded.
+//
+// --verify times nothing: it checks the engines that are easiest to get
+// subtly wrong against plain Dijkstra on the same networks, reports any
+// mismatch to stderr and exits 1 if there was one. Networks above
+// VERIFY_STATIONS are skipped, since it builds a hierarchy for each.
+//
+// Build alongside the main binary:
+//   g++ -std=c++11 -O2 -pthread benchmark.cpp -o benchmark
+
+typedef chrono::steady_clock Clock;
+
+struct Settings {
+    vector<string> networks{"kolkata", "grid", "radial", "lines"};
+    vector<uint32_t> sizes{100, 1000, 10000, 100000, 1000000};
+    string networkFile;
+    double minTime = 1.0;
+    uint64_t maxIterations = 100000;
+    string filter;
+    unsigned seed = 1;
+    bool cache = false;
+    bool instrument = false;
+    bool verify = false;
+    string out;
+    string trace;
+    string metrics;
+};
+
+// A generated network in the form Graph_M is built from.
+struct Network {
+    string kind;
+    vector<string> names;
+    struct Edge {
+        uint32_t u, v;
+        int km;
+    };
+    vector<Edge> edges;
+};
+
+struct Result {
+    string name;
+    string network;
+    uint32_t stations = 0;
+    uint64_t iterations = 0;
+    double seconds = 0;
+    vector<double> latencies; // microseconds, sorted
+    uint64_t allocations = 0;
+    uint64_t bytes = 0;
+};
+
+static int usage() {
+    cerr << "usage: benchmark [--networks kolkata,grid,radial,lines] [--sizes 100,1000,...]\n"
+         << "                 [--network FILE] [--min-time SECONDS] [--max-iterations N]\n"
+         << "                 [--filter TEXT] [--seed N] [--cache] [--out FILE]\n"
+         << "                 [--instrument] [--trace FILE] [--metrics FILE] [--verify]" << endl;
+    return 2;
+}
+
+static vector<string> splitList(const string& list) {
+    vector<string> items;
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+// Line letters of a station: one per line serving it.
+static string lineCode(uint32_t lines) {
+    string code;
+    for (uint32_t l = 0; l < 26; l++) {
+        if (lines & (1u << l)) {
+            code += (char)('A' + l);
+        }
+    }
+    return code;
+}
+
+// Square grid. Each row and each column is a line, so going round a corner
+// means changing lines.
+static void makeGrid(uint32_t n, mt19937& rng, Network& net) {
+    uint32_t w = max(2u, (uint32_t)(sqrt((double)n) + 0.5));
+    for (uint32_t r = 0; r < w; r++) {
+        for (uint32_t c = 0; c < w; c++) {
+            uint32_t lines = 1u << (r % 13) | 1u << (13 + c % 13);
+            net.names.push_back("G" + to_string(r) + "-" + to_string(c) + "~" + lineCode(lines));
+        }
+    }
+    for (uint32_t r = 0; r < w; r++) {
+        for (uint32_t c = 0; c < w; c++) {
+            uint32_t v = r * w + c;
+            if (c + 1 < w) {
+                net.edges.push_back(Network::Edge{v, v + 1, (int)(1 + rng() % 4)});
+            }
+            if (r + 1 < w) {
+                net.edges.push_back(Network::Edge{v, v + w, (int)(1 + rng() % 4)});
+            }
+        }
+    }
+}
+
+// Spokes out of a central hub, crossed by ring lines every few stops.
+static void makeRadial(uint32_t n, mt19937& rng, Network& net) {
+    uint32_t spokes = min(24u, max(4u, (uint32_t)sqrt((double)n) / 4));
+    uint32_t length = max(1u, (n - 1) / spokes);
+    uint32_t ringGap = max(2u, length / 8);
+    net.names.push_back("Hub~" + lineCode((1u << spokes) - 1));
+    for (uint32_t s = 0; s < spokes; s++) {
+        for (uint32_t d = 1; d <= length; d++) {
+            uint32_t lines = 1u << s;
+            if (d % ringGap == 0) {
+                lines |= 1u << (24 + d / ringGap % 2);
+            }
+            net.names.push_back("R" + to_string(s) + "-" + to_string(d) + "~" + lineCode(lines));
+        }
+    }
+    for (uint32_t s = 0; s < spokes; s++) {
+        for (uint32_t d = 1; d <= length; d++) {
+            uint32_t v = 1 + s * length + (d - 1);
+            net.edges.push_back(Network::Edge{d == 1 ? 0 : v - 1, v, (int)(1 + rng() % 3)});
+            if (d % ringGap == 0) {
+                uint32_t next = 1 + (s + 1) % spokes * length + (d - 1);
+                net.edges.push_back(Network::Edge{v, next, (int)(1 + d / ringGap + rng() % 3)});
+            }
+        }
+    }
+}
+
+// Lines threaded through a shared pool of stations: every station is on one
+// line and some are interchanges with a second.
+static void makeLines(uint32_t n, mt19937& rng, Network& net) {
+    const uint32_t lineCount = min(24u, max(2u, n / 20));
+    vector<uint32_t> lines(n);
+    for (uint32_t v = 0; v < n; v++) {
+        lines[v] = 1u << (v % lineCount);
+        if (rng() % 6 == 0) {
+            lines[v] |= 1u << (rng() % lineCount);
+        }
+        net.names.push_back("L" + to_string(v) + "~" + lineCode(lines[v]));
+    }
+    vector<uint32_t> last(lineCount, UINT32_MAX);
+    for (uint32_t v = 0; v < n; v++) {
+        for (uint32_t l = 0; l < lineCount; l++) {
+            if (lines[v] & (1u << l)) {
+                if (last[l] != UINT32_MAX) {
+                    net.edges.push_back(Network::Edge{last[l], v, (int)(1 + rng() % 4)});
+                }
+                last[l] = v;
+            }
+        }
+    }
+}
+
+static void build(const Network& net, Graph_M& g) {
+    for (const string& name : net.names) {
+        g.addVertex(name);
+    }
+    for (const Network::Edge& e : net.edges) {
+        g.addEdge(net.names[e.u], net.names[e.v], e.km);
+    }
+    g.freeze();
+}
+
+class Runner {
+public:
+    explicit Runner(const Settings& s) : settings(s) {}
+
+    // Times op(i) for i = 0, 1, ... until the minimum time has passed.
+    // Whether the benchmark passes --filter.
+    bool selected(const string& name, const string& network, uint32_t stations) const {
+        string full = name + "/" + network + "/" + to_string(stations);
+        return settings.filter.empty() || full.find(settings.filter) != string::npos;
+    }
+
+    template <typename Op>
+    void run(const string& name, const string& network, uint32_t stations, Op op) {
+        string full = name + "/" + network + "/" + to_string(stations);
+        if (!selected(name, network, stations)) {
+            return;
+        }
+        Result r;
+        r.name = full;
+        r.network = network;
+        r.stations = stations;
+        uint64_t allocs = allocationCount().load(memory_order_relaxed);
+        uint64_t bytes = allocatedBytes().load(memory_order_relaxed);
+        Clock::time_point start = Clock::now();
+        while (r.iterations < settings.maxIterations &&
+               (r.iterations == 0 || r.seconds < settings.minTime)) {
+            Clock::time_point a = Clock::now();
+            op(r.iterations);
+            Clock::time_point b = Clock::now();
+            r.latencies.push_back(chrono::duration<double, micro>(b - a).count());
+            r.seconds = chrono::duration<double>(b - start).count();
+            r.iterations++;
+        }
+        r.allocations = allocationCount().load(memory_order_relaxed) - allocs;
+        r.bytes = allocatedBytes().load(memory_order_relaxed) - bytes;
+        sort(r.latencies.begin(), r.latencies.end());
+
+        fprintf(stderr, "%-36s %8llu it  p50 %10.1f us  p99 %10.1f us  %9.1f allocs/it\n", full.c_str(),
+                (unsigned long long)r.iterations, percentile(r, 0.50), percentile(r, 0.99),
+                (double)r.allocations / r.iterations);
+        results.push_back(move(r));
+    }
+
+    static double percentile(const Result& r, double p) {
+        if (r.latencies.empty()) {
+            return 0;
+        }
+        return r.latencies[min(r.latencies.size() - 1, (size_t)(p * r.latencies.size()))];
+    }
+
+    void writeJson(ostream& out) const {
+        char date[64];
+        time_t now = time(nullptr);
+        strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%S", localtime(&now));
+        out << "{\n  \"context\": {\"date\": \"" << date << "\", \"num_cpus\": "
+            << thread::hardware_concurrency() << ", \"seed\": " << settings.seed
+            << ", \"min_time\": " << settings.minTime << ", \"route_cache\": "
+            << (settings.cache ? "true" : "false") << ", \"instrumented\": "
+            << (settings.instrument ? "true" : "false") << "},\n  \"benchmarks\": [";
+        for (size_t i = 0; i < results.size(); i++) {
+            const Result& r = results[i];
+            double mean = 0;
+            for (double l : r.latencies) {
+                mean += l;
+            }
+            mean /= r.iterations;
+            out << (i ? ",\n" : "\n") << "    {\"name\": \"" << r.name << "\", \"network\": \"" << r.network
+                << "\", \"stations\": " << r.stations << ", \"iterations\": " << r.iterations
+                << ", \"time_unit\": \"us\", \"mean\": " << mean << ", \"p50\": " << percentile(r, 0.50)
+                << ", \"p90\": " << percentile(r, 0.90) << ", \"p99\": " << percentile(r, 0.99)
+                << ", \"max\": " << r.latencies.back() << ", \"items_per_second\": " << r.iterations / r.seconds
+                << ", \"allocs_per_iteration\": " << (double)r.allocations / r.iterations
+                << ", \"bytes_per_iteration\": " << (double)r.bytes / r.iterations << "}";
+        }
+        out << "\n  ]\n}" << endl;
+    }
+
+private:
+    const Settings& settings;
+    vector<Result> results;
+};
+
+// The query benchmarks, on random station pairs drawn up front.
+static void benchQueries(Runner& runner, Graph_M& g, const string& network, mt19937& rng) {
+    vector<string> names = g.getKeys();
+    uint32_t n = (uint32_t)names.size();
+    vector<pair<string, string>> pairs(1024);
+    for (auto& p : pairs) {
+        p.first = names[rng() % n];
+        p.second = names[rng() % n];
+    }
+    auto at = [&pairs](uint64_t i) -> const pair<string, string>& {
+        return pairs[i % pairs.size()];
+    };
+    g.Get_Minimum_Distance(pairs[0].first, pairs[0].second); // builds the line graph
+
+    runner.run("dijkstra_distance", network, n, [&](uint64_t i) {
+        g.dijkstra(at(i).first, at(i).second, false);
+    });
+    runner.run("dijkstra_time", network, n, [&](uint64_t i) {
+        g.dijkstra(at(i).first, at(i).second, true);
+    });
+    Route route; // reused, as a caller keeping one per thread would
+    runner.run("get_minimum_distance", network, n, [&](uint64_t i) {
+        g.Get_Minimum_Distance(at(i).first, at(i).second, route);
+    });
+    runner.run("get_minimum_time", network, n, [&](uint64_t i) {
+        g.Get_Minimum_Time(at(i).first, at(i).second, route);
+    });
+    runner.run("has_path", network, n, [&](uint64_t i) {
+        g.hasPath(at(i).first, at(i).second);
+    });
+
+    vector<Route> routes;
+    for (size_t i = 0; i < 64; i++) {
+        Route r = g.Get_Minimum_Time(pairs[i].first, pairs[i].second);
+        if (r.found()) {
+            routes.push_back(r);
+        }
+    }
+    if (!routes.empty()) {
+        runner.run("get_interchanges", network, n, [&](uint64_t i) {
+            g.get_Interchanges(routes[i % routes.size()]);
+        });
+    }
+}
+
+// Distance tables from 64 sources: a oneToAll sweep per source copied into
+// the table, as callers did before distanceTable, against distanceTable
+// with each sweep kernel the CPU supports. Skipped above TABLE_STATIONS,
+// where building the contraction hierarchy takes minutes.
+static void benchTables(Runner& runner, Graph_M& g, const string& network, mt19937& rng) {
+    const uint32_t TABLE_STATIONS = 200000;
+    const SweepKernel kernels[] = {SweepKernel::Scalar, SweepKernel::AVX2, SweepKernel::AVX512};
+    vector<string> names = g.getKeys();
+    uint32_t n = (uint32_t)names.size();
+    if (n > TABLE_STATIONS) {
+        return;
+    }
+    bool any = runner.selected("distance_table_per_source", network, n);
+    for (SweepKernel k : kernels) {
+        any = any || runner.selected(string("distance_table_") + ManySourceSweep::kernelName(k), network, n);
+    }
+    if (!any) {
+        return; // spares building the hierarchy
+    }
+
+    vector<string> sources(64);
+    for (string& src : sources) {
+        src = names[rng() % n];
+    }
+    vector<int> table(sources.size() * n);
+    runner.run("distance_table_per_source", network, n, [&](uint64_t) {
+        for (size_t i = 0; i < sources.size(); i++) {
+            ShortestPathTree tree = g.oneToAll(sources[i], Metric::Distance);
+            copy(tree.cost.begin(), tree.cost.end(), table.begin() + i * n);
+        }
+    });
+
+    g.distanceTable(sources, Metric::Distance, table); // builds the hierarchy
+    for (SweepKernel k : kernels) {
+        if ((int)k > (int)ManySourceSweep::bestKernel()) {
+            continue;
+        }
+        g.setSweepKernel(k);
+        runner.run(string("distance_table_") + ManySourceSweep::kernelName(k), network, n, [&](uint64_t) {
+            g.distanceTable(sources, Metric::Distance, table);
+        });
+    }
+    g.setSweepKernel(ManySourceSweep::bestKernel());
+}
+
+// An edge edit with a live tree attached, closing a random segment and
+// reopening it, against the fresh sweep the repair saves. Each iteration
+// is the whole edit as a caller sees it: builder, compact graph, published
+// version and tree repair. Runs last, as the live tree stays attached.
+static void benchEdits(Runner& runner, Graph_M& g, const string& network, mt19937& rng) {
+    vector<string> names = g.getKeys();
+    uint32_t n = (uint32_t)names.size();
+    if (!runner.selected("edit_live_tree", network, n) && !runner.selected("one_to_all", network, n)) {
+        return;
+    }
+    const CompactGraph& c = g.compact();
+    vector<Network::Edge> edges;
+    for (int i = 0; i < 1024 && c.numArcs() > 0; i++) {
+        uint32_t a = rng() % c.numArcs();
+        uint32_t u = (uint32_t)(upper_bound(c.offsets.data(), c.offsets.data() + n + 1, a) - c.offsets.data()) - 1;
+        edges.push_back(Network::Edge{u, c.targets[a], c.distance[a]});
+    }
+    if (edges.empty()) {
+        return;
+    }
+    string root = names[rng() % n];
+
+    runner.run("one_to_all", network, n, [&](uint64_t) {
+        g.oneToAll(root, Metric::Distance);
+    });
+    g.liveTree(root, Metric::Distance);
+    runner.run("edit_live_tree", network, n, [&](uint64_t i) {
+        const Network::Edge& e = edges[i % edges.size()];
+        g.removeEdge(names[e.u], names[e.v]);
+        g.addEdge(names[e.u], names[e.v], e.km);
+    });
+}
+
+const uint32_t VERIFY_STATIONS = 100000;
+
+// Empty if route runs from s to t over edges of g, each leg weighing what
+// its edge does in the route's metric, and costs cost in total (no
+// stations at all if cost is INT_MAX); otherwise what is wrong with it.
+static string routeProblem(const CompactGraph& g, const Route& route, uint32_t s, uint32_t t, int cost) {
+    if (route.cost != cost) {
+        return "cost " + to_string(route.cost) + ", Dijkstra says " + to_string(cost);
+    }
+    if (cost == INT_MAX) {
+        return route.found() ? "stations on a route to an unreachable station" : "";
+    }
+    if (!route.found() || route.stations.front() != s || route.stations.back() != t) {
+        return "does not run from source to destination";
+    }
+    if (route.legs.size() + 1 != route.stations.size()) {
+        return to_string(route.legs.size()) + " legs for " + to_string(route.stations.size()) + " stations";
+    }
+    const int* w = g.weights(route.metric);
+    long long total = 0;
+    for (size_t i = 0; i < route.legs.size(); i++) {
+        uint32_t a = g.arc(route.stations[i], route.stations[i + 1]);
+        if (a == CompactGraph::NO_STATION) {
+            return "leg " + to_string(i) + " is not an edge";
+        }
+        if (w[a] != route.legs[i]) {
+            return "leg " + to_string(i) + " weighs " + to_string(route.legs[i]) + ", its edge " + to_string(w[a]);
+        }
+        total += route.legs[i];
+    }
+    return total == cost ? "" : "legs add up to " + to_string(total);
+}
+
+// Every point-to-point engine against a Dijkstra tree from the same
+// source: the cost, and the route each one unpacks (for CH, the
+// shortcuts expanded back into real edges). Returns the mismatches.
+static uint64_t verifyEngines(Graph_M& g, const string& network, mt19937& rng) {
+    const SearchMode modes[] = {SearchMode::Bidirectional, SearchMode::ALT, SearchMode::CH};
+    const char* modeNames[] = {"bidirectional", "alt", "ch"};
+    vector<string> names = g.getKeys();
+    uint32_t n = (uint32_t)names.size();
+    uint64_t checked = 0, wrong = 0;
+    for (int m = 0; m < 2; m++) {
+        Metric metric = (Metric)m;
+        for (int i = 0; i < 32; i++) {
+            const string& src = names[rng() % n];
+            ShortestPathTree tree = g.oneToAll(src, metric);
+            for (int j = 0; j < 16; j++) {
+                const string& dst = names[rng() % n];
+                uint32_t t = g.stationId(dst);
+                for (int k = 0; k < 3; k++) {
+                    Route route = g.shortestPath(src, dst, metric, modes[k]);
+                    string problem = routeProblem(g.compact(), route, tree.root, t, tree.cost[t]);
+                    checked++;
+                    if (!problem.empty() && wrong++ < 10) {
+                        fprintf(stderr, "  %s %s %s -> %s: %s\n", modeNames[k], m ? "time" : "distance",
+                                src.c_str(), dst.c_str(), problem.c_str());
+                    }
+                }
+            }
+        }
+    }
+    fprintf(stderr, "%-36s %8llu routes  %llu wrong\n", ("verify_engines/" + network + "/" + to_string(n)).c_str(),
+            (unsigned long long)checked, (unsigned long long)wrong);
+    return wrong;
+}
+
+// distanceTable with every sweep kernel the CPU runs against one Dijkstra
+// sweep per source. The sources are a few lane groups and a partial one,
+// with unknown stations (rows of INT_MAX) mixed in.
+static uint64_t verifyKernels(Graph_M& g, const string& network, mt19937& rng) {
+    const SweepKernel kernels[] = {SweepKernel::Scalar, SweepKernel::AVX2, SweepKernel::AVX512};
+    vector<string> names = g.getKeys();
+    uint32_t n = (uint32_t)names.size();
+    vector<string> sources(2 * ManySourceSweep::LANES + 5);
+    for (string& src : sources) {
+        src = rng() % 8 == 0 ? "no such station" : names[rng() % n];
+    }
+    vector<int> expected(sources.size() * n);
+    for (size_t i = 0; i < sources.size(); i++) {
+        ShortestPathTree tree = g.oneToAll(sources[i], Metric::Distance);
+        for (uint32_t v = 0; v < n; v++) {
+            expected[i * n + v] = tree.cost.empty() ? INT_MAX : tree.cost[v];
+        }
+    }
+
+    uint64_t checked = 0, wrong = 0;
+    vector<int> table;
+    for (SweepKernel k : kernels) {
+        if ((int)k > (int)ManySourceSweep::bestKernel()) {
+            continue;
+        }
+        g.setSweepKernel(k);
+        g.distanceTable(sources, Metric::Distance, table);
+        checked++;
+        for (size_t i = 0; i < table.size(); i++) {
+            if (table[i] != expected[i]) {
+                wrong++;
+                fprintf(stderr, "  %s kernel: %s -> %s costs %d, Dijkstra says %d\n", ManySourceSweep::kernelName(k),
+                        sources[i / n].c_str(), names[i % n].c_str(), table[i], expected[i]);
+                break;
+            }
+        }
+    }
+    g.setSweepKernel(ManySourceSweep::bestKernel());
+    fprintf(stderr, "%-36s %8llu kernels %llu wrong\n", ("verify_kernels/" + network + "/" + to_string(n)).c_str(),
+            (unsigned long long)checked, (unsigned long long)wrong);
+    return wrong;
+}
+
+// Live trees (TreeRepair.h) through random edge removals and insertions,
+// each checked after every edit against a fresh sweep: the same costs, and
+// predecessors that form a shortest-path tree of the edited graph.
+static uint64_t verifyTreeRepair(Graph_M& g, const string& network, mt19937& rng) {
+    vector<string> names = g.getKeys();
+    uint32_t n = (uint32_t)names.size();
+    vector<string> roots;
+    for (int i = 0; i < 3; i++) {
+        roots.push_back(names[rng() % n]);
+        g.liveTree(roots.back(), Metric::Distance);
+        g.liveTree(roots.back(), Metric::Time);
+    }
+    uint64_t edits = 0, wrong = 0;
+    for (int e = 0; e < 60; e++) {
+        const CompactGraph& before = g.compact();
+        uint32_t u = rng() % n;
+        for (int tries = 0; tries < 8 && before.begin(u) == before.end(u); tries++) {
+            u = rng() % n;
+        }
+        if (rng() % 2 && before.begin(u) != before.end(u)) {
+            uint32_t a = before.begin(u) + rng() % (before.end(u) - before.begin(u));
+            g.removeEdge(names[u], before.names[before.targets[a]]);
+        } else {
+            g.addEdge(names[u], names[rng() % n], (int)(1 + rng() % 5));
+        }
+        edits++;
+
+        const CompactGraph& c = g.compact();
+        for (const string& root : roots) {
+            for (int m = 0; m < 2; m++) {
+                shared_ptr<const ShortestPathTree> live = g.liveTree(root, (Metric)m);
+                ShortestPathTree fresh = g.oneToAll(root, (Metric)m);
+                const int* w = c.weights((Metric)m);
+                string problem;
+                for (uint32_t v = 0; v < c.numVertex() && problem.empty(); v++) {
+                    uint32_t p = live->pred[v];
+                    if (live->cost[v] != fresh.cost[v]) {
+                        problem = "cost of " + c.names[v] + " is " + to_string(live->cost[v]) +
+                                  ", Dijkstra says " + to_string(fresh.cost[v]);
+                    } else if (v == live->root || fresh.cost[v] == INT_MAX) {
+                        if (p != CompactGraph::NO_STATION) {
+                            problem = "predecessor on " + c.names[v];
+                        }
+                    } else if (p == CompactGraph::NO_STATION || c.arc(p, v) == CompactGraph::NO_STATION ||
+                               live->cost[p] + w[c.arc(p, v)] != live->cost[v]) {
+                        problem = "predecessor of " + c.names[v] + " is not on a shortest path";
+                    }
+                }
+                if (!problem.empty() && wrong++ < 10) {
+                    fprintf(stderr, "  edit %d, tree from %s (%s): %s\n", e, root.c_str(), m ? "time" : "distance",
+                            problem.c_str());
+                }
+            }
+        }
+    }
+    fprintf(stderr, "%-36s %8llu edits   %llu wrong\n", ("verify_tree_repair/" + network + "/" + to_string(n)).c_str(),
+            (unsigned long long)edits, (unsigned long long)wrong);
+    return wrong;
+}
+
+// All the --verify checks on one network; the tree repair check edits it.
+static uint64_t verify(Graph_M& g, const string& network, mt19937& rng) {
+    return verifyEngines(g, network, rng) + verifyKernels(g, network, rng) + verifyTreeRepair(g, network, rng);
+}
+
+int main(int argc, char* argv[]) {
+    Settings s;
+    for (int i = 1; i < argc; i++) {
+        string flag = argv[i];
+        if (flag == "--cache" || flag == "--instrument" || flag == "--verify") {
+            (flag == "--cache" ? s.cache : flag == "--instrument" ? s.instrument : s.verify) = true;
+            continue;
+        }
+        if (i + 1 >= argc) {
+            return usage();
+        }
+        string value = argv[++i];
+        if (flag == "--networks") {
+            s.networks = splitList(value);
+        } else if (flag == "--sizes") {
+            s.sizes.clear();
+            for (const string& size : splitList(value)) {
+                s.sizes.push_back((uint32_t)max(4L, atol(size.c_str())));
+            }
+        } else if (flag == "--network") {
+            s.networkFile = value;
+        } else if (flag == "--min-time") {
+            s.minTime = atof(value.c_str());
+        } else if (flag == "--max-iterations") {
+            s.maxIterations = max(1ULL, strtoull(value.c_str(), nullptr, 10));
+        } else if (flag == "--filter") {
+            s.filter = value;
+        } else if (flag == "--seed") {
+            s.seed = (unsigned)atoi(value.c_str());
+        } else if (flag == "--out") {
+            s.out = value;
+        } else if (flag == "--trace") {
+            s.trace = value;
+            s.instrument = true;
+        } else if (flag == "--metrics") {
+            s.metrics = value;
+            s.instrument = true;
+        } else {
+            return usage();
+        }
+    }
+
+    Runner runner(s);
+    mt19937 rng(s.seed);
+    uint64_t failures = 0;
+
+    if (!s.networkFile.empty()) {
+        Graph_M g;
+        string error;
+        if (!g.loadAny(s.networkFile, error)) {
+            cerr << error << endl;
+            return 1;
+        }
+        g.setRouteCaching(s.cache);
+        g.setInstrumentation(s.instrument);
+        if (s.verify) {
+            failures += verify(g, "file", rng);
+        } else {
+            benchQueries(runner, g, "file", rng);
+            benchTables(runner, g, "file", rng);
+            benchEdits(runner, g, "file", rng);
+        }
+    }
+
+    for (const string& kind : s.networks) {
+        if (kind == "kolkata") {
+            unique_ptr<Graph_M> g(new Graph_M);
+            Graph_M::Create_Metro_Map(*g);
+            if (s.verify) {
+                failures += verify(*g, kind, rng);
+                continue;
+            }
+            runner.run("build", kind, (uint32_t)g->numVertex(), [&g](uint64_t) {
+                g.reset(new Graph_M);
+                Graph_M::Create_Metro_Map(*g);
+            });
+            g->setRouteCaching(s.cache);
+            g->setInstrumentation(s.instrument);
+            benchQueries(runner, *g, kind, rng);
+            benchTables(runner, *g, kind, rng);
+            benchEdits(runner, *g, kind, rng);
+            continue;
+        }
+        if (kind != "grid" && kind != "radial" && kind != "lines") {
+            cerr << "unknown network kind: " << kind << endl;
+            return usage();
+        }
+        for (uint32_t size : s.sizes) {
+            Network net;
+            net.kind = kind;
+            if (kind == "grid") {
+                makeGrid(size, rng, net);
+            } else if (kind == "radial") {
+                makeRadial(size, rng, net);
+            } else {
+                makeLines(size, rng, net);
+            }
+            uint32_t n = (uint32_t)net.names.size();
+            if (s.verify && n > VERIFY_STATIONS) {
+                fprintf(stderr, "skipping verify on %s/%u: over %u stations\n", kind.c_str(), n, VERIFY_STATIONS);
+                continue;
+            }
+            unique_ptr<Graph_M> g;
+            if (!s.verify) {
+                runner.run("build", kind, n, [&](uint64_t) {
+                    g.reset();
+                    g.reset(new Graph_M);
+                    build(net, *g);
+                });
+            }
+            if (!g) { // --filter skipped the build benchmark
+                g.reset(new Graph_M);
+                build(net, *g);
+            }
+            net = Network(); // the graph has its own copy
+            g->setRouteCaching(s.cache);
+            g->setInstrumentation(s.instrument);
+            if (s.verify) {
+                failures += verify(*g, kind, rng);
+                continue;
+            }
+            benchQueries(runner, *g, kind, rng);
+            benchTables(runner, *g, kind, rng);
+            benchEdits(runner, *g, kind, rng);
+        }
+    }
+    if (s.verify) {
+        return failures == 0 ? 0 : 1;
+    }
+
+    if (!s.trace.empty()) {
+        ofstream out(s.trace);
+        TraceLog::instance().writeChromeTrace(out);
+    }
+    if (!s.metrics.empty()) {
+        ofstream out(s.metrics);
+        MetricsRegistry::instance().writePrometheus(out);
+    }
+    if (s.out.empty()) {
+        runner.writeJson(cout);
+    } else {
+        ofstream out(s.out);
+        runner.writeJson(out);
+        if (!out) {
+            cerr << s.out << ": cannot write results" << endl;
+            return 1;
+        }
+    }
+    return 0;
+}
@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "Server.h"
+using namespace std;
+
+// Load generator for `metro --serve`. Each connection keeps a fixed number
+// of requests in flight between random station pairs and times every
+// response.
+//
+//   loadgen <endpoint> [--connections N] [--pipeline D] [--requests TOTAL]
+//                      [--metric distance|time] [--type route|cost]
+//
+// Build alongside the main binary:
+//   g++ -std=c++11 -O2 -pthread loadgen.cpp -o loadgen
+
+typedef chrono::steady_clock Clock;
+
+struct Settings {
+    Endpoint endpoint;
+    unsigned connections = 4;
+    unsigned pipeline = 32;
+    uint64_t requests = 100000;
+    string metric = "distance";
+    string type = "route";
+};
+
+struct ConnectionResult {
+    vector<uint32_t> latencies; // microseconds
+    uint64_t errors = 0;
+    string failure;
+};
+
+static int usage() {
+    cerr << "usage: loadgen <endpoint> [--connections N] [--pipeline D] [--requests TOTAL]\n"
+         << "               [--metric distance|time] [--type route|cost]" << endl;
+    return 2;
+}
+
+static bool sendAll(int fd, const string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        sent += (size_t)n;
+    }
+    return true;
+}
+
+// Asks the server for its station list (a "stations" request).
+static bool fetchStations(const Endpoint& e, vector<string>& names, string& error) {
+    int fd = connectTo(e, error);
+    if (fd < 0) {
+        return false;
+    }
+    string reply;
+    char buf[65536];
+    bool ok = sendAll(fd, "{\"type\": \"stations\"}\n");
+    while (ok && reply.find('\n') == string::npos) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            ok = false;
+            break;
+        }
+        reply.append(buf, (size_t)n);
+    }
+    close(fd);
+    size_t list = reply.find("\"stations\": [");
+    if (!ok || list == string::npos) {
+        error = "no station list from server";
+        return false;
+    }
+    // Names are JSON strings; only \" and \\ escapes are expected in them.
+    for (size_t p = list + 13; p < reply.size() && reply[p] != ']';) {
+        if (reply[p] != '"') {
+            p++;
+            continue;
+        }
+        string name;
+        for (p++; p < reply.size() && reply[p] != '"'; p++) {
+            if (reply[p] == '\\' && p + 1 < reply.size()) {
+                p++;
+            }
+            name += reply[p];
+        }
+        names.push_back(name);
+        p++;
+    }
+    if (names.size() < 2) {
+        error = "server has fewer than two stations";
+        return false;
+    }
+    return true;
+}
+
+static void appendRequest(string& out, uint64_t id, const string& from, const string& to, const Settings& s) {
+    out += "{\"id\": ";
+    out += to_string(id);
+    out += ", \"type\": \"" + s.type + "\", \"metric\": \"" + s.metric + "\", \"from\": ";
+    appendJsonString(out, from.data(), from.size());
+    out += ", \"to\": ";
+    appendJsonString(out, to.data(), to.size());
+    out += "}\n";
+}
+
+static void drive(const Settings& s, const vector<string>& names, uint64_t count, unsigned seed,
+                  ConnectionResult& result) {
+    string error;
+    int fd = connectTo(s.endpoint, error);
+    if (fd < 0) {
+        result.failure = error;
+        return;
+    }
+    mt19937 rng(seed);
+    deque<Clock::time_point> inFlight; // responses come back in request order
+    uint64_t sent = 0, received = 0;
+    string out, in;
+    char buf[65536];
+    result.latencies.reserve(count);
+
+    auto top = [&]() {
+        out.clear();
+        while (sent < count && inFlight.size() < s.pipeline) {
+            const string& a = names[rng() % names.size()];
+            const string& b = names[rng() % names.size()];
+            appendRequest(out, sent++, a, b, s);
+            inFlight.push_back(Clock::now());
+        }
+        return out.empty() || sendAll(fd, out);
+    };
+
+    if (!top()) {
+        result.failure = "send failed";
+    }
+    while (result.failure.empty() && received < count) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            result.failure = "server closed the connection";
+            break;
+        }
+        in.append(buf, (size_t)n);
+        size_t start = 0, nl;
+        Clock::time_point now = Clock::now();
+        while ((nl = in.find('\n', start)) != string::npos) {
+            static const char okField[] = "\"ok\": true";
+            if (search(in.begin() + start, in.begin() + nl, okField, okField + 10) == in.begin() + nl) {
+                result.errors++;
+            }
+            result.latencies.push_back(
+                (uint32_t)chrono::duration_cast<chrono::microseconds>(now - inFlight.front()).count());
+            inFlight.pop_front();
+            received++;
+            start = nl + 1;
+        }
+        in.erase(0, start);
+        if (!top()) {
+            result.failure = "send failed";
+        }
+    }
+    close(fd);
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 2) {
+        return usage();
+    }
+    Settings s;
+    string error;
+    if (!parseEndpoint(argv[1], s.endpoint, error)) {
+        cerr << error << endl;
+        return 2;
+    }
+    for (int i = 2; i + 1 < argc; i += 2) {
+        string flag = argv[i], value = argv[i + 1];
+        if (flag == "--connections") {
+            s.connections = (unsigned)max(1, atoi(value.c_str()));
+        } else if (flag == "--pipeline") {
+            s.pipeline = (unsigned)max(1, atoi(value.c_str()));
+        } else if (flag == "--requests") {
+            s.requests = strtoull(value.c_str(), nullptr, 10);
+        } else if (flag == "--metric" && (value == "distance" || value == "time")) {
+            s.metric = value;
+        } else if (flag == "--type" && (value == "route" || value == "cost")) {
+            s.type = value;
+        } else {
+            return usage();
+        }
+    }
+    if (argc % 2 != 0) {
+        return usage();
+    }
+
+    vector<string> names;
+    if (!fetchStations(s.endpoint, names, error)) {
+        cerr << error << endl;
+        return 1;
+    }
+
+    vector<ConnectionResult> results(s.connections);
+    vector<thread> threads;
+    Clock::time_point start = Clock::now();
+    for (unsigned c = 0; c < s.connections; c++) {
+        uint64_t count = s.requests / s.connections + (c < s.requests % s.connections ? 1 : 0);
+        threads.push_back(thread(drive, cref(s), cref(names), count, c + 1, ref(results[c])));
+    }
+    for (thread& t : threads) {
+        t.join();
+    }
+    double seconds = chrono::duration<double>(Clock::now() - start).count();
+
+    vector<uint32_t> all;
+    uint64_t errors = 0;
+    for (const ConnectionResult& r : results) {
+        if (!r.failure.empty()) {
+            cerr << "connection failed: " << r.failure << endl;
+            return 1;
+        }
+        all.insert(all.end(), r.latencies.begin(), r.latencies.end());
+        errors += r.errors;
+    }
+    sort(all.begin(), all.end());
+    auto pct = [&all](double p) {
+        return all.empty() ? 0u : all[min(all.size() - 1, (size_t)(p * all.size()))];
+    };
+
+    cout << "requests     " << all.size() << " (" << errors << " errors)\n"
+         << "connections  " << s.connections << " x pipeline " << s.pipeline << "\n"
+         << "elapsed      " << seconds << " s\n"
+         << "throughput   " << (uint64_t)(all.size() / seconds) << " requests/s\n"
+         << "latency us   p50 " << pct(0.50) << "  p90 " << pct(0.90) << "  p99 " << pct(0.99)
+         << "  max " << (all.empty() ? 0u : all.back()) << endl;
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,129 @@
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include "AllPairs.h"
+#include "CompactGraph.h"
+#include "ContractionHierarchy.h"
+#include "NetworkLoader.h"
+#include "Snapshot.h"
+using namespace std;
+
+// Writes and checks the binary snapshots that metro maps at startup.
+//
+//   snapshot_tool write <network file> <snapshot> [--all-pairs] [--hierarchy]
+//   snapshot_tool validate <snapshot>
+//   snapshot_tool info <snapshot>
+//
+// Build alongside the main binary:
+//   g++ -std=c++11 -O2 -pthread snapshot_tool.cpp -o snapshot_tool
+
+static int usage() {
+    cerr << "usage: snapshot_tool write <network file> <snapshot> [--all-pairs] [--hierarchy]\n"
+         << "       snapshot_tool validate <snapshot>\n"
+         << "       snapshot_tool info <snapshot>" << endl;
+    return 2;
+}
+
+static double secondsSince(chrono::steady_clock::time_point start) {
+    return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static int writeCommand(int argc, char* argv[]) {
+    if (argc < 4) {
+        return usage();
+    }
+    bool withAllPairs = false, withHierarchy = false;
+    for (int i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "--all-pairs") == 0) {
+            withAllPairs = true;
+        } else if (strcmp(argv[i], "--hierarchy") == 0) {
+            withHierarchy = true;
+        } else {
+            return usage();
+        }
+    }
+
+    string error;
+    CompactGraph g;
+    NetworkLoader loader;
+    auto start = chrono::steady_clock::now();
+    if (!loader.loadFile(argv[2], g, error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    cout << "loaded " << g.numVertex() << " stations, " << g.numArcs() / 2 << " edges in "
+         << secondsSince(start) << "s" << endl;
+
+    AllPairsTable allPairs[2];
+    ContractionHierarchy hierarchies[2];
+    SnapshotExtras extras;
+    for (int m = 0; m < 2; m++) {
+        if (withAllPairs) {
+            start = chrono::steady_clock::now();
+            allPairs[m].build(g, (Metric)m);
+            extras.allPairs[m] = &allPairs[m];
+            cout << "all-pairs table " << m << " built in " << secondsSince(start) << "s" << endl;
+        }
+        if (withHierarchy) {
+            start = chrono::steady_clock::now();
+            hierarchies[m].build(g, (Metric)m);
+            extras.hierarchies[m] = &hierarchies[m];
+            cout << "hierarchy " << m << " built in " << secondsSince(start) << "s, "
+                 << hierarchies[m].numShortcuts() << " shortcuts" << endl;
+        }
+    }
+
+    if (!writeSnapshot(argv[3], g, extras, error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    cout << "wrote " << argv[3] << endl;
+    return 0;
+}
+
+static int infoCommand(const Snapshot& snap) {
+    const SnapshotHeader& h = snap.info();
+    cout << "version      " << h.version << "\n"
+         << "stations     " << h.numVertex << "\n"
+         << "edges        " << h.numArcs / 2 << "\n"
+         << "file size    " << h.fileSize << " bytes\n"
+         << "fingerprint  " << hex << h.fingerprint << dec << "\n";
+    const char* metrics[2] = {"distance", "time"};
+    for (int m = 0; m < 2; m++) {
+        cout << metrics[m] << ":" << (snap.hasAllPairs((Metric)m) ? " all-pairs" : "")
+             << (snap.hasHierarchy((Metric)m) ? " hierarchy" : "") << "\n";
+    }
+    return 0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc < 3) {
+        return usage();
+    }
+    string command = argv[1];
+    if (command == "write") {
+        return writeCommand(argc, argv);
+    }
+    if (argc != 3 || (command != "validate" && command != "info")) {
+        return usage();
+    }
+
+    string error;
+    Snapshot snap;
+    if (!snap.open(argv[2], error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    if (command == "info") {
+        return infoCommand(snap);
+    }
+    auto start = chrono::steady_clock::now();
+    if (!snap.verify(error)) {
+        cerr << error << endl;
+        return 1;
+    }
+    cout << argv[2] << ": OK (" << secondsSince(start) << "s)" << endl;
+    return 0;
+}